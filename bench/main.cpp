@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
+#include <boost/numeric/ublas/matrix.hpp>
+
+#include "haifisch/matrix.hpp"
+#include "util/func_benchmark.hpp"
+
+using namespace haifisch;
+
+namespace
+{
+const char* usage =
+    "usage: haifisch_bench [options]\n"
+    "  --sizes=N,...        square problem sizes (default 128,256,512,1024)\n"
+    "  --types=T,...        float, double, int (default float,double)\n"
+    "  --threads=N,...      OpenMP team sizes (default: the runtime default)\n"
+    "  --kernels=K,...      gemm, blocked, strassen, naive, ublas, add, transpose\n"
+    "                       (default gemm,strassen,naive,ublas)\n"
+    "  --slow-max=N         largest size naive and ublas run at (default 512)\n"
+    "  --strassen-cutoff=N  recursion cutoff of the strassen kernel (default 256)\n"
+    "  --warmup=N           discarded runs per case (default 2)\n"
+    "  --reps=N             timed runs per case (default 10)\n"
+    "  --min-time=S         keep sampling until S seconds are spent (default 0)\n"
+    "  --format=F           table, csv or json (default table)\n"
+    "  --output=PATH        write the report to PATH instead of stdout\n"
+    "  --help               print this text and exit\n";
+
+struct config
+{
+    std::vector<std::size_t> sizes { 128, 256, 512, 1024 };
+    std::vector<std::string> types { "float", "double" };
+    std::vector<std::size_t> threads;
+    std::vector<std::string> kernels { "gemm", "strassen", "naive", "ublas" };
+    std::size_t slow_max = 512;
+    std::size_t strassen_cutoff = 256;
+    bench::options sampling;
+    std::string format = "table";
+    std::string output;
+    bool help = false;
+};
+
+struct record
+{
+    std::string kernel;
+    std::string type;
+    std::size_t size;
+    std::size_t threads;
+    bench::statistics stats;
+    double flops;
+    double bytes;
+};
+
+std::vector<std::string> split(std::string_view list)
+{
+    std::vector<std::string> items;
+    std::size_t begin = 0;
+    while (begin <= list.size())
+    {
+        const std::size_t end = std::min(list.find(',', begin), list.size());
+        if (end > begin)
+        {
+            items.emplace_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+std::vector<std::size_t> split_sizes(std::string_view list)
+{
+    std::vector<std::size_t> values;
+    for (const std::string& item : split(list))
+    {
+        values.push_back(std::stoul(item));
+    }
+    return values;
+}
+
+/// False on an unknown option or a malformed value.
+bool parse(int argc, char* argv[], config& cfg)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        const std::size_t eq = arg.find('=');
+        const std::string_view key = arg.substr(0, eq);
+        const std::string_view value = eq == std::string_view::npos ? std::string_view {} : arg.substr(eq + 1);
+
+        try
+        {
+            if      (key == "--sizes")           cfg.sizes = split_sizes(value);
+            else if (key == "--types")           cfg.types = split(value);
+            else if (key == "--threads")         cfg.threads = split_sizes(value);
+            else if (key == "--kernels")         cfg.kernels = split(value);
+            else if (key == "--slow-max")        cfg.slow_max = std::stoul(std::string { value });
+            else if (key == "--strassen-cutoff") cfg.strassen_cutoff = std::stoul(std::string { value });
+            else if (key == "--warmup")          cfg.sampling.warmup = std::stoul(std::string { value });
+            else if (key == "--reps")            cfg.sampling.repetitions = std::stoul(std::string { value });
+            else if (key == "--min-time")        cfg.sampling.min_time = std::stod(std::string { value });
+            else if (key == "--format")          cfg.format = value;
+            else if (key == "--output")          cfg.output = value;
+            else if (key == "--help")            cfg.help = true;
+            else return false;
+        }
+        catch (const std::invalid_argument&)
+        {
+            std::cerr << "invalid value: " << arg << '\n';
+            return false;
+        }
+        catch (const std::out_of_range&)
+        {
+            std::cerr << "value out of range: " << arg << '\n';
+            return false;
+        }
+    }
+
+    const auto known = [](const std::vector<std::string>& items, std::initializer_list<std::string_view> names)
+    {
+        return std::all_of(items.begin(), items.end(), [&](const std::string& item)
+        {
+            return std::find(names.begin(), names.end(), item) != names.end();
+        });
+    };
+    return known(cfg.types, { "float", "double", "int" })
+        && known(cfg.kernels, { "gemm", "blocked", "strassen", "naive", "ublas", "add", "transpose" })
+        && known({ cfg.format }, { "table", "csv", "json" });
+}
+
+template <typename T>
+void fill(matrix<T>& mat, std::size_t seed)
+{
+    for (std::size_t i = 0; i < mat.width() * mat.height(); ++i)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        mat.data()[i] = static_cast<T>((seed >> 33) % 17) - static_cast<T>(8);
+    }
+}
+
+/// Times one kernel at one size; returns false for the slow reference
+/// kernels past slow_max.
+template <typename T>
+bool run_case(const config& cfg, const std::string& kernel, std::size_t n, record& out)
+{
+    if ((kernel == "naive" || kernel == "ublas") && n > cfg.slow_max)
+    {
+        return false;
+    }
+
+    matrix<T> a(n, n);
+    matrix<T> b(n, n);
+    matrix<T> c(n, n);
+    fill(a, n);
+    fill(b, n + 1);
+
+    const double elements = static_cast<double>(n) * static_cast<double>(n);
+    const double product_flops = 2.0 * elements * static_cast<double>(n);
+    const double product_bytes = 3.0 * elements * sizeof(T);
+
+    std::function<void()> body;
+    out.flops = product_flops;
+    out.bytes = product_bytes;
+
+    if (kernel == "gemm")
+    {
+        body = [&] { gemm(T { 1 }, a, b, T {}, c); };
+    }
+    else if (kernel == "blocked")
+    {
+        body = [&] { bench::do_not_optimize(blocked_mul_impl<T>().process(a, b)); };
+    }
+    else if (kernel == "strassen")
+    {
+        body = [&] { bench::do_not_optimize(strassen_mul_impl<T>(cfg.strassen_cutoff).process(a, b)); };
+    }
+    else if (kernel == "naive")
+    {
+        body = [&] { bench::do_not_optimize(naive_mul_impl<T>().process(a, b)); };
+    }
+    else if (kernel == "ublas")
+    {
+        boost::numeric::ublas::matrix<T> ua(n, n);
+        boost::numeric::ublas::matrix<T> ub(n, n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                ua(i, j) = a(i, j);
+                ub(i, j) = b(i, j);
+            }
+        }
+        boost::numeric::ublas::matrix<T> uc(n, n);
+        out.stats = bench::measure(cfg.sampling, [&] { uc = boost::numeric::ublas::prod(ua, ub); });
+        bench::do_not_optimize(uc);
+        return true;
+    }
+    else if (kernel == "add")
+    {
+        c = a;
+        body = [&] { c += b; };
+        out.flops = elements;
+        out.bytes = 3.0 * elements * sizeof(T);
+    }
+    else
+    {
+        body = [&] { transpose(a.view(), c.view()); };
+        out.flops = 0;
+        out.bytes = 2.0 * elements * sizeof(T);
+    }
+
+    out.stats = bench::measure(cfg.sampling, body);
+    bench::do_not_optimize(c);
+    return true;
+}
+
+bool run_type(const config& cfg, const std::string& type, const std::string& kernel, std::size_t n, record& out)
+{
+    if (type == "float")  return run_case<float>(cfg, kernel, n, out);
+    if (type == "double") return run_case<double>(cfg, kernel, n, out);
+    return run_case<int>(cfg, kernel, n, out);
+}
+
+double gflops(const record& r)
+{
+    return r.flops / r.stats.median * 1e-9;
+}
+
+double gbytes(const record& r)
+{
+    return r.bytes / r.stats.median * 1e-9;
+}
+
+std::string_view isa_name()
+{
+    switch (simd::active_isa())
+    {
+        case simd::isa::avx512: return "avx512";
+        case simd::isa::avx2:   return "avx2";
+        case simd::isa::sse2:   return "sse2";
+        default:                return "generic";
+    }
+}
+
+void report_table(std::ostream& os, const std::vector<record>& records)
+{
+    os << std::left << std::setw(10) << "kernel" << std::setw(8) << "type" << std::right
+       << std::setw(7) << "size" << std::setw(8) << "threads"
+       << std::setw(13) << "median ms" << std::setw(13) << "p95 ms" << std::setw(12) << "stddev %"
+       << std::setw(10) << "GFLOP/s" << std::setw(9) << "GB/s" << std::setw(10) << "outliers" << '\n';
+    os << std::fixed;
+    for (const record& r : records)
+    {
+        os << std::left << std::setw(10) << r.kernel << std::setw(8) << r.type << std::right
+           << std::setw(7) << r.size << std::setw(8) << r.threads
+           << std::setprecision(3) << std::setw(13) << r.stats.median * 1e3 << std::setw(13) << r.stats.p95 * 1e3
+           << std::setprecision(2) << std::setw(12) << 100.0 * r.stats.stddev / r.stats.mean
+           << std::setw(10) << gflops(r) << std::setw(9) << gbytes(r)
+           << std::setw(10) << r.stats.outliers << '\n';
+    }
+}
+
+void report_csv(std::ostream& os, const std::vector<record>& records)
+{
+    os << "kernel,type,size,threads,samples,outliers,min_s,median_s,p95_s,max_s,mean_s,stddev_s,gflops,gbytes_per_s\n";
+    os << std::setprecision(9);
+    for (const record& r : records)
+    {
+        os << r.kernel << ',' << r.type << ',' << r.size << ',' << r.threads << ','
+           << r.stats.samples << ',' << r.stats.outliers << ','
+           << r.stats.min << ',' << r.stats.median << ',' << r.stats.p95 << ',' << r.stats.max << ','
+           << r.stats.mean << ',' << r.stats.stddev << ',' << gflops(r) << ',' << gbytes(r) << '\n';
+    }
+}
+
+void report_json(std::ostream& os, const std::vector<record>& records)
+{
+    os << std::setprecision(9);
+    os << "{\n  \"benchmark\": \"haifisch_bench\",\n  \"isa\": \"" << isa_name() << "\",\n  \"results\": [";
+    for (std::size_t i = 0; i < records.size(); ++i)
+    {
+        const record& r = records[i];
+        os << (i == 0 ? "\n" : ",\n")
+           << "    { \"kernel\": \"" << r.kernel << "\", \"type\": \"" << r.type << "\", \"size\": " << r.size
+           << ", \"threads\": " << r.threads << ", \"samples\": " << r.stats.samples
+           << ", \"outliers\": " << r.stats.outliers
+           << ", \"min_s\": " << r.stats.min << ", \"median_s\": " << r.stats.median
+           << ", \"p95_s\": " << r.stats.p95 << ", \"max_s\": " << r.stats.max
+           << ", \"mean_s\": " << r.stats.mean << ", \"stddev_s\": " << r.stats.stddev
+           << ", \"gflops\": " << gflops(r) << ", \"gbytes_per_s\": " << gbytes(r) << " }";
+    }
+    os << "\n  ]\n}\n";
+}
+
+std::size_t default_threads()
+{
+#ifdef _OPENMP
+    return static_cast<std::size_t>(omp_get_max_threads());
+#else
+    return 1;
+#endif // _OPENMP
+}
+
+void set_threads(std::size_t threads)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(static_cast<int>(threads));
+#else
+    (void) threads;
+#endif // _OPENMP
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    config cfg;
+    if (!parse(argc, argv, cfg))
+    {
+        std::cerr << usage;
+        return EXIT_FAILURE;
+    }
+    if (cfg.help)
+    {
+        std::cout << usage;
+        return EXIT_SUCCESS;
+    }
+    if (cfg.threads.empty())
+    {
+        cfg.threads.push_back(default_threads());
+    }
+
+    std::vector<record> records;
+    for (const std::size_t threads : cfg.threads)
+    {
+        set_threads(threads);
+        for (const std::string& type : cfg.types)
+        {
+            for (const std::string& kernel : cfg.kernels)
+            {
+                for (const std::size_t n : cfg.sizes)
+                {
+                    record r { kernel, type, n, threads, {}, 0, 0 };
+                    if (run_type(cfg, type, kernel, n, r))
+                    {
+                        records.push_back(r);
+                        std::cerr << kernel << ' ' << type << ' ' << n << " x" << threads << ": " << r.stats << '\n';
+                    }
+                }
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!cfg.output.empty())
+    {
+        file.open(cfg.output);
+        if (!file)
+        {
+            std::cerr << "cannot open " << cfg.output << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    std::ostream& os = cfg.output.empty() ? std::cout : file;
+
+    if      (cfg.format == "csv")  report_csv(os, records);
+    else if (cfg.format == "json") report_json(os, records);
+    else                           report_table(os, records);
+
+    return EXIT_SUCCESS;
+}
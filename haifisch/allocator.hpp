@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef HAIFISCH_ALLOCATOR_HPP
+#define HAIFISCH_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif // __linux__
+
+
+namespace haifisch
+{
+/// Placement choices of aligned_allocator.
+///
+/// Alignment is the minimum alignment of every block. Blocks of at least
+/// huge_page_threshold bytes are aligned to 2 MiB and, with HugePages,
+/// advised for transparent huge pages so large matrices need fewer TLB
+/// entries. With FirstTouch such blocks are zeroed by an OpenMP team
+/// before use; on Linux a page lands on the NUMA node of the thread that
+/// first writes it, so the static schedule of the kernels later finds its
+/// rows local (as long as threads are pinned, e.g. OMP_PROC_BIND=close).
+template <std::size_t Alignment = 64, bool HugePages = true, bool FirstTouch = true>
+struct storage_policy
+{
+    static_assert((Alignment & (Alignment - 1)) == 0, "alignment must be a power of two");
+
+    static constexpr std::size_t alignment = Alignment;
+    static constexpr bool huge_pages = HugePages;
+    static constexpr bool first_touch = FirstTouch;
+
+    static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+    static constexpr std::size_t huge_page_threshold = 4 * 1024 * 1024;
+    static constexpr std::size_t page_size = 4096;
+};
+
+/// Standard allocator handing out storage placed according to Policy.
+template <typename T, typename Policy = storage_policy<>>
+class aligned_allocator
+{
+public:
+    using value_type = T;
+    using policy_type = Policy;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = aligned_allocator<U, Policy>;
+    };
+
+    aligned_allocator() noexcept = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Policy>&) noexcept
+    { }
+
+    T* allocate(std::size_t n)
+    {
+        const std::size_t bytes = n * sizeof(T);
+        if (!is_large(bytes))
+        {
+            return static_cast<T*>(::operator new(bytes, std::align_val_t { alignment(bytes) }));
+        }
+
+        const std::size_t rounded = round_to_huge_pages(bytes);
+        void* ptr = ::operator new(rounded, std::align_val_t { alignment(bytes) });
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if constexpr (Policy::huge_pages)
+        {
+            madvise(ptr, rounded, MADV_HUGEPAGE);
+        }
+#endif // __linux__ && MADV_HUGEPAGE
+        if constexpr (Policy::first_touch)
+        {
+            touch(static_cast<char*>(ptr), rounded);
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept
+    {
+        const std::size_t bytes = n * sizeof(T);
+        ::operator delete(ptr, std::align_val_t { alignment(bytes) });
+    }
+
+    template <typename U>
+    bool operator == (const aligned_allocator<U, Policy>&) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator != (const aligned_allocator<U, Policy>&) const noexcept
+    {
+        return false;
+    }
+
+private:
+    static constexpr bool is_large(std::size_t bytes) noexcept
+    {
+        return bytes >= Policy::huge_page_threshold;
+    }
+
+    static constexpr std::size_t alignment(std::size_t bytes) noexcept
+    {
+        const std::size_t natural = alignof(T) > Policy::alignment ? alignof(T) : Policy::alignment;
+        return is_large(bytes) && natural < Policy::huge_page_size ? Policy::huge_page_size : natural;
+    }
+
+    static constexpr std::size_t round_to_huge_pages(std::size_t bytes) noexcept
+    {
+        return (bytes + Policy::huge_page_size - 1) / Policy::huge_page_size * Policy::huge_page_size;
+    }
+
+    /// Zeroes the block page by page, every thread taking one contiguous
+    /// share like the static schedules of the kernels do.
+    static void touch(char* ptr, std::size_t bytes) noexcept
+    {
+        const std::size_t pages = bytes / Policy::page_size;
+
+        #pragma omp parallel for schedule(static)
+        for (std::size_t page = 0; page < pages; ++page)
+        {
+            std::memset(ptr + page * Policy::page_size, 0, Policy::page_size);
+        }
+    }
+};
+} // namespace haifisch
+
+#endif // HAIFISCH_ALLOCATOR_HPP
@@ -0,0 +1,347 @@
+#pragma once
+
+#ifndef HAIFISCH_BATCH_HPP
+#define HAIFISCH_BATCH_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "blas.hpp"
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+/// Non-owning batch of equally shaped matrices laid out at a fixed
+/// distance from each other. Entry i is the view
+/// matrix_view(data + i * batch_stride, width, height, stride). A batch
+/// stride of zero repeats one matrix for every entry, e.g. shared weights.
+template <typename T>
+class matrix_batch
+{
+public:
+    constexpr matrix_batch(T* data_, std::size_t cols_, std::size_t rows_, std::size_t count_,
+                           std::size_t stride_, std::size_t batch_stride_) noexcept
+        : ptr(data_)
+        , cols(cols_)
+        , rows(rows_)
+        , entries(count_)
+        , ld(stride_)
+        , step(batch_stride_)
+    { }
+    /// Densely packed batch: every matrix contiguous, one after the other.
+    constexpr matrix_batch(T* data_, std::size_t cols_, std::size_t rows_, std::size_t count_) noexcept
+        : matrix_batch(data_, cols_, rows_, count_, cols_, cols_ * rows_)
+    { }
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    constexpr matrix_batch(const matrix_batch<U>& other) noexcept
+        : matrix_batch(other.data(), other.width(), other.height(), other.size(), other.stride(), other.batch_stride())
+    { }
+
+    [[gnu::always_inline]] inline constexpr T* data() const noexcept
+    {
+        return ptr;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t width() const noexcept
+    {
+        return cols;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t height() const noexcept
+    {
+        return rows;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t size() const noexcept
+    {
+        return entries;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t stride() const noexcept
+    {
+        return ld;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t batch_stride() const noexcept
+    {
+        return step;
+    }
+    [[gnu::always_inline]] inline constexpr matrix_view<T> operator [] (std::size_t index) const noexcept
+    {
+        assert(index < entries);
+        return matrix_view<T>(ptr + index * step, cols, rows, ld);
+    }
+
+private:
+    T* ptr;
+    std::size_t cols;
+    std::size_t rows;
+    std::size_t entries;
+    std::size_t ld;
+    std::size_t step;
+};
+
+namespace detail
+{
+/// Products with a dimension above this go through the packed GEMM engine,
+/// one entry per thread; smaller ones are computed straight from memory.
+constexpr std::size_t batch_small_limit = 64;
+
+/// Rows [i0, i0 + MF * W) of C = A * B + beta * C for column-major
+/// operands. Columns of C are computed in pairs, so every vector of A
+/// loaded from L1 feeds two accumulators; 2 * MF accumulators stay in
+/// registers across the whole k loop.
+template <typename T, std::size_t W, std::size_t MF>
+[[gnu::always_inline]] inline void small_gemm_panel(std::size_t i0, std::size_t n, std::size_t k,
+                                                    const T* a, std::size_t lda,
+                                                    const T* b, std::size_t ldb,
+                                                    T* c, std::size_t ldc, T beta) noexcept
+{
+    using vec_t = typename simd::simd_vector<T, W>::type;
+
+    auto store = [beta](T* dst, const vec_t& acc) {
+        vec_t result = acc;
+        if (beta != T {})
+        {
+            vec_t old;
+            std::memcpy(&old, dst, sizeof(vec_t));
+            result += old * beta;
+        }
+        std::memcpy(dst, &result, sizeof(vec_t));
+    };
+
+    std::size_t j = 0;
+    for (; j + 2 <= n; j += 2)
+    {
+        vec_t acc0[MF] = {};
+        vec_t acc1[MF] = {};
+        const T* b0 = b + j * ldb;
+        const T* b1 = b0 + ldb;
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            const T* column = a + p * lda + i0;
+            for (std::size_t f = 0; f < MF; ++f)
+            {
+                vec_t av;
+                std::memcpy(&av, column + f * W, sizeof(vec_t));
+                acc0[f] += av * b0[p];
+                acc1[f] += av * b1[p];
+            }
+        }
+        for (std::size_t f = 0; f < MF; ++f)
+        {
+            store(c + j * ldc + i0 + f * W, acc0[f]);
+            store(c + (j + 1) * ldc + i0 + f * W, acc1[f]);
+        }
+    }
+    if (j < n)
+    {
+        vec_t acc[MF] = {};
+        const T* b0 = b + j * ldb;
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            const T* column = a + p * lda + i0;
+            for (std::size_t f = 0; f < MF; ++f)
+            {
+                vec_t av;
+                std::memcpy(&av, column + f * W, sizeof(vec_t));
+                acc[f] += av * b0[p];
+            }
+        }
+        for (std::size_t f = 0; f < MF; ++f)
+        {
+            store(c + j * ldc + i0 + f * W, acc[f]);
+        }
+    }
+}
+
+/// Rows [i0, m) of C = A * B + beta * C: panels of four, two and one
+/// vectors of W elements, then the remaining rows with vectors half as
+/// wide, down to scalars.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void small_gemm_rows(std::size_t i0, std::size_t m, std::size_t n, std::size_t k,
+                                                   const T* a, std::size_t lda,
+                                                   const T* b, std::size_t ldb,
+                                                   T* c, std::size_t ldc, T beta) noexcept
+{
+    if constexpr (W == 1)
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            for (std::size_t i = i0; i < m; ++i)
+            {
+                T sum = {};
+                for (std::size_t p = 0; p < k; ++p)
+                {
+                    sum += a[p * lda + i] * b[j * ldb + p];
+                }
+                c[j * ldc + i] = beta == T {} ? sum : sum + beta * c[j * ldc + i];
+            }
+        }
+    }
+    else
+    {
+        for (; i0 + 4 * W <= m; i0 += 4 * W)
+        {
+            small_gemm_panel<T, W, 4>(i0, n, k, a, lda, b, ldb, c, ldc, beta);
+        }
+        if (i0 + 2 * W <= m)
+        {
+            small_gemm_panel<T, W, 2>(i0, n, k, a, lda, b, ldb, c, ldc, beta);
+            i0 += 2 * W;
+        }
+        if (i0 + W <= m)
+        {
+            small_gemm_panel<T, W, 1>(i0, n, k, a, lda, b, ldb, c, ldc, beta);
+            i0 += W;
+        }
+        if (i0 < m)
+        {
+            small_gemm_rows<T, W / 2>(i0, m, n, k, a, lda, b, ldb, c, ldc, beta);
+        }
+    }
+}
+
+/// Batch entries [first, last) of the small-product path.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void small_batch_entries(std::size_t first, std::size_t last,
+                                                       std::size_t m, std::size_t n, std::size_t k,
+                                                       const T* a, std::size_t lda, std::size_t sa,
+                                                       const T* b, std::size_t ldb, std::size_t sb,
+                                                       T* c, std::size_t ldc, std::size_t sc, T beta) noexcept
+{
+    for (std::size_t e = first; e < last; ++e)
+    {
+        small_gemm_rows<T, W>(0, m, n, k, a + e * sa, lda, b + e * sb, ldb, c + e * sc, ldc, beta);
+    }
+}
+
+/// Square 4, 8 and 16 are passed as constants, so the kernel is unrolled
+/// for them; every other shape runs the same code with runtime bounds.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void small_batch_body(std::size_t first, std::size_t last,
+                                                    std::size_t m, std::size_t n, std::size_t k,
+                                                    const T* a, std::size_t lda, std::size_t sa,
+                                                    const T* b, std::size_t ldb, std::size_t sb,
+                                                    T* c, std::size_t ldc, std::size_t sc, T beta) noexcept
+{
+    if (m == n && n == k)
+    {
+        switch (m)
+        {
+            case 4:  return small_batch_entries<T, W>(first, last, 4, 4, 4, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+            case 8:  return small_batch_entries<T, W>(first, last, 8, 8, 8, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+            case 16: return small_batch_entries<T, W>(first, last, 16, 16, 16, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+            default: break;
+        }
+    }
+    small_batch_entries<T, W>(first, last, m, n, k, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+}
+
+template <typename T>
+using small_batch_kernel_t = void (*)(std::size_t, std::size_t, std::size_t, std::size_t, std::size_t,
+                                      const T*, std::size_t, std::size_t,
+                                      const T*, std::size_t, std::size_t,
+                                      T*, std::size_t, std::size_t, T) noexcept;
+
+template <typename T>
+void small_batch_generic(std::size_t first, std::size_t last, std::size_t m, std::size_t n, std::size_t k,
+                         const T* a, std::size_t lda, std::size_t sa,
+                         const T* b, std::size_t ldb, std::size_t sb,
+                         T* c, std::size_t ldc, std::size_t sc, T beta) noexcept
+{
+    small_batch_body<T, vector_elements<T, simd::isa::generic>>(first, last, m, n, k, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void small_batch_avx2(std::size_t first, std::size_t last, std::size_t m, std::size_t n, std::size_t k,
+                      const T* a, std::size_t lda, std::size_t sa,
+                      const T* b, std::size_t ldb, std::size_t sb,
+                      T* c, std::size_t ldc, std::size_t sc, T beta) noexcept
+{
+    small_batch_body<T, vector_elements<T, simd::isa::avx2>>(first, last, m, n, k, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+void small_batch_avx512(std::size_t first, std::size_t last, std::size_t m, std::size_t n, std::size_t k,
+                        const T* a, std::size_t lda, std::size_t sa,
+                        const T* b, std::size_t ldb, std::size_t sb,
+                        T* c, std::size_t ldc, std::size_t sc, T beta) noexcept
+{
+    small_batch_body<T, vector_elements<T, simd::isa::avx512>>(first, last, m, n, k, a, lda, sa, b, ldb, sb, c, ldc, sc, beta);
+}
+#endif // HAIFISCH_X86
+
+template <typename T>
+small_batch_kernel_t<T> small_batch_kernel() noexcept
+{
+#ifdef HAIFISCH_X86
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+            case simd::isa::avx512: return small_batch_avx512<T>;
+            case simd::isa::avx2:   return small_batch_avx2<T>;
+            default:                break;
+        }
+    }
+#endif // HAIFISCH_X86
+    return small_batch_generic<T>;
+}
+} // namespace detail
+
+/// c[i] = a[i] * b[i] + beta * c[i] for every entry of the batches, with
+/// c[i](x, y) the sum over p of a[i](x, p) * b[i](p, y). c is not read when
+/// beta is zero, and its entries must not overlap.
+///
+/// The entries, not the products, are shared among the OpenMP threads.
+/// Entries up to 64 in every dimension are multiplied in registers
+/// straight from memory, without packing; larger ones go through the GEMM
+/// engine, single-threaded within their entry.
+template <typename A, typename B, typename T>
+void batched_multiply(matrix_batch<A> a, matrix_batch<B> b, matrix_batch<T> c, T beta = T {})
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T> && std::is_same_v<std::remove_const_t<B>, T>,
+                  "operands must share the element type");
+    assert(a.height() == b.width());
+    assert(c.width() == a.width());
+    assert(c.height() == b.height());
+    assert(a.size() == c.size() && b.size() == c.size());
+
+    const std::size_t m = a.width();
+    const std::size_t k = a.height();
+    const std::size_t n = b.height();
+    const std::size_t count = c.size();
+    const bool parallel = count > 1 && count * m * n * k >= detail::gemm_parallel_threshold;
+
+    const T* a_data = a.data();
+    const T* b_data = b.data();
+
+    if (std::max({ m, n, k }) > detail::batch_small_limit)
+    {
+        detail::parallel_ranges(count, 1, parallel, [&](std::size_t first, std::size_t last) {
+            for (std::size_t e = first; e < last; ++e)
+            {
+                detail::gemm(m, n, k, a_data + e * a.batch_stride(), a.stride(),
+                             b_data + e * b.batch_stride(), b.stride(),
+                             c.data() + e * c.batch_stride(), c.stride(), beta);
+            }
+        });
+        return;
+    }
+
+    const detail::small_batch_kernel_t<T> kernel = detail::small_batch_kernel<T>();
+    detail::parallel_ranges(count, 1, parallel, [&](std::size_t first, std::size_t last) {
+        kernel(first, last, m, n, k,
+               a_data, a.stride(), a.batch_stride(),
+               b_data, b.stride(), b.batch_stride(),
+               c.data(), c.stride(), c.batch_stride(), beta);
+    });
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_BATCH_HPP
@@ -0,0 +1,467 @@
+#pragma once
+
+#ifndef HAIFISCH_BLAS_HPP
+#define HAIFISCH_BLAS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
+#include "gemm.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+
+
+namespace haifisch
+{
+namespace detail
+{
+/// Level 1 and 2 kernels below this many elements stay on the calling thread.
+constexpr std::size_t blas_parallel_threshold = 1 << 15;
+
+/// Bytes of y one gemv pass updates: the strip stays in L1 while four
+/// columns of A at a time stream past it.
+constexpr std::size_t gemv_strip_bytes = 8 * 1024;
+
+/// Columns of A combined per pass over a strip of y, or dotted with x per
+/// pass in gemv_t; each element of y or x is then loaded once per four
+/// columns.
+constexpr std::size_t gemv_columns = 4;
+
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline T horizontal_sum(const typename simd::simd_vector<T, W>::type& v) noexcept
+{
+    T sum = {};
+    for (std::size_t l = 0; l < W; ++l)
+    {
+        sum += v[l];
+    }
+    return sum;
+}
+
+/// y[first:last] = alpha * A[first:last, :] x + beta * y[first:last] for
+/// column-major A (m x n). y is not read when beta is zero.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void gemv_body(std::size_t n, T alpha, const T* a, std::size_t lda, const T* x,
+                                             T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    constexpr std::size_t strip = std::max<std::size_t>(gemv_strip_bytes / sizeof(T) / W * W, W);
+
+    for (std::size_t i0 = first; i0 < last; i0 += strip)
+    {
+        const std::size_t i1 = std::min(last, i0 + strip);
+        const std::size_t vector_end = i1 - (i1 - i0) % W;
+
+        for (std::size_t i = i0; i < i1; ++i)
+        {
+            y[i] = beta == T {} ? T {} : beta * y[i];
+        }
+
+        std::size_t j = 0;
+        for (; j + gemv_columns <= n; j += gemv_columns)
+        {
+            const T x0 = alpha * x[j];
+            const T x1 = alpha * x[j + 1];
+            const T x2 = alpha * x[j + 2];
+            const T x3 = alpha * x[j + 3];
+            const T* c0 = a + j * lda;
+            const T* c1 = c0 + lda;
+            const T* c2 = c1 + lda;
+            const T* c3 = c2 + lda;
+
+            std::size_t i = i0;
+            if constexpr (is_vectorizable_v<T>)
+            {
+                using vec_t = typename simd::simd_vector<T, W>::type;
+                for (; i < vector_end; i += W)
+                {
+                    vec_t acc, v0, v1, v2, v3;
+                    std::memcpy(&acc, y + i, sizeof(vec_t));
+                    std::memcpy(&v0, c0 + i, sizeof(vec_t));
+                    std::memcpy(&v1, c1 + i, sizeof(vec_t));
+                    std::memcpy(&v2, c2 + i, sizeof(vec_t));
+                    std::memcpy(&v3, c3 + i, sizeof(vec_t));
+                    acc += v0 * x0;
+                    acc += v1 * x1;
+                    acc += v2 * x2;
+                    acc += v3 * x3;
+                    std::memcpy(y + i, &acc, sizeof(vec_t));
+                }
+            }
+            for (; i < i1; ++i)
+            {
+                y[i] += c0[i] * x0 + c1[i] * x1 + c2[i] * x2 + c3[i] * x3;
+            }
+        }
+        for (; j < n; ++j)
+        {
+            const T xj = alpha * x[j];
+            const T* column = a + j * lda;
+            for (std::size_t i = i0; i < i1; ++i)
+            {
+                y[i] += column[i] * xj;
+            }
+        }
+    }
+}
+
+/// y[first:last] = alpha * A[:, first:last]^T x + beta * y[first:last] for
+/// column-major A (m x n): every y[j] is the dot product of column j with x.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void gemv_t_body(std::size_t m, T alpha, const T* a, std::size_t lda, const T* x,
+                                               T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    const std::size_t vector_end = m - m % W;
+
+    std::size_t j = first;
+    for (; j + gemv_columns <= last; j += gemv_columns)
+    {
+        const T* c0 = a + j * lda;
+        const T* c1 = c0 + lda;
+        const T* c2 = c1 + lda;
+        const T* c3 = c2 + lda;
+        T s0 = {}, s1 = {}, s2 = {}, s3 = {};
+
+        std::size_t i = 0;
+        if constexpr (is_vectorizable_v<T>)
+        {
+            using vec_t = typename simd::simd_vector<T, W>::type;
+            vec_t acc0 = {}, acc1 = {}, acc2 = {}, acc3 = {};
+            for (; i < vector_end; i += W)
+            {
+                vec_t xv, v0, v1, v2, v3;
+                std::memcpy(&xv, x + i, sizeof(vec_t));
+                std::memcpy(&v0, c0 + i, sizeof(vec_t));
+                std::memcpy(&v1, c1 + i, sizeof(vec_t));
+                std::memcpy(&v2, c2 + i, sizeof(vec_t));
+                std::memcpy(&v3, c3 + i, sizeof(vec_t));
+                acc0 += v0 * xv;
+                acc1 += v1 * xv;
+                acc2 += v2 * xv;
+                acc3 += v3 * xv;
+            }
+            s0 = horizontal_sum<T, W>(acc0);
+            s1 = horizontal_sum<T, W>(acc1);
+            s2 = horizontal_sum<T, W>(acc2);
+            s3 = horizontal_sum<T, W>(acc3);
+        }
+        for (; i < m; ++i)
+        {
+            s0 += c0[i] * x[i];
+            s1 += c1[i] * x[i];
+            s2 += c2[i] * x[i];
+            s3 += c3[i] * x[i];
+        }
+
+        y[j]     = alpha * s0 + (beta == T {} ? T {} : beta * y[j]);
+        y[j + 1] = alpha * s1 + (beta == T {} ? T {} : beta * y[j + 1]);
+        y[j + 2] = alpha * s2 + (beta == T {} ? T {} : beta * y[j + 2]);
+        y[j + 3] = alpha * s3 + (beta == T {} ? T {} : beta * y[j + 3]);
+    }
+    for (; j < last; ++j)
+    {
+        const T* column = a + j * lda;
+        T sum = {};
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            sum += column[i] * x[i];
+        }
+        y[j] = alpha * sum + (beta == T {} ? T {} : beta * y[j]);
+    }
+}
+
+/// y += alpha * x over n elements.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void axpy_body(std::size_t n, T alpha, const T* x, T* y) noexcept
+{
+    std::size_t i = 0;
+    if constexpr (is_vectorizable_v<T>)
+    {
+        using vec_t = typename simd::simd_vector<T, W>::type;
+        constexpr std::size_t U = 4 * W;
+        const std::size_t vector_end = n - n % U;
+        for (; i < vector_end; i += U)
+        {
+            vec_t xv[4], yv[4];
+            std::memcpy(xv, x + i, sizeof(xv));
+            std::memcpy(yv, y + i, sizeof(yv));
+            for (std::size_t u = 0; u < 4; ++u)
+            {
+                yv[u] += xv[u] * alpha;
+            }
+            std::memcpy(y + i, yv, sizeof(yv));
+        }
+    }
+    for (; i < n; ++i)
+    {
+        y[i] += alpha * x[i];
+    }
+}
+
+/// Sum of x[i] * y[i] over n elements, with four independent accumulators.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline T dot_body(std::size_t n, const T* x, const T* y) noexcept
+{
+    T sum = {};
+    std::size_t i = 0;
+    if constexpr (is_vectorizable_v<T>)
+    {
+        using vec_t = typename simd::simd_vector<T, W>::type;
+        constexpr std::size_t U = 4 * W;
+        const std::size_t vector_end = n - n % U;
+        vec_t acc[4] = {};
+        for (; i < vector_end; i += U)
+        {
+            vec_t xv[4], yv[4];
+            std::memcpy(xv, x + i, sizeof(xv));
+            std::memcpy(yv, y + i, sizeof(yv));
+            for (std::size_t u = 0; u < 4; ++u)
+            {
+                acc[u] += xv[u] * yv[u];
+            }
+        }
+        sum = horizontal_sum<T, W>((acc[0] + acc[1]) + (acc[2] + acc[3]));
+    }
+    for (; i < n; ++i)
+    {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+template <typename T>
+using gemv_kernel_t = void (*)(std::size_t, T, const T*, std::size_t, const T*, T, T*, std::size_t, std::size_t) noexcept;
+
+template <typename T>
+void gemv_generic(std::size_t n, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_body<T, vector_elements<T, simd::isa::generic>>(n, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+void gemv_t_generic(std::size_t m, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_t_body<T, vector_elements<T, simd::isa::generic>>(m, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+void axpy_generic(std::size_t n, T alpha, const T* x, T* y) noexcept
+{
+    axpy_body<T, vector_elements<T, simd::isa::generic>>(n, alpha, x, y);
+}
+
+template <typename T>
+T dot_generic(std::size_t n, const T* x, const T* y) noexcept
+{
+    return dot_body<T, vector_elements<T, simd::isa::generic>>(n, x, y);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void gemv_avx2(std::size_t n, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_body<T, vector_elements<T, simd::isa::avx2>>(n, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void gemv_t_avx2(std::size_t m, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_t_body<T, vector_elements<T, simd::isa::avx2>>(m, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void axpy_avx2(std::size_t n, T alpha, const T* x, T* y) noexcept
+{
+    axpy_body<T, vector_elements<T, simd::isa::avx2>>(n, alpha, x, y);
+}
+
+template <typename T>
+[[gnu::target("avx2,fma")]]
+T dot_avx2(std::size_t n, const T* x, const T* y) noexcept
+{
+    return dot_body<T, vector_elements<T, simd::isa::avx2>>(n, x, y);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+void gemv_avx512(std::size_t n, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_body<T, vector_elements<T, simd::isa::avx512>>(n, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+void gemv_t_avx512(std::size_t m, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y, std::size_t first, std::size_t last) noexcept
+{
+    gemv_t_body<T, vector_elements<T, simd::isa::avx512>>(m, alpha, a, lda, x, beta, y, first, last);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+void axpy_avx512(std::size_t n, T alpha, const T* x, T* y) noexcept
+{
+    axpy_body<T, vector_elements<T, simd::isa::avx512>>(n, alpha, x, y);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+T dot_avx512(std::size_t n, const T* x, const T* y) noexcept
+{
+    return dot_body<T, vector_elements<T, simd::isa::avx512>>(n, x, y);
+}
+#endif // HAIFISCH_X86
+
+/// Splits [0, size) into one contiguous share per OpenMP thread, each a
+/// multiple of grain long, and runs f(first, last) on it.
+template <typename F>
+void parallel_ranges(std::size_t size, std::size_t grain, bool parallel, F&& f)
+{
+    if (!parallel)
+    {
+        f(std::size_t { 0 }, size);
+        return;
+    }
+
+    HAIFISCH_PROFILE_TEAM(team);
+    #pragma omp parallel
+    {
+        HAIFISCH_PROFILE_MEMBER(team);
+        std::size_t threads = 1;
+        std::size_t thread = 0;
+#ifdef _OPENMP
+        threads = static_cast<std::size_t>(omp_get_num_threads());
+        thread = static_cast<std::size_t>(omp_get_thread_num());
+#endif // _OPENMP
+        const std::size_t share = round_up((size + threads - 1) / threads, grain);
+        const std::size_t first = std::min(size, thread * share);
+        const std::size_t last = std::min(size, first + share);
+        if (first < last)
+        {
+            f(first, last);
+        }
+    }
+}
+
+/// y = alpha * A x + beta * y for column-major A (m x n). The rows of y are
+/// shared among the OpenMP threads in cache-line multiples.
+template <typename T>
+void gemv(std::size_t m, std::size_t n, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y) noexcept
+{
+    gemv_kernel_t<T> kernel = gemv_generic<T>;
+#ifdef HAIFISCH_X86
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+            case simd::isa::avx512: kernel = gemv_avx512<T>; break;
+            case simd::isa::avx2:   kernel = gemv_avx2<T>;   break;
+            default:                break;
+        }
+    }
+#endif // HAIFISCH_X86
+
+    const std::size_t grain = std::max<std::size_t>(gemm_alignment / sizeof(T), 1);
+    parallel_ranges(m, grain, m * n >= blas_parallel_threshold, [=](std::size_t first, std::size_t last) {
+        kernel(n, alpha, a, lda, x, beta, y, first, last);
+    });
+}
+
+/// y = alpha * A^T x + beta * y for column-major A (m x n). The columns of
+/// A, i.e. the elements of y, are shared among the OpenMP threads.
+template <typename T>
+void gemv_t(std::size_t m, std::size_t n, T alpha, const T* a, std::size_t lda, const T* x, T beta, T* y) noexcept
+{
+    gemv_kernel_t<T> kernel = gemv_t_generic<T>;
+#ifdef HAIFISCH_X86
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+            case simd::isa::avx512: kernel = gemv_t_avx512<T>; break;
+            case simd::isa::avx2:   kernel = gemv_t_avx2<T>;   break;
+            default:                break;
+        }
+    }
+#endif // HAIFISCH_X86
+
+    parallel_ranges(n, gemv_columns, m * n >= blas_parallel_threshold, [=](std::size_t first, std::size_t last) {
+        kernel(m, alpha, a, lda, x, beta, y, first, last);
+    });
+}
+
+template <typename T>
+void axpy(std::size_t n, T alpha, const T* x, T* y) noexcept
+{
+    void (*kernel)(std::size_t, T, const T*, T*) noexcept = axpy_generic<T>;
+#ifdef HAIFISCH_X86
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+            case simd::isa::avx512: kernel = axpy_avx512<T>; break;
+            case simd::isa::avx2:   kernel = axpy_avx2<T>;   break;
+            default:                break;
+        }
+    }
+#endif // HAIFISCH_X86
+
+    const std::size_t grain = std::max<std::size_t>(gemm_alignment / sizeof(T), 1);
+    parallel_ranges(n, grain, n >= blas_parallel_threshold, [=](std::size_t first, std::size_t last) {
+        kernel(last - first, alpha, x + first, y + first);
+    });
+}
+
+template <typename T>
+T dot(std::size_t n, const T* x, const T* y) noexcept
+{
+    T (*kernel)(std::size_t, const T*, const T*) noexcept = dot_generic<T>;
+#ifdef HAIFISCH_X86
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+            case simd::isa::avx512: kernel = dot_avx512<T>; break;
+            case simd::isa::avx2:   kernel = dot_avx2<T>;   break;
+            default:                break;
+        }
+    }
+#endif // HAIFISCH_X86
+
+    if (n < blas_parallel_threshold)
+    {
+        return kernel(n, x, y);
+    }
+
+    /// Fixed blocks summed in order keep the result independent of the
+    /// number of threads.
+    const std::size_t blocks = (n + blas_parallel_threshold - 1) / blas_parallel_threshold;
+    std::vector<T> partial(blocks);
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        const std::size_t first = block * blas_parallel_threshold;
+        partial[block] = kernel(std::min(blas_parallel_threshold, n - first), x + first, y + first);
+    }
+
+    T sum = {};
+    for (const T& value : partial)
+    {
+        sum += value;
+    }
+    return sum;
+}
+} // namespace detail
+} // namespace haifisch
+
+#endif // HAIFISCH_BLAS_HPP
@@ -0,0 +1,483 @@
+#pragma once
+
+#ifndef HAIFISCH_ELEMENTWISE_HPP
+#define HAIFISCH_ELEMENTWISE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "blas.hpp"
+#include "half.hpp"
+#include "simd.hpp"
+#include "view.hpp"
+
+#ifdef HAIFISCH_X86
+# include <emmintrin.h>
+#endif // HAIFISCH_X86
+
+
+namespace haifisch
+{
+namespace detail
+{
+/// Elementwise passes and reductions below this many elements stay on the
+/// calling thread.
+constexpr std::size_t elementwise_parallel_threshold = 1 << 16;
+
+/// Copies and fills of at least this many bytes bypass the cache with
+/// non-temporal stores: the destination cannot stay cached anyway, and
+/// streaming saves reading every destination line before overwriting it.
+constexpr std::size_t streaming_store_bytes = std::size_t { 8 } << 20;
+
+/// Elements per partial result of a parallel reduction. Partials are
+/// combined in a fixed order, so sums do not depend on the thread count.
+constexpr std::size_t reduction_block = 1 << 15;
+
+/// Element types whose copies and fills may be streamed as raw 16-byte
+/// vectors.
+template <typename T>
+constexpr bool is_streamable_v = std::is_trivially_copyable_v<T> && 16 % sizeof(T) == 0;
+
+template <typename T>
+std::size_t elementwise_grain() noexcept
+{
+    return std::max<std::size_t>(gemm_alignment / sizeof(T), 1);
+}
+
+#ifdef HAIFISCH_X86
+/// dst[0:n] = src[0:n] (src != nullptr) or value with non-temporal stores:
+/// scalar stores up to the first 16-byte boundary of dst, then four
+/// streamed vectors per cache line.
+template <typename T>
+[[gnu::target("sse2")]]
+void stream_store(T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    constexpr std::size_t per_vector = 16 / sizeof(T);
+
+    std::size_t i = 0;
+    while (i < n && reinterpret_cast<std::uintptr_t>(dst + i) % 16 != 0)
+    {
+        dst[i] = src != nullptr ? src[i] : value;
+        ++i;
+    }
+
+    T pattern[per_vector];
+    std::fill_n(pattern, per_vector, value);
+    const __m128i repeated = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+
+    const std::size_t line = 4 * per_vector;
+    for (; i + line <= n; i += line)
+    {
+        for (std::size_t r = 0; r < 4; ++r)
+        {
+            const std::size_t at = i + r * per_vector;
+            const __m128i v = src != nullptr ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + at)) : repeated;
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + at), v);
+        }
+    }
+    _mm_sfence();
+
+    for (; i < n; ++i)
+    {
+        dst[i] = src != nullptr ? src[i] : value;
+    }
+}
+#endif // HAIFISCH_X86
+
+/// Whether a copy or fill of n elements at dst is streamed. dst must be
+/// aligned to its element size for the vector stores to tile it.
+template <typename T>
+bool use_streaming(const T* dst, std::size_t n) noexcept
+{
+#ifdef HAIFISCH_X86
+    if constexpr (is_streamable_v<T>)
+    {
+        return n * sizeof(T) >= streaming_store_bytes && reinterpret_cast<std::uintptr_t>(dst) % sizeof(T) == 0;
+    }
+#endif // HAIFISCH_X86
+    static_cast<void>(dst);
+    static_cast<void>(n);
+    return false;
+}
+
+/// dst[0:n] = src[0:n] for non-overlapping ranges: memcpy in per-thread
+/// shares, or streaming stores for large destinations.
+template <typename T>
+void copy(T* dst, const T* src, std::size_t n) noexcept
+{
+    if constexpr (!std::is_trivially_copyable_v<T>)
+    {
+        std::copy_n(src, n, dst);
+    }
+    else
+    {
+        const bool streaming = use_streaming(dst, n);
+        parallel_ranges(n, elementwise_grain<T>(), n >= elementwise_parallel_threshold, [=](std::size_t first, std::size_t last) {
+#ifdef HAIFISCH_X86
+            if constexpr (is_streamable_v<T>)
+            {
+                if (streaming)
+                {
+                    stream_store(dst + first, src + first, T {}, last - first);
+                    return;
+                }
+            }
+#endif // HAIFISCH_X86
+            static_cast<void>(streaming);
+            std::memcpy(dst + first, src + first, (last - first) * sizeof(T));
+        });
+    }
+}
+
+/// Elements of a half-precision pass widened to float at a time.
+constexpr std::size_t half_chunk = 256;
+
+/// dst op= src (or value) for bfloat16 or float16: each chunk is widened,
+/// combined by the float kernels and rounded back on store.
+template <typename H>
+void elementwise_half(simd::elementwise_op op, H* dst, const H* src, H value, std::size_t n) noexcept
+{
+    alignas(64) float lhs[half_chunk];
+    alignas(64) float rhs[half_chunk];
+    for (std::size_t i = 0; i < n; i += half_chunk)
+    {
+        const std::size_t count = std::min(half_chunk, n - i);
+        convert_elements(dst + i, count, lhs);
+        if (src != nullptr)
+        {
+            convert_elements(src + i, count, rhs);
+        }
+        simd::elementwise<float>(op, lhs, src != nullptr ? rhs : nullptr, static_cast<float>(value), count);
+        convert_elements(static_cast<const float*>(lhs), count, dst + i);
+    }
+}
+
+/// simd::elementwise() over per-thread shares of large ranges; large fills
+/// are streamed. Half-precision arithmetic goes through float.
+template <typename T>
+void elementwise(simd::elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    const bool streaming = op == simd::elementwise_op::fill && use_streaming(dst, n);
+    parallel_ranges(n, elementwise_grain<T>(), n >= elementwise_parallel_threshold, [=](std::size_t first, std::size_t last) {
+#ifdef HAIFISCH_X86
+        if constexpr (is_streamable_v<T>)
+        {
+            if (streaming)
+            {
+                stream_store(dst + first, static_cast<const T*>(nullptr), value, last - first);
+                return;
+            }
+        }
+#endif // HAIFISCH_X86
+        static_cast<void>(streaming);
+        if constexpr (is_half_v<T>)
+        {
+            if (op == simd::elementwise_op::fill)
+            {
+                std::fill(dst + first, dst + last, value);
+                return;
+            }
+            elementwise_half(op, dst + first, src != nullptr ? src + first : nullptr, value, last - first);
+        }
+        else
+        {
+            simd::elementwise<T>(op, dst + first, src != nullptr ? src + first : nullptr, value, last - first);
+        }
+    });
+}
+
+/// Whether the n elements at a and b are bitwise equal, compared in
+/// per-thread shares for large ranges.
+template <typename T>
+bool equal(const T* a, const T* b, std::size_t n) noexcept
+{
+    if (n < elementwise_parallel_threshold)
+    {
+        return std::memcmp(a, b, n * sizeof(T)) == 0;
+    }
+
+    const std::size_t blocks = (n + reduction_block - 1) / reduction_block;
+    bool same = true;
+
+    #pragma omp parallel for schedule(static) reduction(&&: same)
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        const std::size_t first = block * reduction_block;
+        same = same && std::memcmp(a + first, b + first, std::min(reduction_block, n - first) * sizeof(T)) == 0;
+    }
+    return same;
+}
+
+/// simd::reduce() over the n > 0 elements at x, in reduction_block pieces
+/// shared among the OpenMP threads for large ranges.
+template <typename T>
+T reduce(simd::reduce_op op, const T* x, std::size_t n) noexcept
+{
+    assert(n > 0);
+    if (n < elementwise_parallel_threshold)
+    {
+        return simd::reduce(op, x, n);
+    }
+
+    const std::size_t blocks = (n + reduction_block - 1) / reduction_block;
+    std::vector<T> partial(blocks);
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        const std::size_t first = block * reduction_block;
+        partial[block] = simd::reduce(op, x + first, std::min(reduction_block, n - first));
+    }
+
+    T result = partial[0];
+    for (std::size_t block = 1; block < blocks; ++block)
+    {
+        result = simd::reduce_merge(op, result, partial[block]);
+    }
+    return result;
+}
+
+/// reduce() over the lines of a view, one partial per line for strided
+/// views.
+template <typename T>
+T reduce(simd::reduce_op op, matrix_view<const T> x) noexcept
+{
+    if (x.contiguous())
+    {
+        return detail::reduce(op, x.data(), x.width() * x.height());
+    }
+
+    std::vector<T> partial(x.height());
+    #pragma omp parallel for schedule(static) if (x.width() * x.height() >= elementwise_parallel_threshold)
+    for (std::size_t y = 0; y < x.height(); ++y)
+    {
+        partial[y] = simd::reduce(op, x.at_pointer(0, y), x.width());
+    }
+
+    T result = partial[0];
+    for (std::size_t y = 1; y < x.height(); ++y)
+    {
+        result = simd::reduce_merge(op, result, partial[y]);
+    }
+    return result;
+}
+
+template <typename D, typename S, typename F>
+[[gnu::always_inline]] inline void map_body(D* dst, const S* src, std::size_t n, const F& f)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i] = f(src[i]);
+    }
+}
+
+template <typename D, typename S1, typename S2, typename F>
+[[gnu::always_inline]] inline void zip_body(D* dst, const S1* a, const S2* b, std::size_t n, const F& f)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i] = f(a[i], b[i]);
+    }
+}
+
+template <typename D, typename S, typename F>
+void map_generic(D* dst, const S* src, std::size_t n, const F& f)
+{
+    map_body(dst, src, n, f);
+}
+
+template <typename D, typename S1, typename S2, typename F>
+void zip_generic(D* dst, const S1* a, const S2* b, std::size_t n, const F& f)
+{
+    zip_body(dst, a, b, n, f);
+}
+
+#ifdef HAIFISCH_X86
+template <typename D, typename S, typename F>
+[[gnu::target("avx2,fma")]]
+void map_avx2(D* dst, const S* src, std::size_t n, const F& f)
+{
+    map_body(dst, src, n, f);
+}
+
+template <typename D, typename S1, typename S2, typename F>
+[[gnu::target("avx2,fma")]]
+void zip_avx2(D* dst, const S1* a, const S2* b, std::size_t n, const F& f)
+{
+    zip_body(dst, a, b, n, f);
+}
+
+template <typename D, typename S, typename F>
+[[gnu::target("avx512f,fma")]]
+void map_avx512(D* dst, const S* src, std::size_t n, const F& f)
+{
+    map_body(dst, src, n, f);
+}
+
+template <typename D, typename S1, typename S2, typename F>
+[[gnu::target("avx512f,fma")]]
+void zip_avx512(D* dst, const S1* a, const S2* b, std::size_t n, const F& f)
+{
+    zip_body(dst, a, b, n, f);
+}
+#endif // HAIFISCH_X86
+
+/// dst[i] = f(src[i]) for i < n. The loop is compiled for the active ISA
+/// level, so an inlinable f vectorizes, and split among OpenMP threads for
+/// large ranges; f must be safe to call concurrently. dst may be src.
+template <typename D, typename S, typename F>
+void map(D* dst, const S* src, std::size_t n, const F& f)
+{
+    void (*kernel)(D*, const S*, std::size_t, const F&) = map_generic<D, S, F>;
+#ifdef HAIFISCH_X86
+    switch (simd::active_isa())
+    {
+        case simd::isa::avx512: kernel = map_avx512<D, S, F>; break;
+        case simd::isa::avx2:   kernel = map_avx2<D, S, F>;   break;
+        default:                break;
+    }
+#endif // HAIFISCH_X86
+
+    parallel_ranges(n, elementwise_grain<D>(), n >= elementwise_parallel_threshold, [&](std::size_t first, std::size_t last) {
+        kernel(dst + first, src + first, last - first, f);
+    });
+}
+
+/// dst[i] = f(a[i], b[i]) for i < n, dispatched and shared like map().
+template <typename D, typename S1, typename S2, typename F>
+void zip(D* dst, const S1* a, const S2* b, std::size_t n, const F& f)
+{
+    void (*kernel)(D*, const S1*, const S2*, std::size_t, const F&) = zip_generic<D, S1, S2, F>;
+#ifdef HAIFISCH_X86
+    switch (simd::active_isa())
+    {
+        case simd::isa::avx512: kernel = zip_avx512<D, S1, S2, F>; break;
+        case simd::isa::avx2:   kernel = zip_avx2<D, S1, S2, F>;   break;
+        default:                break;
+    }
+#endif // HAIFISCH_X86
+
+    parallel_ranges(n, elementwise_grain<D>(), n >= elementwise_parallel_threshold, [&](std::size_t first, std::size_t last) {
+        kernel(dst + first, a + first, b + first, last - first, f);
+    });
+}
+} // namespace detail
+
+/// Sum of all elements of x.
+template <typename S>
+std::remove_const_t<S> sum(matrix_view<S> x) noexcept
+{
+    using T = std::remove_const_t<S>;
+    if (x.width() == 0 || x.height() == 0)
+    {
+        return T {};
+    }
+    return detail::reduce(simd::reduce_op::sum, matrix_view<const T>(x));
+}
+
+/// Smallest element of the non-empty x.
+template <typename S>
+std::remove_const_t<S> minimum(matrix_view<S> x) noexcept
+{
+    using T = std::remove_const_t<S>;
+    assert(x.width() > 0 && x.height() > 0);
+    return detail::reduce(simd::reduce_op::min, matrix_view<const T>(x));
+}
+
+/// Largest element of the non-empty x.
+template <typename S>
+std::remove_const_t<S> maximum(matrix_view<S> x) noexcept
+{
+    using T = std::remove_const_t<S>;
+    assert(x.width() > 0 && x.height() > 0);
+    return detail::reduce(simd::reduce_op::max, matrix_view<const T>(x));
+}
+
+/// Frobenius norm: the square root of the sum of squares of all elements.
+/// Like nrm2(), no scaling guards against overflow of the squares.
+template <typename S>
+std::remove_const_t<S> norm_frobenius(matrix_view<S> x) noexcept
+{
+    using T = std::remove_const_t<S>;
+    static_assert(std::is_floating_point_v<T>, "norm_frobenius needs a floating point element type");
+    if (x.width() == 0 || x.height() == 0)
+    {
+        return T {};
+    }
+    return std::sqrt(detail::reduce(simd::reduce_op::sum_squares, matrix_view<const T>(x)));
+}
+
+/// Infinity norm: the largest sum of absolute values along a row, i.e. over
+/// y for fixed x. Every thread accumulates a contiguous range of rows line
+/// by line, so all loads are unit-stride.
+template <typename S>
+std::remove_const_t<S> norm_inf(matrix_view<S> x)
+{
+    using T = std::remove_const_t<S>;
+    if (x.width() == 0 || x.height() == 0)
+    {
+        return T {};
+    }
+
+    std::vector<T> rows(x.width());
+    T* const row_sums = rows.data();
+    const bool parallel = x.width() * x.height() >= detail::elementwise_parallel_threshold;
+    detail::parallel_ranges(x.width(), detail::elementwise_grain<T>(), parallel, [=](std::size_t first, std::size_t last) {
+        for (std::size_t y = 0; y < x.height(); ++y)
+        {
+            const S* line = x.at_pointer(0, y);
+            for (std::size_t i = first; i < last; ++i)
+            {
+                row_sums[i] += line[i] < T {} ? -line[i] : line[i];
+            }
+        }
+    });
+    return *std::max_element(rows.begin(), rows.end());
+}
+
+/// dst(x, y) = f(src(x, y)) for views of the same shape; dst may be src.
+template <typename S, typename D, typename F>
+void map(matrix_view<S> src, matrix_view<D> dst, const F& f)
+{
+    assert(src.width() == dst.width() && src.height() == dst.height());
+
+    if (src.contiguous() && dst.contiguous())
+    {
+        detail::map(dst.data(), src.data(), src.width() * src.height(), f);
+        return;
+    }
+    #pragma omp parallel for schedule(static) if (src.width() * src.height() >= detail::elementwise_parallel_threshold)
+    for (std::size_t y = 0; y < src.height(); ++y)
+    {
+        detail::map_generic(dst.at_pointer(0, y), src.at_pointer(0, y), src.width(), f);
+    }
+}
+
+/// dst(x, y) = f(a(x, y), b(x, y)) for views of the same shape; dst may be
+/// a or b.
+template <typename S1, typename S2, typename D, typename F>
+void zip(matrix_view<S1> a, matrix_view<S2> b, matrix_view<D> dst, const F& f)
+{
+    assert(a.width() == b.width() && a.height() == b.height());
+    assert(a.width() == dst.width() && a.height() == dst.height());
+
+    if (a.contiguous() && b.contiguous() && dst.contiguous())
+    {
+        detail::zip(dst.data(), a.data(), b.data(), a.width() * a.height(), f);
+        return;
+    }
+    #pragma omp parallel for schedule(static) if (a.width() * a.height() >= detail::elementwise_parallel_threshold)
+    for (std::size_t y = 0; y < a.height(); ++y)
+    {
+        detail::zip_generic(dst.at_pointer(0, y), a.at_pointer(0, y), b.at_pointer(0, y), a.width(), f);
+    }
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_ELEMENTWISE_HPP
@@ -0,0 +1,341 @@
+#pragma once
+
+#ifndef HAIFISCH_EXPRESSION_HPP
+#define HAIFISCH_EXPRESSION_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
+#include "simd.hpp"
+
+
+namespace haifisch
+{
+template <typename T, typename Allocator>
+class matrix;
+
+/// CRTP base of every lazy elementwise expression over haifisch::matrix.
+///
+/// `a + b - c * 2` builds a tree of light nodes holding references to the
+/// operand matrices; nothing is computed until the tree is assigned to a
+/// matrix, which evaluates it in one fused pass over memory.
+template <typename E>
+struct matrix_expression
+{
+    [[gnu::always_inline]] inline const E& self() const noexcept
+    {
+        return static_cast<const E&>(*this);
+    }
+};
+
+/// Leaf of an expression: a matrix taken by reference.
+template <typename T>
+class matrix_reference : public matrix_expression<matrix_reference<T>>
+{
+public:
+    using value_type = T;
+
+    matrix_reference(const T* data_, std::size_t cols_, std::size_t rows_) noexcept
+        : data(data_)
+        , cols(cols_)
+        , rows(rows_)
+    { }
+    [[gnu::always_inline]] inline std::size_t width() const noexcept
+    {
+        return cols;
+    }
+    [[gnu::always_inline]] inline std::size_t height() const noexcept
+    {
+        return rows;
+    }
+    [[gnu::always_inline]] inline T operator [] (std::size_t index) const noexcept
+    {
+        return data[index];
+    }
+
+private:
+    const T* data;
+    std::size_t cols;
+    std::size_t rows;
+};
+
+/// Operands are combined in their arithmetic type, which is float for the
+/// half-precision storage types, and rounded back to T.
+namespace ops
+{
+struct plus
+{
+    template <typename T>
+    [[gnu::always_inline]] static inline T apply(T lhs, T rhs) noexcept { return static_cast<T>(lhs + rhs); }
+};
+
+struct minus
+{
+    template <typename T>
+    [[gnu::always_inline]] static inline T apply(T lhs, T rhs) noexcept { return static_cast<T>(lhs - rhs); }
+};
+
+struct multiplies
+{
+    template <typename T>
+    [[gnu::always_inline]] static inline T apply(T lhs, T rhs) noexcept { return static_cast<T>(lhs * rhs); }
+};
+
+struct divides
+{
+    template <typename T>
+    [[gnu::always_inline]] static inline T apply(T lhs, T rhs) noexcept { return static_cast<T>(lhs / rhs); }
+};
+} // namespace ops
+
+/// Elementwise lhs op rhs of two equally shaped expressions.
+template <typename L, typename R, typename Op>
+class binary_expression : public matrix_expression<binary_expression<L, R, Op>>
+{
+public:
+    using value_type = typename L::value_type;
+    static_assert(std::is_same_v<value_type, typename R::value_type>, "operands must share the element type");
+
+    binary_expression(const L& lhs_, const R& rhs_) noexcept
+        : lhs(lhs_)
+        , rhs(rhs_)
+    {
+        assert(lhs.width() == rhs.width());
+        assert(lhs.height() == rhs.height());
+    }
+    [[gnu::always_inline]] inline std::size_t width() const noexcept
+    {
+        return lhs.width();
+    }
+    [[gnu::always_inline]] inline std::size_t height() const noexcept
+    {
+        return lhs.height();
+    }
+    [[gnu::always_inline]] inline value_type operator [] (std::size_t index) const noexcept
+    {
+        return Op::apply(lhs[index], rhs[index]);
+    }
+
+private:
+    L lhs;
+    R rhs;
+};
+
+/// Elementwise expr op scalar, or scalar op expr when ScalarFirst is set.
+template <typename E, typename Op, bool ScalarFirst = false>
+class scalar_expression : public matrix_expression<scalar_expression<E, Op, ScalarFirst>>
+{
+public:
+    using value_type = typename E::value_type;
+
+    scalar_expression(const E& expr_, value_type scalar_) noexcept
+        : expr(expr_)
+        , scalar(scalar_)
+    { }
+    [[gnu::always_inline]] inline std::size_t width() const noexcept
+    {
+        return expr.width();
+    }
+    [[gnu::always_inline]] inline std::size_t height() const noexcept
+    {
+        return expr.height();
+    }
+    [[gnu::always_inline]] inline value_type operator [] (std::size_t index) const noexcept
+    {
+        if constexpr (ScalarFirst)
+        {
+            return Op::apply(scalar, expr[index]);
+        }
+        else
+        {
+            return Op::apply(expr[index], scalar);
+        }
+    }
+
+private:
+    E expr;
+    value_type scalar;
+};
+
+template <typename T>
+struct is_matrix : std::false_type { };
+
+template <typename T, typename Allocator>
+struct is_matrix<matrix<T, Allocator>> : std::true_type { };
+
+/// Matrices and expressions may appear on either side of an operator.
+template <typename T>
+constexpr bool is_expression_operand_v = is_matrix<T>::value || std::is_base_of_v<matrix_expression<T>, T>;
+
+template <typename T, typename Allocator>
+[[gnu::always_inline]] inline matrix_reference<T> as_expression(const matrix<T, Allocator>& mat) noexcept
+{
+    return matrix_reference<T>(mat.data(), mat.width(), mat.height());
+}
+
+template <typename E>
+[[gnu::always_inline]] inline const E& as_expression(const matrix_expression<E>& expr) noexcept
+{
+    return expr.self();
+}
+
+template <typename T>
+using expression_t = std::decay_t<decltype(as_expression(std::declval<const T&>()))>;
+
+template <typename L, typename R>
+using enable_if_operands_t = std::enable_if_t<is_expression_operand_v<L> && is_expression_operand_v<R>>;
+
+template <typename E, typename S>
+using enable_if_scalar_t = std::enable_if_t<is_expression_operand_v<E> && std::is_arithmetic_v<S>>;
+
+template <typename L, typename R, typename = enable_if_operands_t<L, R>>
+auto operator + (const L& lhs, const R& rhs) noexcept
+{
+    return binary_expression<expression_t<L>, expression_t<R>, ops::plus>(as_expression(lhs), as_expression(rhs));
+}
+
+template <typename L, typename R, typename = enable_if_operands_t<L, R>>
+auto operator - (const L& lhs, const R& rhs) noexcept
+{
+    return binary_expression<expression_t<L>, expression_t<R>, ops::minus>(as_expression(lhs), as_expression(rhs));
+}
+
+template <typename E, typename S, typename = enable_if_scalar_t<E, S>>
+auto operator * (const E& expr, S scalar) noexcept
+{
+    using value_type = typename expression_t<E>::value_type;
+    return scalar_expression<expression_t<E>, ops::multiplies>(as_expression(expr), static_cast<value_type>(scalar));
+}
+
+template <typename E, typename S, typename = enable_if_scalar_t<E, S>>
+auto operator * (S scalar, const E& expr) noexcept
+{
+    using value_type = typename expression_t<E>::value_type;
+    return scalar_expression<expression_t<E>, ops::multiplies, true>(as_expression(expr), static_cast<value_type>(scalar));
+}
+
+template <typename E, typename S, typename = enable_if_scalar_t<E, S>>
+auto operator / (const E& expr, S scalar) noexcept
+{
+    using value_type = typename expression_t<E>::value_type;
+    return scalar_expression<expression_t<E>, ops::divides>(as_expression(expr), static_cast<value_type>(scalar));
+}
+
+template <typename E, typename = std::enable_if_t<is_expression_operand_v<E>>>
+auto operator - (const E& expr) noexcept
+{
+    using value_type = typename expression_t<E>::value_type;
+    return scalar_expression<expression_t<E>, ops::minus, true>(as_expression(expr), value_type {});
+}
+
+template <typename L, typename R, typename = enable_if_operands_t<L, R>,
+          typename = std::enable_if_t<!(is_matrix<L>::value && is_matrix<R>::value)>>
+bool operator == (const L& lhs, const R& rhs) noexcept
+{
+    const auto& l = as_expression(lhs);
+    const auto& r = as_expression(rhs);
+    if (l.width() != r.width()) return false;
+    if (l.height() != r.height()) return false;
+
+    const std::size_t size = l.width() * l.height();
+    for (std::size_t i = 0; i < size; i++)
+    {
+        if (l[i] != r[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename L, typename R, typename = enable_if_operands_t<L, R>,
+          typename = std::enable_if_t<!(is_matrix<L>::value && is_matrix<R>::value)>>
+bool operator != (const L& lhs, const R& rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+namespace detail
+{
+/// Expressions below this many elements are evaluated on the calling thread.
+constexpr std::size_t expression_parallel_threshold = 1 << 16;
+
+template <typename T, typename E>
+[[gnu::always_inline]] inline void evaluate_body(T* dst, const E& expr, std::size_t first, std::size_t last) noexcept
+{
+    for (std::size_t i = first; i < last; i++)
+    {
+        dst[i] = expr[i];
+    }
+}
+
+template <typename T, typename E>
+void evaluate_generic(T* dst, const E& expr, std::size_t first, std::size_t last) noexcept
+{
+    evaluate_body(dst, expr, first, last);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T, typename E>
+[[gnu::target("avx2,fma")]]
+void evaluate_avx2(T* dst, const E& expr, std::size_t first, std::size_t last) noexcept
+{
+    evaluate_body(dst, expr, first, last);
+}
+
+template <typename T, typename E>
+[[gnu::target("avx512f,fma")]]
+void evaluate_avx512(T* dst, const E& expr, std::size_t first, std::size_t last) noexcept
+{
+    evaluate_body(dst, expr, first, last);
+}
+#endif // HAIFISCH_X86
+
+/// dst[i] = expr[i] for i < size in one pass, with the loop compiled for the
+/// active ISA level and split among OpenMP threads for large matrices.
+/// dst may alias any operand of expr.
+template <typename T, typename E>
+void evaluate(T* dst, const E& expr, std::size_t size) noexcept
+{
+    using kernel_t = void (*)(T*, const E&, std::size_t, std::size_t) noexcept;
+
+    kernel_t kernel = evaluate_generic<T, E>;
+#ifdef HAIFISCH_X86
+    switch (simd::active_isa())
+    {
+        case simd::isa::avx512: kernel = evaluate_avx512<T, E>; break;
+        case simd::isa::avx2:   kernel = evaluate_avx2<T, E>;   break;
+        default:                break;
+    }
+#endif // HAIFISCH_X86
+
+    if (size < expression_parallel_threshold)
+    {
+        kernel(dst, expr, 0, size);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        std::size_t threads = 1;
+        std::size_t thread = 0;
+#ifdef _OPENMP
+        threads = static_cast<std::size_t>(omp_get_num_threads());
+        thread = static_cast<std::size_t>(omp_get_thread_num());
+#endif // _OPENMP
+        const std::size_t chunk = (size + threads - 1) / threads;
+        const std::size_t first = std::min(size, thread * chunk);
+        const std::size_t last = std::min(size, first + chunk);
+        kernel(dst, expr, first, last);
+    }
+}
+} // namespace detail
+} // namespace haifisch
+
+#endif // HAIFISCH_EXPRESSION_HPP
@@ -0,0 +1,449 @@
+#pragma once
+
+#ifndef HAIFISCH_FIXED_HPP
+#define HAIFISCH_FIXED_HPP
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "transpose.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+namespace detail
+{
+/// Columns of R elements are handled as one vector when they fill a power
+/// of two up to a cache line; the compiler splits wider vectors into the
+/// registers of the target the translation unit is built for.
+template <typename T, std::size_t R>
+constexpr bool fixed_column_vectorizable = is_vectorizable_v<T> && R > 1 && (R & (R - 1)) == 0 && R * sizeof(T) <= 64;
+
+template <typename T, std::size_t R, std::size_t C>
+constexpr std::size_t fixed_alignment = fixed_column_vectorizable<T, R> ? R * sizeof(T) : alignof(T);
+
+/// c = a b for one column b of K elements, a being R x K.
+template <typename T, std::size_t R, std::size_t... P>
+[[gnu::always_inline]] inline void fixed_column_product(const T* a, const T* b, T* c, std::index_sequence<P...>) noexcept
+{
+    if constexpr (fixed_column_vectorizable<T, R>)
+    {
+        using vec_t = typename simd::simd_vector<T, R>::type;
+        vec_t columns[sizeof...(P)];
+        (std::memcpy(&columns[P], a + P * R, sizeof(vec_t)), ...);
+        const vec_t sum = ((columns[P] * b[P]) + ...);
+        std::memcpy(c, &sum, sizeof(vec_t));
+    }
+    else
+    {
+        for (std::size_t i = 0; i < R; ++i)
+        {
+            c[i] = ((a[P * R + i] * b[P]) + ...);
+        }
+    }
+}
+
+template <typename T, std::size_t R, std::size_t K, std::size_t... J>
+[[gnu::always_inline]] inline void fixed_product(const T* a, const T* b, T* c, std::index_sequence<J...>) noexcept
+{
+    (fixed_column_product<T, R>(a, b + J * K, c + J * R, std::make_index_sequence<K> {}), ...);
+}
+
+/// Inverse of the n x n column-major matrix a by Gauss-Jordan elimination
+/// with partial pivoting; a is destroyed. Returns the determinant.
+template <typename T, std::size_t N>
+T fixed_gauss_jordan(T (&a)[N * N], T (&inverse)[N * N]) noexcept
+{
+    for (std::size_t i = 0; i < N * N; ++i)
+    {
+        inverse[i] = i % (N + 1) == 0 ? T { 1 } : T {};
+    }
+
+    T det = 1;
+    for (std::size_t col = 0; col < N; ++col)
+    {
+        std::size_t pivot = col;
+        for (std::size_t row = col + 1; row < N; ++row)
+        {
+            if (std::abs(a[col * N + row]) > std::abs(a[col * N + pivot]))
+            {
+                pivot = row;
+            }
+        }
+        if (pivot != col)
+        {
+            for (std::size_t j = 0; j < N; ++j)
+            {
+                std::swap(a[j * N + col], a[j * N + pivot]);
+                std::swap(inverse[j * N + col], inverse[j * N + pivot]);
+            }
+            det = -det;
+        }
+
+        const T diagonal = a[col * N + col];
+        det *= diagonal;
+        const T scale = T { 1 } / diagonal;
+        for (std::size_t j = 0; j < N; ++j)
+        {
+            a[j * N + col] *= scale;
+            inverse[j * N + col] *= scale;
+        }
+        for (std::size_t row = 0; row < N; ++row)
+        {
+            const T factor = a[col * N + row];
+            if (row == col || factor == T {})
+            {
+                continue;
+            }
+            for (std::size_t j = 0; j < N; ++j)
+            {
+                a[j * N + row] -= factor * a[j * N + col];
+                inverse[j * N + row] -= factor * inverse[j * N + col];
+            }
+        }
+    }
+    return det;
+}
+} // namespace detail
+
+/// Matrix with R rows and C columns known at compile time, stored inline.
+///
+/// The layout is the one of haifisch::matrix: element (i, j) of row i and
+/// column j lives at data()[j * R + i], so a fixed_matrix<T, R, C> has
+/// width() == R and height() == C like matrix<T>(R, C), and view() hands it
+/// to every view-based kernel. Arithmetic is expanded for the exact size:
+/// no loops over runtime bounds, no allocation, and columns that fill a
+/// vector register are processed as one vector.
+template <typename T, std::size_t R, std::size_t C>
+class fixed_matrix
+{
+    static_assert(R > 0 && C > 0, "a fixed_matrix needs at least one element");
+
+public:
+    using value_type = T;
+
+    /// Zero matrix.
+    constexpr fixed_matrix() noexcept
+        : values {}
+    { }
+    /// Elements given row by row, the way the matrix is written down.
+    template <typename... U, typename = std::enable_if_t<sizeof...(U) == R * C && (std::is_convertible_v<U, T> && ...)>>
+    constexpr fixed_matrix(U... elements) noexcept
+        : values {}
+    {
+        const T list[] = { static_cast<T>(elements)... };
+        for (std::size_t i = 0; i < R; ++i)
+        {
+            for (std::size_t j = 0; j < C; ++j)
+            {
+                values[j * R + i] = list[i * C + j];
+            }
+        }
+    }
+    /// Copies an R x C view, e.g. matrix<T>::view().
+    explicit fixed_matrix(matrix_view<const T> source) noexcept
+        : values {}
+    {
+        assert(source.width() == R && source.height() == C);
+        matrix_view<T>(values, R, C).assign(source);
+    }
+
+    static constexpr fixed_matrix identity() noexcept
+    {
+        static_assert(R == C, "only square matrices have an identity");
+        fixed_matrix result;
+        for (std::size_t i = 0; i < R; ++i)
+        {
+            result.values[i * R + i] = T { 1 };
+        }
+        return result;
+    }
+
+    [[gnu::always_inline]] inline static constexpr std::size_t width() noexcept
+    {
+        return R;
+    }
+    [[gnu::always_inline]] inline static constexpr std::size_t height() noexcept
+    {
+        return C;
+    }
+    [[gnu::always_inline]] inline constexpr T* data() noexcept
+    {
+        return values;
+    }
+    [[gnu::always_inline]] inline constexpr const T* data() const noexcept
+    {
+        return values;
+    }
+    [[gnu::always_inline]] inline constexpr T& operator () (std::size_t i, std::size_t j) noexcept
+    {
+        return values[j * R + i];
+    }
+    [[gnu::always_inline]] inline constexpr const T& operator () (std::size_t i, std::size_t j) const noexcept
+    {
+        return values[j * R + i];
+    }
+    [[gnu::always_inline]] inline constexpr T& at(std::size_t i, std::size_t j) noexcept
+    {
+        assert(i < R && j < C);
+        return values[j * R + i];
+    }
+    [[gnu::always_inline]] inline constexpr const T& at(std::size_t i, std::size_t j) const noexcept
+    {
+        assert(i < R && j < C);
+        return values[j * R + i];
+    }
+    [[gnu::always_inline]] inline matrix_view<T> view() noexcept
+    {
+        return matrix_view<T>(values, R, C);
+    }
+    [[gnu::always_inline]] inline matrix_view<const T> view() const noexcept
+    {
+        return matrix_view<const T>(values, R, C);
+    }
+
+    [[gnu::always_inline]] inline fixed_matrix& operator += (const fixed_matrix& rhs) noexcept
+    {
+        for (std::size_t i = 0; i < R * C; ++i)
+        {
+            values[i] += rhs.values[i];
+        }
+        return *this;
+    }
+    [[gnu::always_inline]] inline fixed_matrix& operator -= (const fixed_matrix& rhs) noexcept
+    {
+        for (std::size_t i = 0; i < R * C; ++i)
+        {
+            values[i] -= rhs.values[i];
+        }
+        return *this;
+    }
+    [[gnu::always_inline]] inline fixed_matrix& operator *= (const T& scalar) noexcept
+    {
+        for (std::size_t i = 0; i < R * C; ++i)
+        {
+            values[i] *= scalar;
+        }
+        return *this;
+    }
+    [[gnu::always_inline]] inline fixed_matrix& operator *= (const fixed_matrix<T, C, C>& rhs) noexcept
+    {
+        return *this = *this * rhs;
+    }
+
+    [[gnu::always_inline]] inline bool operator == (const fixed_matrix& other) const noexcept
+    {
+        for (std::size_t i = 0; i < R * C; ++i)
+        {
+            if (!(values[i] == other.values[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    [[gnu::always_inline]] inline bool operator != (const fixed_matrix& other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+    alignas(detail::fixed_alignment<T, R, C>) T values[R * C];
+};
+
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator + (fixed_matrix<T, R, C> lhs, const fixed_matrix<T, R, C>& rhs) noexcept
+{
+    return lhs += rhs;
+}
+
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator - (fixed_matrix<T, R, C> lhs, const fixed_matrix<T, R, C>& rhs) noexcept
+{
+    return lhs -= rhs;
+}
+
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator - (const fixed_matrix<T, R, C>& value) noexcept
+{
+    return fixed_matrix<T, R, C>() - value;
+}
+
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator * (fixed_matrix<T, R, C> lhs, const T& scalar) noexcept
+{
+    return lhs *= scalar;
+}
+
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator * (const T& scalar, fixed_matrix<T, R, C> rhs) noexcept
+{
+    return rhs *= scalar;
+}
+
+/// (R x K) (K x C) product. Every column of the result is a sum of the
+/// columns of lhs scaled by one column of rhs.
+template <typename T, std::size_t R, std::size_t K, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, R, C> operator * (const fixed_matrix<T, R, K>& lhs, const fixed_matrix<T, K, C>& rhs) noexcept
+{
+    fixed_matrix<T, R, C> result;
+    detail::fixed_product<T, R, K>(lhs.data(), rhs.data(), result.data(), std::make_index_sequence<C> {});
+    return result;
+}
+
+/// Square sizes that fill a vector column are transposed in registers with
+/// the tile kernel of transpose.hpp.
+template <typename T, std::size_t R, std::size_t C>
+[[gnu::always_inline]] inline fixed_matrix<T, C, R> transpose(const fixed_matrix<T, R, C>& value) noexcept
+{
+    fixed_matrix<T, C, R> result;
+    if constexpr (R == C && detail::fixed_column_vectorizable<T, R>)
+    {
+        detail::transpose_tile<T, R>(value.data(), R, result.data(), R);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < R; ++i)
+        {
+            for (std::size_t j = 0; j < C; ++j)
+            {
+                result(j, i) = value(i, j);
+            }
+        }
+    }
+    return result;
+}
+
+/// Determinant: closed forms up to 4 x 4, elimination with partial
+/// pivoting above.
+template <typename T, std::size_t N>
+inline T determinant(const fixed_matrix<T, N, N>& a) noexcept
+{
+    static_assert(std::is_floating_point_v<T>, "determinant needs a floating point type");
+
+    if constexpr (N == 1)
+    {
+        return a(0, 0);
+    }
+    else if constexpr (N == 2)
+    {
+        return a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+    }
+    else if constexpr (N == 3)
+    {
+        return a(0, 0) * (a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1))
+             + a(0, 1) * (a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2))
+             + a(0, 2) * (a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0));
+    }
+    else if constexpr (N == 4)
+    {
+        const T s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+        const T s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+        const T s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+        const T s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+        const T s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+        const T s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+        const T c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+        const T c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+        const T c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+        const T c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+        const T c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+        const T c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+        return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    }
+    else
+    {
+        T work[N * N];
+        T unused[N * N];
+        std::memcpy(work, a.data(), sizeof(work));
+        return detail::fixed_gauss_jordan<T, N>(work, unused);
+    }
+}
+
+/// Inverse: adjugate over determinant up to 4 x 4, Gauss-Jordan with
+/// partial pivoting above. A singular matrix yields infinities or NaNs.
+template <typename T, std::size_t N>
+inline fixed_matrix<T, N, N> inverse(const fixed_matrix<T, N, N>& a) noexcept
+{
+    static_assert(std::is_floating_point_v<T>, "inverse needs a floating point type");
+
+    fixed_matrix<T, N, N> b;
+    if constexpr (N == 1)
+    {
+        b(0, 0) = T { 1 } / a(0, 0);
+    }
+    else if constexpr (N == 2)
+    {
+        const T inv = T { 1 } / determinant(a);
+        b(0, 0) =  a(1, 1) * inv;
+        b(0, 1) = -a(0, 1) * inv;
+        b(1, 0) = -a(1, 0) * inv;
+        b(1, 1) =  a(0, 0) * inv;
+    }
+    else if constexpr (N == 3)
+    {
+        b(0, 0) = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+        b(0, 1) = a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2);
+        b(0, 2) = a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1);
+        b(1, 0) = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+        b(1, 1) = a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0);
+        b(1, 2) = a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2);
+        b(2, 0) = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+        b(2, 1) = a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1);
+        b(2, 2) = a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+        b *= T { 1 } / (a(0, 0) * b(0, 0) + a(0, 1) * b(1, 0) + a(0, 2) * b(2, 0));
+    }
+    else if constexpr (N == 4)
+    {
+        /// 2 x 2 minors of the upper (s) and lower (c) row pairs.
+        const T s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+        const T s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+        const T s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+        const T s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+        const T s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+        const T s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+        const T c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+        const T c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+        const T c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+        const T c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+        const T c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+        const T c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+
+        b(0, 0) =  a(1, 1) * c5 - a(1, 2) * c4 + a(1, 3) * c3;
+        b(0, 1) = -a(0, 1) * c5 + a(0, 2) * c4 - a(0, 3) * c3;
+        b(0, 2) =  a(3, 1) * s5 - a(3, 2) * s4 + a(3, 3) * s3;
+        b(0, 3) = -a(2, 1) * s5 + a(2, 2) * s4 - a(2, 3) * s3;
+        b(1, 0) = -a(1, 0) * c5 + a(1, 2) * c2 - a(1, 3) * c1;
+        b(1, 1) =  a(0, 0) * c5 - a(0, 2) * c2 + a(0, 3) * c1;
+        b(1, 2) = -a(3, 0) * s5 + a(3, 2) * s2 - a(3, 3) * s1;
+        b(1, 3) =  a(2, 0) * s5 - a(2, 2) * s2 + a(2, 3) * s1;
+        b(2, 0) =  a(1, 0) * c4 - a(1, 1) * c2 + a(1, 3) * c0;
+        b(2, 1) = -a(0, 0) * c4 + a(0, 1) * c2 - a(0, 3) * c0;
+        b(2, 2) =  a(3, 0) * s4 - a(3, 1) * s2 + a(3, 3) * s0;
+        b(2, 3) = -a(2, 0) * s4 + a(2, 1) * s2 - a(2, 3) * s0;
+        b(3, 0) = -a(1, 0) * c3 + a(1, 1) * c1 - a(1, 2) * c0;
+        b(3, 1) =  a(0, 0) * c3 - a(0, 1) * c1 + a(0, 2) * c0;
+        b(3, 2) = -a(3, 0) * s3 + a(3, 1) * s1 - a(3, 2) * s0;
+        b(3, 3) =  a(2, 0) * s3 - a(2, 1) * s1 + a(2, 2) * s0;
+        b *= T { 1 } / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+    }
+    else
+    {
+        T work[N * N];
+        std::memcpy(work, a.data(), sizeof(work));
+        T result[N * N];
+        detail::fixed_gauss_jordan<T, N>(work, result);
+        std::memcpy(b.data(), result, sizeof(result));
+    }
+    return b;
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_FIXED_HPP
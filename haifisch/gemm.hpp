@@ -0,0 +1,556 @@
+#pragma once
+
+#ifndef HAIFISCH_GEMM_HPP
+#define HAIFISCH_GEMM_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include "half.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+
+
+namespace haifisch
+{
+/// How a GEMM operand enters the product: as stored, or transposed in
+/// place by swapping its strides.
+enum class gemm_op
+{
+    none,
+    transpose
+};
+
+namespace detail
+{
+/// Blocking parameters of the packed GEMM engine.
+///
+/// mr x nr is the register tile computed by the micro-kernel,
+/// a kc x nr micro-panel of B is sized for L1, an mc x kc block of A for L2
+/// and a kc x nc panel of B for L3.
+template <typename T>
+struct gemm_blocking
+{
+    static constexpr std::size_t mr = 4;
+    static constexpr std::size_t nr = 4;
+    static constexpr std::size_t kc = 256;
+    static constexpr std::size_t mc = 128;
+    static constexpr std::size_t nc = 2048;
+};
+
+/// Blocking for the vectorized micro-kernels of one ISA level: the tile is
+/// two registers tall and nr columns wide, so 2 * nr accumulators stay in
+/// the register file (8 of 16 xmm, 12 of 16 ymm, 16 of 32 zmm).
+template <typename T, simd::isa Level>
+struct simd_gemm_blocking
+{
+    static constexpr std::size_t vector_bytes = simd::register_bytes(Level);
+    static constexpr std::size_t mr = 2 * vector_bytes / sizeof(T);
+    static constexpr std::size_t nr = Level == simd::isa::avx512 ? 8
+                                    : Level == simd::isa::avx2   ? 6
+                                    :                              4;
+    static constexpr std::size_t kc = 16 * 1024 / (nr * sizeof(T));
+    static constexpr std::size_t mc = 512 * 1024 / (kc * sizeof(T)) / mr * mr;
+    static constexpr std::size_t nc = 4096 / nr * nr;
+};
+
+/// Products smaller than this (in multiply-adds) do not open a parallel region.
+constexpr std::size_t gemm_parallel_threshold = 64 * 64 * 64;
+
+constexpr std::size_t gemm_alignment = 64;
+
+constexpr std::size_t round_up(std::size_t value, std::size_t multiple) noexcept
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/// Scratch memory for packed panels, aligned to a cache line.
+template <typename T>
+class aligned_buffer
+{
+public:
+    explicit aligned_buffer(std::size_t size)
+        : ptr(size > 0 ? static_cast<T*>(::operator new[](size * sizeof(T), std::align_val_t { gemm_alignment })) : nullptr)
+    { }
+    aligned_buffer(const aligned_buffer&) = delete;
+    aligned_buffer& operator = (const aligned_buffer&) = delete;
+    ~aligned_buffer()
+    {
+        ::operator delete[](ptr, std::align_val_t { gemm_alignment });
+    }
+    T* get() const noexcept
+    {
+        return ptr;
+    }
+
+private:
+    T* ptr;
+};
+
+/// Elements per cache line, at least one.
+template <typename T>
+constexpr std::size_t line_elements = std::max<std::size_t>(gemm_alignment / sizeof(T), 1);
+
+/// Elements of scratch space gemm_driver needs for its packed panels of A
+/// and B, including the slack to align them to a cache line.
+template <typename T, typename Blocking>
+constexpr std::size_t packing_size(std::size_t m, std::size_t n, std::size_t k) noexcept
+{
+    const std::size_t kc = std::min(Blocking::kc, k);
+    return round_up(round_up(m, Blocking::mr) * kc, line_elements<T>)
+         + round_up(std::min(Blocking::nc, n), Blocking::nr) * kc + line_elements<T>;
+}
+
+/// The first cache-line boundary at or after p, or p itself when no element
+/// starts on one.
+template <typename T>
+T* align_to_line(T* p) noexcept
+{
+    const auto address = reinterpret_cast<std::uintptr_t>(p);
+    const std::size_t skip = round_up(address, gemm_alignment) - address;
+    return skip % sizeof(T) == 0 ? p + skip / sizeof(T) : p;
+}
+
+/// Packs the mr-row micro-panels [first, last) of an m x k block of A.
+/// Element (i, p) of A lives at a[i * rs + p * cs]. Every micro-panel is
+/// stored as k consecutive columns of mr elements, zero-padded past m.
+/// A source of another element type (half precision) is converted to T on
+/// the way, contiguous columns through convert_elements().
+template <typename T, std::size_t MR, typename S = T>
+void pack_a(std::size_t first, std::size_t last, std::size_t m, std::size_t k,
+            const S* a, std::size_t rs, std::size_t cs, T* packed) noexcept
+{
+    for (std::size_t panel = first; panel < last; ++panel)
+    {
+        const std::size_t i0 = panel * MR;
+        const std::size_t rows = std::min(MR, m - i0);
+        T* dst = packed + panel * MR * k;
+
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            const S* src = a + i0 * rs + p * cs;
+            std::size_t r = 0;
+            if constexpr (!std::is_same_v<S, T>)
+            {
+                if (rs == 1)
+                {
+                    convert_elements(src, rows, dst);
+                    r = rows;
+                }
+            }
+            for (; r < rows; ++r)
+            {
+                dst[r] = static_cast<T>(src[r * rs]);
+            }
+            for (; r < MR; ++r)
+            {
+                dst[r] = T {};
+            }
+            dst += MR;
+        }
+    }
+}
+
+/// Packs the nr-column micro-panels [first, last) of a k x n panel of B.
+/// Element (p, j) of B lives at b[p * rs + j * cs]. Every micro-panel is
+/// stored as k consecutive rows of nr elements, zero-padded past n.
+/// A converted source with contiguous columns goes column by column
+/// through a small buffer, so the bulk conversion still applies.
+template <typename T, std::size_t NR, typename S = T>
+void pack_b(std::size_t first, std::size_t last, std::size_t k, std::size_t n,
+            const S* b, std::size_t rs, std::size_t cs, T* packed) noexcept
+{
+    if constexpr (!std::is_same_v<S, T>)
+    {
+        if (rs == 1)
+        {
+            constexpr std::size_t chunk = 256;
+            T column[chunk];
+            for (std::size_t panel = first; panel < last; ++panel)
+            {
+                const std::size_t j0 = panel * NR;
+                const std::size_t cols = std::min(NR, n - j0);
+                T* dst = packed + panel * NR * k;
+
+                for (std::size_t c = 0; c < NR; ++c)
+                {
+                    for (std::size_t p0 = 0; p0 < k; p0 += chunk)
+                    {
+                        const std::size_t depth = std::min(chunk, k - p0);
+                        if (c < cols)
+                        {
+                            convert_elements(b + (j0 + c) * cs + p0, depth, column);
+                        }
+                        for (std::size_t p = 0; p < depth; ++p)
+                        {
+                            dst[(p0 + p) * NR + c] = c < cols ? column[p] : T {};
+                        }
+                    }
+                }
+            }
+            return;
+        }
+    }
+
+    for (std::size_t panel = first; panel < last; ++panel)
+    {
+        const std::size_t j0 = panel * NR;
+        const std::size_t cols = std::min(NR, n - j0);
+        T* dst = packed + panel * NR * k;
+
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            const S* src = b + p * rs + j0 * cs;
+            std::size_t c = 0;
+            for (; c < cols; ++c)
+            {
+                dst[c] = static_cast<T>(src[c * cs]);
+            }
+            for (; c < NR; ++c)
+            {
+                dst[c] = T {};
+            }
+            dst += NR;
+        }
+    }
+}
+
+template <typename T>
+constexpr bool is_vectorizable_v = simd::has_kernels_v<T> || std::is_same_v<T, std::int64_t>;
+
+/// Writes the accumulated register tile back: C = alpha * acc + beta * C.
+/// C is not read when beta is zero.
+template <typename T, std::size_t MR, std::size_t NR>
+void store_tile(const T (&acc)[NR][MR], T* c, std::size_t ldc,
+                std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    if (beta == T {})
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                c[j * ldc + i] = alpha * acc[j][i];
+            }
+        }
+    }
+    else
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                c[j * ldc + i] = alpha * acc[j][i] + beta * c[j * ldc + i];
+            }
+        }
+    }
+}
+
+/// Register-blocked kernel: C[m x n] = alpha * A_panel * B_panel + beta * C,
+/// where m <= MR and n <= NR. C is column-major with leading dimension ldc.
+///
+/// For arithmetic types with vector registers every column of the tile is
+/// held in MR / W native vectors of W elements. The body is always inlined
+/// so that the ISA wrappers below compile it for their own target.
+template <typename T, std::size_t MR, std::size_t NR, std::size_t W>
+[[gnu::always_inline]] inline void micro_kernel(std::size_t k, const T* a, const T* b, T* c, std::size_t ldc,
+                                                std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    T acc[NR][MR];
+
+    if constexpr (is_vectorizable_v<T>)
+    {
+        static_assert(MR % W == 0, "the register tile must be a whole number of vectors tall");
+
+        using vec_t = typename simd::simd_vector<T, W>::type;
+        constexpr std::size_t MV = MR / W;
+
+        vec_t columns[NR][MV] = {};
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            vec_t column[MV];
+            for (std::size_t v = 0; v < MV; ++v)
+            {
+                std::memcpy(&column[v], a + v * W, sizeof(vec_t));
+            }
+            for (std::size_t j = 0; j < NR; ++j)
+            {
+                const T bj = b[j];
+                for (std::size_t v = 0; v < MV; ++v)
+                {
+                    columns[j][v] += column[v] * bj;
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+        for (std::size_t j = 0; j < NR; ++j)
+        {
+            for (std::size_t v = 0; v < MV; ++v)
+            {
+                std::memcpy(&acc[j][v * W], &columns[j][v], sizeof(vec_t));
+            }
+        }
+    }
+    else
+    {
+        for (std::size_t j = 0; j < NR; ++j)
+        {
+            for (std::size_t i = 0; i < MR; ++i)
+            {
+                acc[j][i] = T {};
+            }
+        }
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            for (std::size_t j = 0; j < NR; ++j)
+            {
+                const T bj = b[j];
+                for (std::size_t i = 0; i < MR; ++i)
+                {
+                    acc[j][i] += a[i] * bj;
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+    }
+
+    store_tile<T, MR, NR>(acc, c, ldc, m, n, alpha, beta);
+}
+
+/// Elements of T per native register of the given level; 1 for types the
+/// micro-kernel handles as scalars.
+template <typename T, simd::isa Level>
+constexpr std::size_t vector_elements = is_vectorizable_v<T> ? simd::register_bytes(Level) / sizeof(T) : 1;
+
+template <typename T>
+using micro_kernel_t = void (*)(std::size_t, const T*, const T*, T*, std::size_t, std::size_t, std::size_t, T, T);
+
+template <typename T, std::size_t MR, std::size_t NR>
+void micro_kernel_generic(std::size_t k, const T* a, const T* b, T* c, std::size_t ldc,
+                          std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    micro_kernel<T, MR, NR, vector_elements<T, simd::isa::generic>>(k, a, b, c, ldc, m, n, alpha, beta);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T, std::size_t MR, std::size_t NR>
+[[gnu::target("sse2")]]
+void micro_kernel_sse2(std::size_t k, const T* a, const T* b, T* c, std::size_t ldc,
+                       std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    micro_kernel<T, MR, NR, vector_elements<T, simd::isa::sse2>>(k, a, b, c, ldc, m, n, alpha, beta);
+}
+
+template <typename T, std::size_t MR, std::size_t NR>
+[[gnu::target("avx2,fma")]]
+void micro_kernel_avx2(std::size_t k, const T* a, const T* b, T* c, std::size_t ldc,
+                       std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    micro_kernel<T, MR, NR, vector_elements<T, simd::isa::avx2>>(k, a, b, c, ldc, m, n, alpha, beta);
+}
+
+template <typename T, std::size_t MR, std::size_t NR>
+[[gnu::target("avx512f,fma")]]
+void micro_kernel_avx512(std::size_t k, const T* a, const T* b, T* c, std::size_t ldc,
+                         std::size_t m, std::size_t n, T alpha, T beta) noexcept
+{
+    micro_kernel<T, MR, NR, vector_elements<T, simd::isa::avx512>>(k, a, b, c, ldc, m, n, alpha, beta);
+}
+#endif // HAIFISCH_X86
+
+/// C = alpha * A * B + beta * C for column-major C (m x n), with the given
+/// blocking and micro-kernel. Element (i, p) of A lives at
+/// a[i * a_rs + p * a_cs] and element (p, j) of B at b[p * b_rs + j * b_cs],
+/// so transposed operands are read in place by the packing routines.
+///
+/// The classic five-loop Goto/BLIS scheme: B is packed per kc x nc panel,
+/// A per kc-deep panel, and the mc x nr tiles of C are shared among the
+/// OpenMP threads. A and B may be stored in a narrower type than T; they
+/// are widened while packing, so the kernels only ever see T.
+///
+/// The packed panels go to workspace when given, which must then hold
+/// packing_size<T, Blocking>(m, n, k) elements; otherwise they are
+/// allocated for the call.
+template <typename T, typename Blocking, micro_kernel_t<T> Kernel, typename SA = T, typename SB = T>
+void gemm_driver(std::size_t m, std::size_t n, std::size_t k, T alpha,
+                 const SA* a, std::size_t a_rs, std::size_t a_cs,
+                 const SB* b, std::size_t b_rs, std::size_t b_cs,
+                 T beta, T* c, std::size_t ldc, T* workspace = nullptr)
+{
+    using blocking = Blocking;
+    constexpr std::size_t mr = blocking::mr;
+    constexpr std::size_t nr = blocking::nr;
+
+    if (m == 0 || n == 0)
+    {
+        return;
+    }
+    if (k == 0 || alpha == T {})
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                c[j * ldc + i] = beta == T {} ? T {} : beta * c[j * ldc + i];
+            }
+        }
+        return;
+    }
+
+    const std::size_t kc_max = std::min(blocking::kc, k);
+    aligned_buffer<T> owned(workspace == nullptr ? packing_size<T, blocking>(m, n, k) : 0);
+    T* const packed_a = workspace == nullptr ? owned.get() : align_to_line(workspace);
+    T* const packed_b = packed_a + round_up(round_up(m, mr) * kc_max, line_elements<T>);
+
+    const std::size_t a_panels = round_up(m, mr) / mr;
+    const std::size_t m_blocks = round_up(m, blocking::mc) / blocking::mc;
+    const bool parallel = m * n * k >= gemm_parallel_threshold;
+
+    HAIFISCH_PROFILE_TEAM(team);
+    #pragma omp parallel if (parallel)
+    {
+        HAIFISCH_PROFILE_MEMBER(team);
+        for (std::size_t jc = 0; jc < n; jc += blocking::nc)
+        {
+            const std::size_t nb = std::min(blocking::nc, n - jc);
+            const std::size_t b_panels = round_up(nb, nr) / nr;
+
+            for (std::size_t pc = 0; pc < k; pc += blocking::kc)
+            {
+                const std::size_t kb = std::min(blocking::kc, k - pc);
+                const T beta_panel = pc == 0 ? beta : T { 1 };
+
+                #pragma omp for schedule(static) nowait
+                for (std::size_t panel = 0; panel < b_panels; ++panel)
+                {
+                    pack_b<T, nr, SB>(panel, panel + 1, kb, nb, b + jc * b_cs + pc * b_rs, b_rs, b_cs, packed_b);
+                }
+
+                #pragma omp for schedule(static)
+                for (std::size_t panel = 0; panel < a_panels; ++panel)
+                {
+                    pack_a<T, mr, SA>(panel, panel + 1, m, kb, a + pc * a_cs, a_rs, a_cs, packed_a);
+                }
+
+                #pragma omp for collapse(2) schedule(static)
+                for (std::size_t ib = 0; ib < m_blocks; ++ib)
+                {
+                    for (std::size_t jr = 0; jr < b_panels; ++jr)
+                    {
+                        const std::size_t ic = ib * blocking::mc;
+                        const std::size_t mb = std::min(blocking::mc, m - ic);
+                        const std::size_t n_tile = std::min(nr, nb - jr * nr);
+                        const T* b_panel = packed_b + jr * nr * kb;
+                        T* c_tile = c + (jc + jr * nr) * ldc + ic;
+
+                        for (std::size_t ir = 0; ir < mb; ir += mr)
+                        {
+                            const T* a_panel = packed_a + (ic + ir) * kb;
+                            Kernel(kb, a_panel, b_panel, c_tile + ir, ldc,
+                                   std::min(mr, mb - ir), n_tile, alpha, beta_panel);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// C = alpha * op(A) * op(B) + beta * C for column-major C (m x n), op(A)
+/// being m x k and op(B) k x n. A transposed operand is read through
+/// swapped strides, never copied; lda and ldb are the leading dimensions
+/// of A and B as stored. C is not read when beta is zero. float, double and
+/// int32 run the micro-kernel of the ISA level picked at startup, every
+/// other type the generic one. A and B may be bfloat16 or float16 with a
+/// float C: the panels are widened while packing and accumulate in float.
+/// workspace, if given, holds gemm_workspace<T>(m, n, k) elements for the
+/// packed panels, and the call allocates nothing.
+template <typename T, typename SA = T, typename SB = T>
+void gemm(gemm_op op_a, gemm_op op_b, std::size_t m, std::size_t n, std::size_t k,
+          T alpha, const SA* a, std::size_t lda,
+          const SB* b, std::size_t ldb,
+          T beta, T* c, std::size_t ldc, T* workspace = nullptr)
+{
+    const std::size_t a_rs = op_a == gemm_op::none ? 1 : lda;
+    const std::size_t a_cs = op_a == gemm_op::none ? lda : 1;
+    const std::size_t b_rs = op_b == gemm_op::none ? 1 : ldb;
+    const std::size_t b_cs = op_b == gemm_op::none ? ldb : 1;
+
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+#ifdef HAIFISCH_X86
+            case simd::isa::avx512:
+            {
+                using blocking = simd_gemm_blocking<T, simd::isa::avx512>;
+                return gemm_driver<T, blocking, micro_kernel_avx512<T, blocking::mr, blocking::nr>, SA, SB>(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, workspace);
+            }
+            case simd::isa::avx2:
+            {
+                using blocking = simd_gemm_blocking<T, simd::isa::avx2>;
+                return gemm_driver<T, blocking, micro_kernel_avx2<T, blocking::mr, blocking::nr>, SA, SB>(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, workspace);
+            }
+            case simd::isa::sse2:
+            {
+                using blocking = simd_gemm_blocking<T, simd::isa::sse2>;
+                return gemm_driver<T, blocking, micro_kernel_sse2<T, blocking::mr, blocking::nr>, SA, SB>(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, workspace);
+            }
+#endif // HAIFISCH_X86
+            default:
+            {
+                using blocking = simd_gemm_blocking<T, simd::isa::generic>;
+                return gemm_driver<T, blocking, micro_kernel_generic<T, blocking::mr, blocking::nr>, SA, SB>(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, workspace);
+            }
+        }
+    }
+    else
+    {
+        using blocking = gemm_blocking<T>;
+        gemm_driver<T, blocking, micro_kernel_generic<T, blocking::mr, blocking::nr>, SA, SB>(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, workspace);
+    }
+}
+
+/// Elements of workspace gemm() needs for an m x n x k product of T with
+/// the ISA level active now.
+template <typename T>
+std::size_t gemm_workspace(std::size_t m, std::size_t n, std::size_t k) noexcept
+{
+    if constexpr (simd::has_kernels_v<T>)
+    {
+        switch (simd::active_isa())
+        {
+#ifdef HAIFISCH_X86
+            case simd::isa::avx512: return packing_size<T, simd_gemm_blocking<T, simd::isa::avx512>>(m, n, k);
+            case simd::isa::avx2:   return packing_size<T, simd_gemm_blocking<T, simd::isa::avx2>>(m, n, k);
+            case simd::isa::sse2:   return packing_size<T, simd_gemm_blocking<T, simd::isa::sse2>>(m, n, k);
+#endif // HAIFISCH_X86
+            default:                return packing_size<T, simd_gemm_blocking<T, simd::isa::generic>>(m, n, k);
+        }
+    }
+    else
+    {
+        return packing_size<T, gemm_blocking<T>>(m, n, k);
+    }
+}
+
+/// C = A * B + beta * C for column-major A (m x k), B (k x n) and C (m x n).
+/// C is not read when beta is zero.
+template <typename T>
+void gemm(std::size_t m, std::size_t n, std::size_t k,
+          const T* a, std::size_t lda,
+          const T* b, std::size_t ldb,
+          T* c, std::size_t ldc, T beta = T {}, T* workspace = nullptr)
+{
+    gemm(gemm_op::none, gemm_op::none, m, n, k, T { 1 }, a, lda, b, ldb, beta, c, ldc, workspace);
+}
+} // namespace detail
+} // namespace haifisch
+
+#endif // HAIFISCH_GEMM_HPP
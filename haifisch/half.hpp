@@ -0,0 +1,287 @@
+#pragma once
+
+#ifndef HAIFISCH_HALF_HPP
+#define HAIFISCH_HALF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+
+#include "simd.hpp"
+
+#ifdef HAIFISCH_X86
+# include <immintrin.h>
+#endif // HAIFISCH_X86
+
+
+namespace haifisch
+{
+namespace detail
+{
+[[gnu::always_inline]] inline std::uint32_t float_bits(float value) noexcept
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+[[gnu::always_inline]] inline float bits_float(std::uint32_t bits) noexcept
+{
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// Rounds to nearest even; NaNs stay NaN (quieted) instead of rounding
+/// into infinity.
+[[gnu::always_inline]] inline std::uint16_t float_to_bfloat16(float value) noexcept
+{
+    std::uint32_t bits = float_bits(value);
+    if ((bits & 0x7fffffffu) > 0x7f800000u)
+    {
+        return static_cast<std::uint16_t>((bits >> 16) | 0x0040u);
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1u);
+    return static_cast<std::uint16_t>(bits >> 16);
+}
+
+[[gnu::always_inline]] inline float bfloat16_to_float(std::uint16_t bits) noexcept
+{
+    return bits_float(std::uint32_t { bits } << 16);
+}
+
+/// IEEE binary16 with round to nearest even. Values below the normal range
+/// are rounded by adding a magic number that lines their bits up with the
+/// binary16 subnormal mantissa, so the FPU does the rounding.
+[[gnu::always_inline]] inline std::uint16_t float_to_float16(float value) noexcept
+{
+    const std::uint32_t bits = float_bits(value);
+    const std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t magnitude = bits & 0x7fffffffu;
+
+    if (magnitude >= 0x7f800000u)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x0200u : 0u));
+    }
+    if (magnitude >= 0x477ff000u)
+    {
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (magnitude < 0x38800000u)
+    {
+        constexpr std::uint32_t magic = 126u << 23;
+        const float rounded = bits_float(magnitude) + bits_float(magic);
+        return static_cast<std::uint16_t>(sign | (float_bits(rounded) - magic));
+    }
+
+    const std::uint32_t odd = (magnitude >> 13) & 1u;
+    magnitude = magnitude - (112u << 23) + 0xfffu + odd;
+    return static_cast<std::uint16_t>(sign | (magnitude >> 13));
+}
+
+[[gnu::always_inline]] inline float float16_to_float(std::uint16_t bits) noexcept
+{
+    const std::uint32_t sign = std::uint32_t { bits & 0x8000u } << 16;
+    const std::uint32_t exponent = (bits >> 10) & 0x1fu;
+    const std::uint32_t mantissa = bits & 0x3ffu;
+
+    if (exponent == 0x1f)
+    {
+        return bits_float(sign | 0x7f800000u | (mantissa << 13));
+    }
+    if (exponent == 0)
+    {
+        const float magnitude = static_cast<float>(mantissa) * 0x1p-24f;
+        return bits_float(sign | float_bits(magnitude));
+    }
+    return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+} // namespace detail
+
+/// Brain floating point: the upper 16 bits of a binary32, so the full float
+/// exponent range with an 8-bit significand. A storage type — arithmetic
+/// goes through float.
+struct bfloat16
+{
+    std::uint16_t bits;
+
+    bfloat16() = default;
+    explicit bfloat16(float value) noexcept
+        : bits(detail::float_to_bfloat16(value))
+    { }
+
+    operator float() const noexcept
+    {
+        return detail::bfloat16_to_float(bits);
+    }
+};
+
+/// IEEE 754 binary16: 5 exponent and 11 significand bits, finite up to
+/// 65504. A storage type — arithmetic goes through float.
+struct float16
+{
+    std::uint16_t bits;
+
+    float16() = default;
+    explicit float16(float value) noexcept
+        : bits(detail::float_to_float16(value))
+    { }
+
+    operator float() const noexcept
+    {
+        return detail::float16_to_float(bits);
+    }
+};
+
+template <typename T>
+constexpr bool is_half_v = std::is_same_v<T, bfloat16> || std::is_same_v<T, float16>;
+
+inline std::ostream& operator << (std::ostream& os, bfloat16 value)
+{
+    return os << static_cast<float>(value);
+}
+
+inline std::ostream& operator << (std::ostream& os, float16 value)
+{
+    return os << static_cast<float>(value);
+}
+
+namespace detail
+{
+/// Converts n elements; the generic form is an element-wise cast, the
+/// overloads below convert between half precision and float in bulk.
+template <typename S, typename T>
+void convert_elements(const S* src, std::size_t n, T* dst) noexcept
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i] = static_cast<T>(src[i]);
+    }
+}
+
+#ifdef HAIFISCH_X86
+[[gnu::target("avx,f16c")]]
+inline void widen_f16c(const float16* src, std::size_t n, float* dst) noexcept
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    for (; i < n; ++i)
+    {
+        dst[i] = float16_to_float(src[i].bits);
+    }
+}
+
+[[gnu::target("avx,f16c")]]
+inline void narrow_f16c(const float* src, std::size_t n, float16* dst) noexcept
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+    for (; i < n; ++i)
+    {
+        dst[i].bits = float_to_float16(src[i]);
+    }
+}
+
+/// vcvtneps2bf16 treats float subnormals as zero, otherwise it matches
+/// float_to_bfloat16().
+[[gnu::target("avx512f,avx512bf16")]]
+inline void narrow_avx512_bf16(const float* src, std::size_t n, bfloat16* dst) noexcept
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        std::memcpy(dst + i, &h, sizeof(h));
+    }
+    for (; i < n; ++i)
+    {
+        dst[i].bits = float_to_bfloat16(src[i]);
+    }
+}
+#endif // HAIFISCH_X86
+
+/// F16C came with the first AVX2 parts, so it is used from the avx2 level
+/// up; HAIFISCH_ISA=generic or sse2 selects the software conversion.
+inline bool use_f16c() noexcept
+{
+#ifdef HAIFISCH_X86
+    return simd::active_isa() >= simd::isa::avx2 && __builtin_cpu_supports("f16c");
+#else
+    return false;
+#endif // HAIFISCH_X86
+}
+
+inline bool use_avx512_bf16() noexcept
+{
+#ifdef HAIFISCH_X86
+    return simd::active_isa() == simd::isa::avx512 && __builtin_cpu_supports("avx512bf16");
+#else
+    return false;
+#endif // HAIFISCH_X86
+}
+
+/// Widening bfloat16 is a 16-bit shift, which the compiler vectorizes for
+/// the baseline ISA on its own.
+inline void convert_elements(const bfloat16* src, std::size_t n, float* dst) noexcept
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i] = bfloat16_to_float(src[i].bits);
+    }
+}
+
+inline void convert_elements(const float16* src, std::size_t n, float* dst) noexcept
+{
+#ifdef HAIFISCH_X86
+    if (use_f16c())
+    {
+        return widen_f16c(src, n, dst);
+    }
+#endif // HAIFISCH_X86
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i] = float16_to_float(src[i].bits);
+    }
+}
+
+inline void convert_elements(const float* src, std::size_t n, bfloat16* dst) noexcept
+{
+#ifdef HAIFISCH_X86
+    if (use_avx512_bf16())
+    {
+        return narrow_avx512_bf16(src, n, dst);
+    }
+#endif // HAIFISCH_X86
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i].bits = float_to_bfloat16(src[i]);
+    }
+}
+
+inline void convert_elements(const float* src, std::size_t n, float16* dst) noexcept
+{
+#ifdef HAIFISCH_X86
+    if (use_f16c())
+    {
+        return narrow_f16c(src, n, dst);
+    }
+#endif // HAIFISCH_X86
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        dst[i].bits = float_to_float16(src[i]);
+    }
+}
+} // namespace detail
+} // namespace haifisch
+
+#endif // HAIFISCH_HALF_HPP
@@ -0,0 +1,532 @@
+#pragma once
+
+#ifndef HAIFISCH_MAPPED_HPP
+#define HAIFISCH_MAPPED_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gemm.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+/// Element type codes of the binary matrix format.
+enum class element_type : std::uint32_t
+{
+    int8 = 1,
+    int16 = 2,
+    int32 = 3,
+    int64 = 4,
+    uint8 = 5,
+    uint16 = 6,
+    uint32 = 7,
+    uint64 = 8,
+    float32 = 9,
+    float64 = 10
+};
+
+/// How mapped_matrix maps its file.
+///
+/// read_only:     shared, read-only pages; writing through them faults.
+/// copy_on_write: private pages; writes stay in memory and never reach
+///                the file.
+/// read_write:    shared, writable pages; writes reach the file, at the
+///                latest on sync() or unmapping.
+enum class map_mode
+{
+    read_only,
+    copy_on_write,
+    read_write
+};
+
+/// Header of the binary matrix format, version 1.
+///
+/// A file is this 64-byte header, zero padding up to data_offset, and the
+/// elements in native byte order with element (x, y) at
+/// y * width + x, i.e. the layout of haifisch::matrix (layout code 0).
+/// data_offset is a multiple of alignment, 4096 when written by
+/// save_matrix(), so the mapped elements start on a page boundary.
+/// byte_order holds 0x01020304 as written by the producing machine;
+/// files of the other byte order are rejected instead of converted.
+struct matrix_file_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t type;
+    std::uint32_t element_size;
+    std::uint32_t layout;
+    std::uint32_t reserved;
+    std::uint64_t width;
+    std::uint64_t height;
+    std::uint64_t alignment;
+    std::uint64_t data_offset;
+};
+
+static_assert(sizeof(matrix_file_header) == 64, "the file header is 64 bytes long");
+
+namespace detail
+{
+constexpr char matrix_file_magic[8] = { 'H', 'A', 'I', 'F', 'I', 'S', 'C', 'H' };
+constexpr std::uint32_t matrix_file_version = 1;
+constexpr std::uint32_t matrix_file_byte_order = 0x01020304;
+constexpr std::uint32_t matrix_file_layout = 0;
+constexpr std::uint64_t matrix_file_alignment = 4096;
+
+template <typename T>
+constexpr element_type element_type_of() noexcept
+{
+    if constexpr (std::is_same_v<T, float>)
+    {
+        return element_type::float32;
+    }
+    else if constexpr (std::is_same_v<T, double>)
+    {
+        return element_type::float64;
+    }
+    else
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>, "no file element type for T");
+        constexpr std::uint32_t log_size = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3;
+        return static_cast<element_type>((std::is_signed_v<T> ? 1 : 5) + log_size);
+    }
+}
+
+[[noreturn]] inline void throw_file_error(const char* what, const std::string& path)
+{
+    throw std::system_error(errno, std::generic_category(), std::string("haifisch: ") + what + " " + path);
+}
+
+/// Closes the descriptor when leaving scope.
+class file_descriptor
+{
+public:
+    file_descriptor(const std::string& path, int flags)
+        : fd(::open(path.c_str(), flags | O_CLOEXEC, 0644))
+    {
+        if (fd < 0)
+        {
+            throw_file_error("cannot open", path);
+        }
+    }
+    file_descriptor(const file_descriptor&) = delete;
+    file_descriptor& operator = (const file_descriptor&) = delete;
+    ~file_descriptor()
+    {
+        ::close(fd);
+    }
+    int get() const noexcept
+    {
+        return fd;
+    }
+
+private:
+    int fd;
+};
+
+inline void write_all(int fd, const void* data, std::size_t bytes, const std::string& path)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (bytes > 0)
+    {
+        const ssize_t written = ::write(fd, ptr, bytes);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_file_error("cannot write", path);
+        }
+        ptr += written;
+        bytes -= static_cast<std::size_t>(written);
+    }
+}
+
+template <typename T>
+matrix_file_header make_file_header(std::size_t width, std::size_t height) noexcept
+{
+    matrix_file_header header = {};
+    std::memcpy(header.magic, matrix_file_magic, sizeof(header.magic));
+    header.version = matrix_file_version;
+    header.byte_order = matrix_file_byte_order;
+    header.type = static_cast<std::uint32_t>(element_type_of<T>());
+    header.element_size = sizeof(T);
+    header.layout = matrix_file_layout;
+    header.width = width;
+    header.height = height;
+    header.alignment = matrix_file_alignment;
+    header.data_offset = matrix_file_alignment;
+    return header;
+}
+} // namespace detail
+
+/// Writes source to path in the binary matrix format, replacing the file.
+/// Strided views are written line by line. Throws std::system_error when
+/// the file cannot be written.
+template <typename S>
+void save_matrix(const std::string& path, matrix_view<S> source)
+{
+    using T = std::remove_const_t<S>;
+
+    const matrix_file_header header = detail::make_file_header<T>(source.width(), source.height());
+    const detail::file_descriptor file(path, O_WRONLY | O_CREAT | O_TRUNC);
+
+    char prefix[detail::matrix_file_alignment] = {};
+    std::memcpy(prefix, &header, sizeof(header));
+    detail::write_all(file.get(), prefix, sizeof(prefix), path);
+
+    if (source.contiguous())
+    {
+        detail::write_all(file.get(), source.data(), source.width() * source.height() * sizeof(T), path);
+    }
+    else
+    {
+        for (std::size_t y = 0; y < source.height(); ++y)
+        {
+            detail::write_all(file.get(), source.at_pointer(0, y), source.width() * sizeof(T), path);
+        }
+    }
+}
+
+/// Matrix file mapped into memory: opening costs one mmap, and the
+/// elements are paged in from the file as the kernels touch them.
+///
+/// The elements are reached through views, so a mapped operand goes
+/// straight into multiply(), gemm() or transpose(), and matrix<T>'s view
+/// constructor copies it into owned storage when needed. Throws
+/// std::system_error on I/O failures and std::runtime_error when the file
+/// is not a matrix file of element type T in the native byte order.
+template <typename T>
+class mapped_matrix
+{
+public:
+    explicit mapped_matrix(const std::string& path, map_mode mode_ = map_mode::read_only)
+        : mode(mode_)
+    {
+        const detail::file_descriptor file(path, mode == map_mode::read_write ? O_RDWR : O_RDONLY);
+
+        struct stat status;
+        if (::fstat(file.get(), &status) != 0)
+        {
+            detail::throw_file_error("cannot stat", path);
+        }
+        const std::size_t file_size = static_cast<std::size_t>(status.st_size);
+        if (file_size < sizeof(matrix_file_header))
+        {
+            throw std::runtime_error("haifisch: not a matrix file " + path);
+        }
+
+        map(file.get(), file_size, path);
+        const matrix_file_header& header = *static_cast<const matrix_file_header*>(base);
+        const char* error = validate(header, file_size);
+        if (error != nullptr)
+        {
+            unmap();
+            throw std::runtime_error(std::string("haifisch: ") + error + " " + path);
+        }
+
+        ptr = reinterpret_cast<T*>(static_cast<char*>(base) + header.data_offset);
+        cols = static_cast<std::size_t>(header.width);
+        rows = static_cast<std::size_t>(header.height);
+    }
+    mapped_matrix(const mapped_matrix&) = delete;
+    mapped_matrix& operator = (const mapped_matrix&) = delete;
+    mapped_matrix(mapped_matrix&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    mapped_matrix& operator = (mapped_matrix&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            base = other.base;
+            length = other.length;
+            ptr = other.ptr;
+            cols = other.cols;
+            rows = other.rows;
+            mode = other.mode;
+            other.base = nullptr;
+            other.length = 0;
+            other.ptr = nullptr;
+            other.cols = 0;
+            other.rows = 0;
+        }
+        return *this;
+    }
+    ~mapped_matrix()
+    {
+        unmap();
+    }
+
+    /// Creates a zero-filled width x height matrix file at path and maps it
+    /// read_write, e.g. as the destination of a product too large for RAM.
+    static mapped_matrix create(const std::string& path, std::size_t width, std::size_t height)
+    {
+        const matrix_file_header header = detail::make_file_header<T>(width, height);
+        {
+            const detail::file_descriptor file(path, O_RDWR | O_CREAT | O_TRUNC);
+            detail::write_all(file.get(), &header, sizeof(header), path);
+            if (::ftruncate(file.get(), static_cast<off_t>(header.data_offset + width * height * sizeof(T))) != 0)
+            {
+                detail::throw_file_error("cannot resize", path);
+            }
+        }
+        return mapped_matrix(path, map_mode::read_write);
+    }
+
+    [[gnu::always_inline]] inline std::size_t width() const noexcept
+    {
+        return cols;
+    }
+    [[gnu::always_inline]] inline std::size_t height() const noexcept
+    {
+        return rows;
+    }
+    [[gnu::always_inline]] inline map_mode access() const noexcept
+    {
+        return mode;
+    }
+    [[gnu::always_inline]] inline const T* data() const noexcept
+    {
+        return ptr;
+    }
+    [[gnu::always_inline]] inline matrix_view<const T> view() const noexcept
+    {
+        return matrix_view<const T>(ptr, cols, rows);
+    }
+    /// Writable view; the mapping must not be read_only.
+    [[gnu::always_inline]] inline matrix_view<T> mutable_view() const noexcept
+    {
+        assert(mode != map_mode::read_only);
+        return matrix_view<T>(ptr, cols, rows);
+    }
+
+    /// Writes modified pages of a read_write mapping back to the file.
+    void sync() const
+    {
+        if (mode == map_mode::read_write && base != nullptr && ::msync(base, length, MS_SYNC) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "haifisch: cannot sync mapped matrix");
+        }
+    }
+
+private:
+    void map(int fd, std::size_t bytes, const std::string& path)
+    {
+        const int protection = mode == map_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+        const int flags = mode == map_mode::copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+        void* mapping = ::mmap(nullptr, bytes, protection, flags, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            detail::throw_file_error("cannot map", path);
+        }
+        base = mapping;
+        length = bytes;
+    }
+
+    void unmap() noexcept
+    {
+        if (base != nullptr)
+        {
+            ::munmap(base, length);
+            base = nullptr;
+        }
+    }
+
+    static const char* validate(const matrix_file_header& header, std::size_t file_size) noexcept
+    {
+        if (std::memcmp(header.magic, detail::matrix_file_magic, sizeof(header.magic)) != 0)
+        {
+            return "not a matrix file";
+        }
+        if (header.version != detail::matrix_file_version)
+        {
+            return "unsupported format version in";
+        }
+        if (header.byte_order != detail::matrix_file_byte_order)
+        {
+            return "foreign byte order in";
+        }
+        if (header.type != static_cast<std::uint32_t>(detail::element_type_of<T>()) || header.element_size != sizeof(T))
+        {
+            return "element type mismatch in";
+        }
+        if (header.layout != detail::matrix_file_layout)
+        {
+            return "unsupported layout in";
+        }
+        if (header.data_offset < sizeof(matrix_file_header) || header.data_offset % alignof(T) != 0)
+        {
+            return "misaligned elements in";
+        }
+        if (header.data_offset > file_size
+            || (header.width != 0 && header.height > (file_size - header.data_offset) / sizeof(T) / header.width))
+        {
+            return "truncated matrix file";
+        }
+        return nullptr;
+    }
+
+    void* base = nullptr;
+    std::size_t length = 0;
+    T* ptr = nullptr;
+    std::size_t cols = 0;
+    std::size_t rows = 0;
+    map_mode mode = map_mode::read_only;
+};
+
+namespace detail
+{
+/// Default memory budget of out_of_core_multiply(): the tile buffers
+/// together stay below 256 MiB.
+constexpr std::size_t out_of_core_budget = std::size_t { 256 } << 20;
+
+/// Side of the square tiles: two A tiles, two B tiles and one C tile must
+/// fit in the budget. Multiple of 64, at least 64.
+template <typename T>
+std::size_t out_of_core_tile(std::size_t memory_budget) noexcept
+{
+    const std::size_t side = static_cast<std::size_t>(std::sqrt(static_cast<double>(memory_budget / (5 * sizeof(T)))));
+    return std::max<std::size_t>(64, side / 64 * 64);
+}
+
+/// Starts asynchronous readahead of every line of block. Only a hint: for
+/// resident memory it costs a system call per line and nothing else.
+template <typename T>
+void prefetch_block(matrix_view<T> block) noexcept
+{
+#if defined(__linux__) && defined(MADV_WILLNEED)
+    const std::uintptr_t page_mask = ~std::uintptr_t { matrix_file_alignment - 1 };
+    const std::size_t lines = block.contiguous() ? 1 : block.height();
+    const std::size_t line_bytes = (block.contiguous() ? block.width() * block.height() : block.width()) * sizeof(T);
+    for (std::size_t y = 0; y < lines; ++y)
+    {
+        const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(block.at_pointer(0, y));
+        const std::uintptr_t start = first & page_mask;
+        ::madvise(reinterpret_cast<void*>(start), first + line_bytes - start, MADV_WILLNEED);
+    }
+#else
+    static_cast<void>(block);
+#endif // __linux__ && MADV_WILLNEED
+}
+} // namespace detail
+
+/// c = a * b + beta * c for operands that need not fit in memory, e.g. the
+/// views of mapped_matrix files, keeping at most memory_budget bytes of
+/// tiles resident.
+///
+/// c is produced one square tile at a time, accumulated over the tiles of
+/// a and b along k. Every step copies its a and b tiles into dense buffers
+/// and multiplies them with the in-memory GEMM engine; meanwhile a
+/// separate thread reads ahead and copies the tiles of the next step into
+/// the other half of the double buffer, so I/O overlaps the computation.
+template <typename A, typename B, typename T>
+void out_of_core_multiply(matrix_view<A> a, matrix_view<B> b, matrix_view<T> c, T beta = T {},
+                          std::size_t memory_budget = detail::out_of_core_budget)
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T> && std::is_same_v<std::remove_const_t<B>, T>,
+                  "operands must share the element type");
+    assert(a.height() == b.width());
+    assert(c.width() == a.width());
+    assert(c.height() == b.height());
+
+    const std::size_t m = a.width();
+    const std::size_t k = a.height();
+    const std::size_t n = b.height();
+    if (m == 0 || n == 0 || k == 0)
+    {
+        multiply(a, b, c, beta);
+        return;
+    }
+
+    const std::size_t tile = detail::out_of_core_tile<T>(memory_budget);
+    const std::size_t m_tiles = (m + tile - 1) / tile;
+    const std::size_t n_tiles = (n + tile - 1) / tile;
+    const std::size_t k_tiles = (k + tile - 1) / tile;
+    const std::size_t steps = m_tiles * n_tiles * k_tiles;
+
+    detail::aligned_buffer<T> buffer(5 * tile * tile);
+    T* const a_tiles[2] = { buffer.get(), buffer.get() + tile * tile };
+    T* const b_tiles[2] = { buffer.get() + 2 * tile * tile, buffer.get() + 3 * tile * tile };
+    T* const c_tile = buffer.get() + 4 * tile * tile;
+
+    /// Step s multiplies tile (i, p) of a by tile (p, j) of b, p fastest.
+    struct step
+    {
+        std::size_t x, y, p, w, h, depth;
+    };
+    auto decode = [&](std::size_t s) {
+        const std::size_t p = s % k_tiles * tile;
+        const std::size_t y = s / k_tiles % n_tiles * tile;
+        const std::size_t x = s / (k_tiles * n_tiles) * tile;
+        return step { x, y, p, std::min(tile, m - x), std::min(tile, n - y), std::min(tile, k - p) };
+    };
+    auto load = [&](std::size_t s) {
+        const step t = decode(s);
+        const matrix_view<const T> a_block = matrix_view<const T>(a).block(t.x, t.p, t.w, t.depth);
+        const matrix_view<const T> b_block = matrix_view<const T>(b).block(t.p, t.y, t.depth, t.h);
+        detail::prefetch_block(a_block);
+        detail::prefetch_block(b_block);
+        matrix_view<T>(a_tiles[s % 2], t.w, t.depth).assign(a_block);
+        matrix_view<T>(b_tiles[s % 2], t.depth, t.h).assign(b_block);
+    };
+
+    std::future<void> pending = std::async(std::launch::async, load, std::size_t { 0 });
+    for (std::size_t s = 0; s < steps; ++s)
+    {
+        pending.get();
+        if (s + 1 < steps)
+        {
+            pending = std::async(std::launch::async, load, s + 1);
+        }
+
+        const step t = decode(s);
+        const matrix_view<T> c_block = c.block(t.x, t.y, t.w, t.h);
+        const matrix_view<T> accumulator(c_tile, t.w, t.h);
+        T first_beta = T {};
+        if (t.p == 0 && beta != T {})
+        {
+            accumulator.assign(c_block);
+            first_beta = beta;
+        }
+
+        detail::gemm(t.w, t.h, t.depth, a_tiles[s % 2], t.w, b_tiles[s % 2], t.depth,
+                     c_tile, t.w, t.p == 0 ? first_beta : T { 1 });
+
+        if (t.p + t.depth == k)
+        {
+            c_block.assign(accumulator);
+        }
+    }
+}
+
+/// Out-of-core product of three matrix files; c must be mapped read_write.
+template <typename T>
+void out_of_core_multiply(const mapped_matrix<T>& a, const mapped_matrix<T>& b, const mapped_matrix<T>& c,
+                          std::size_t memory_budget = detail::out_of_core_budget)
+{
+    out_of_core_multiply(a.view(), b.view(), c.mutable_view(), T {}, memory_budget);
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_MAPPED_HPP
@@ -12,12 +12,34 @@
 #undef use_inline
 
 #include <iostream>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <memory>
 
 #include <boost/pool/pool_alloc.hpp>
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
+#include "allocator.hpp"
+#include "batch.hpp"
+#include "blas.hpp"
+#include "elementwise.hpp"
+#include "expression.hpp"
+#include "fixed.hpp"
+#include "gemm.hpp"
+#include "half.hpp"
+#include "mapped.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "quantized.hpp"
+#include "solve.hpp"
+#include "sparse.hpp"
+#include "transpose.hpp"
+#include "view.hpp"
+
 
 namespace haifisch
 {
@@ -53,10 +75,15 @@ private:
     allocator_type allocator;
 };
 
-#include <boost/pool/pool_alloc.hpp>
+/// Default storage: small matrices recycle blocks through the thread-local
+/// pool, large ones are 64-byte aligned, huge-page backed and first-touch
+/// initialized, see recycling_allocator and storage_policy.
+template  <typename T>
+using matrix_allocator_t = matrix_allocator<T, std::allocator_traits<recycling_allocator<T>>>;
 
+/// Storage from a boost pool, without alignment or placement guarantees.
 template  <typename T>
-using matrix_allocator_t = matrix_allocator<T, std::allocator_traits<boost::pool_allocator<T>>>;
+using pool_matrix_allocator_t = matrix_allocator<T, std::allocator_traits<boost::pool_allocator<T>>>;
 
 template <typename T, typename Allocator = matrix_allocator_t<T>>
 class vector
@@ -67,13 +94,58 @@ public:
         , vec(allocator.allocate(size))
         , len(size)
     { }
+    MATRIX_INLINE vector(const vector& rhs) noexcept
+        : allocator()
+        , vec(allocator.allocate(rhs.len))
+        , len(rhs.len)
+    {
+        std::copy_n(rhs.vec, len, vec);
+    }
+    MATRIX_INLINE vector(vector&& rhs) noexcept
+        : allocator()
+        , vec(rhs.vec)
+        , len(rhs.len)
+    {
+        rhs.vec = nullptr;
+        rhs.len = 0;
+    }
     MATRIX_INLINE virtual ~vector()
     {
-        if (vec)
+        destroy();
+    }
+    MATRIX_INLINE vector& operator = (const vector& rhs) noexcept
+    {
+        if (this != &rhs)
         {
-            delete[] vec;
-            vec = nullptr;
+            if (len != rhs.len)
+            {
+                destroy();
+                vec = allocator.allocate(rhs.len);
+                len = rhs.len;
+            }
+            std::copy_n(rhs.vec, len, vec);
         }
+        return *this;
+    }
+    MATRIX_INLINE vector& operator = (vector&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            destroy();
+            vec = rhs.vec;
+            len = rhs.len;
+            rhs.vec = nullptr;
+            rhs.len = 0;
+        }
+        return *this;
+    }
+    MATRIX_INLINE T* data() const noexcept
+    {
+        return vec;
+    }
+    MATRIX_INLINE void fill(T value) noexcept
+    {
+        detail::elementwise<T>(simd::elementwise_op::fill, vec, nullptr, value, len);
     }
     MATRIX_INLINE T& at(std::size_t index) const noexcept
     {
@@ -88,7 +160,25 @@ public:
     {
         return len;
     }
+    MATRIX_INLINE bool operator == (const vector& other) const noexcept
+    {
+        return len == other.len && std::equal(vec, vec + len, other.vec);
+    }
+    MATRIX_INLINE bool operator != (const vector& other) const noexcept
+    {
+        return !(*this == other);
+    }
+
 private:
+    void destroy() noexcept
+    {
+        if (vec)
+        {
+            allocator.deallocate(vec, len);
+            vec = nullptr;
+        }
+    }
+
     Allocator allocator;
     T* vec;
     std::size_t len;
@@ -103,16 +193,67 @@ struct naive_mul_impl
     matrix<T> process(const matrix<T>& lhs, const matrix<T>& rhs);
 };
 
+template <typename T, typename Allocator = matrix_allocator_t<T>>
+struct blocked_mul_impl
+{
+    matrix<T> process(const matrix<T>& lhs, const matrix<T>& rhs);
+};
+
 template <typename T, typename Allocator = matrix_allocator_t<T>>
 struct strassen_mul_impl
 {
+    /// Cutoff new instances start with: once the smallest dimension of a
+    /// block is at most this, the recursion hands it to the GEMM engine.
+    static inline std::size_t default_cutoff = 1024;
+
+    /// Recursion levels whose seven products run as OpenMP tasks, enough
+    /// for every thread of the default team to get at least one leaf.
+    static std::size_t default_task_depth() noexcept;
+
+    explicit strassen_mul_impl(std::size_t cutoff_ = default_cutoff,
+                               std::size_t task_depth_ = default_task_depth()) noexcept
+        : cutoff(std::max<std::size_t>(cutoff_, 1))
+        , task_depth(task_depth_)
+        , threads(max_threads())
+    { }
+
+    /// Number of elements of scratch space an (m x k) * (k x n) product needs.
+    std::size_t workspace_size(std::size_t m, std::size_t k, std::size_t n) const noexcept;
+
+    matrix<T> process(const matrix<T>& lhs, const matrix<T>& rhs);
     matrix<T> process(T* allocated_block, const matrix<T>& lhs, const matrix<T>& rhs);
+    /// Writes lhs * rhs into result, which must not overlap the operands.
+    void process(T* allocated_block, matrix_view<const T> lhs, matrix_view<const T> rhs, matrix_view<T> result);
+
+private:
+    using const_view = matrix_view<const T>;
+    using view = matrix_view<T>;
+
+    static std::size_t max_threads() noexcept;
+    static std::size_t thread_index() noexcept;
+
+    std::size_t level_size(std::size_t m, std::size_t k, std::size_t n, std::size_t depth) const noexcept;
+    std::size_t product_size(std::size_t m, std::size_t k, std::size_t n, std::size_t depth,
+                             bool sum_a, bool sum_b) const noexcept;
+    bool pooled(std::size_t depth) const noexcept;
+    std::size_t pool_slot_size(std::size_t m, std::size_t k, std::size_t n) const noexcept;
+
+    void multiply(T* arena, T* pool, std::size_t depth, const_view a, const_view b, view c);
+    void multiply_sequential(T* arena, std::size_t depth, const_view a, const_view b, view c);
+    void multiply_tasks(T* arena, T* pool, std::size_t depth, const_view a, const_view b, view c);
+    void product(T* slot, T* pool, std::size_t depth,
+                 const_view ax, const_view ay, simd::elementwise_op aop,
+                 const_view bx, const_view by, simd::elementwise_op bop, view p);
+
+    std::size_t cutoff;
+    std::size_t task_depth;
+    std::size_t threads;
 };
 
 template <typename T>
-MATRIX_INLINE matrix<T> transpose(const matrix<T>& rhs) noexcept;
+MATRIX_INLINE inline matrix<T> transpose(const matrix<T>& rhs) noexcept;
 
-std::uint64_t nearest_power_of_2(std::uint64_t value)
+inline std::uint64_t nearest_power_of_2(std::uint64_t value)
 {
     value--;
     value |= value >>  1;
@@ -120,6 +261,7 @@ std::uint64_t nearest_power_of_2(std::uint64_t value)
     value |= value >>  4;
     value |= value >>  8;
     value |= value >> 16;
+    value |= value >> 32;
     value++;
 
     return value;
@@ -141,6 +283,30 @@ public:
     {
         construct(rhs);
     }
+    /// Copies the viewed elements, e.g. of another matrix's block or of a
+    /// fixed_matrix.
+    MATRIX_INLINE explicit matrix(matrix_view<const T> source) noexcept
+        : cols(source.width())
+        , rows(source.height())
+        , mat(allocator.allocate(cols * rows))
+    {
+        view().assign(source);
+    }
+    MATRIX_INLINE explicit matrix(const sparse_matrix<T>& source)
+        : cols(source.width())
+        , rows(source.height())
+        , mat(allocator.allocate(cols * rows))
+    {
+        source.to_dense(view());
+    }
+    template <typename E>
+    MATRIX_INLINE matrix(const matrix_expression<E>& expr) noexcept
+        : cols(expr.self().width())
+        , rows(expr.self().height())
+        , mat(allocator.allocate(cols * rows))
+    {
+        detail::evaluate(mat, expr.self(), cols * rows);
+    }
     MATRIX_INLINE matrix(matrix&& rhs) noexcept
     {
         mat = rhs.mat;
@@ -156,10 +322,8 @@ public:
     }
     MATRIX_INLINE void fill(T value) noexcept
     {
-        for (std::size_t i = 0; i < cols * rows; i++)
-        {
-            mat[i] = value;
-        }
+        HAIFISCH_PROFILE_SCOPE("fill", cols * rows);
+        detail::elementwise<T>(simd::elementwise_op::fill, mat, nullptr, value, cols * rows);
     }
     MATRIX_INLINE constexpr std::size_t width() const noexcept
     {
@@ -177,10 +341,35 @@ public:
     {
         return mat + (cols * y + x);
     }
+    MATRIX_INLINE matrix_view<T> view() const noexcept
+    {
+        return matrix_view<T>(mat, cols, rows);
+    }
+    /// The w x h block whose first element is (x, y), without copying.
+    MATRIX_INLINE matrix_view<T> block(std::size_t x, std::size_t y, std::size_t w, std::size_t h) const noexcept
+    {
+        return view().block(x, y, w, h);
+    }
+    /// Transposes in place: square matrices trade mirrored blocks, other
+    /// shapes are permuted by cycle following. Neither needs a second buffer.
+    MATRIX_INLINE matrix& transpose()
+    {
+        HAIFISCH_PROFILE_SCOPE("transpose", cols * rows);
+        if (cols == rows)
+        {
+            detail::transpose_square(mat, cols, cols);
+        }
+        else
+        {
+            detail::transpose_cycles(mat, cols, rows);
+        }
+        std::swap(cols, rows);
+        return *this;
+    }
     MATRIX_INLINE constexpr T& at(std::size_t x, std::size_t y) const
     {
-        assert(y <= cols);
-        assert(x <= rows);
+        assert(x < cols);
+        assert(y < rows);
 
         return mat[cols * y + x];
     }
@@ -208,80 +397,103 @@ public:
         rhs.cols = 0;
         return *this;
     }
-    MATRIX_INLINE matrix& operator += (const matrix& rhs) noexcept
+    /// Evaluates the expression in place. Operands of an elementwise
+    /// expression always have the shape of its result, so *this may be one
+    /// of them.
+    template <typename E>
+    MATRIX_INLINE matrix& operator = (const matrix_expression<E>& expr) noexcept
     {
-        assert(cols == rhs.cols);
-        assert(rows == rhs.rows);
-
-        for (std::size_t i = 0; i < cols * rows; i++)
+        const std::size_t width_ = expr.self().width();
+        const std::size_t height_ = expr.self().height();
+        if (mat == nullptr || cols * rows != width_ * height_)
         {
-            mat[i] += rhs.mat[i];
+            destroy();
+            mat = allocator.allocate(width_ * height_);
         }
+        cols = width_;
+        rows = height_;
 
+        detail::evaluate(mat, expr.self(), cols * rows);
         return *this;
     }
-    MATRIX_INLINE matrix& operator -= (const matrix& rhs) noexcept
+    template <typename E>
+    MATRIX_INLINE matrix& operator += (const matrix_expression<E>& expr) noexcept
     {
-        assert(cols == rhs.cols);
-        assert(rows == rhs.rows);
-
-        for (std::size_t i = 0; i < cols * rows; i++)
-        {
-            mat[i] -= rhs.mat[i];
-        }
+        assert(cols == expr.self().width());
+        assert(rows == expr.self().height());
 
+        detail::evaluate(mat, as_expression(*this) + expr.self(), cols * rows);
         return *this;
     }
-    MATRIX_INLINE matrix& operator *= (const matrix& rhs) noexcept
+    template <typename E>
+    MATRIX_INLINE matrix& operator -= (const matrix_expression<E>& expr) noexcept
     {
-        assert(cols == rhs.rows);
+        assert(cols == expr.self().width());
+        assert(rows == expr.self().height());
 
-        /// If not power of 2.
-        if ((cols & (cols - 1)) == 0)
-        {
-            strassen_mul_impl<T> impl;
-            *this = impl.process(*this, rhs);
-
-            rows = rhs.rows;
-        }
-        else {
-            naive_mul_impl<T> impl;
-            *this = impl.process(*this, rhs);
+        detail::evaluate(mat, as_expression(*this) - expr.self(), cols * rows);
+        return *this;
+    }
+    MATRIX_INLINE matrix& operator += (const matrix& rhs) noexcept
+    {
+        assert(cols == rhs.cols);
+        assert(rows == rhs.rows);
 
-            rows = rhs.rows;
-        }
+        HAIFISCH_PROFILE_SCOPE("add", cols * rows);
+        detail::elementwise<T>(simd::elementwise_op::add, mat, rhs.mat, T {}, cols * rows);
 
         return *this;
     }
-    MATRIX_INLINE matrix& operator *= (const T& val) noexcept
+    MATRIX_INLINE matrix& operator -= (const matrix& rhs) noexcept
     {
-        for (std::size_t i = 0; i < cols * rows; i++)
-        {
-            mat[i] *= val;
-        }
+        assert(cols == rhs.cols);
+        assert(rows == rhs.rows);
+
+        HAIFISCH_PROFILE_SCOPE("sub", cols * rows);
+        detail::elementwise<T>(simd::elementwise_op::sub, mat, rhs.mat, T {}, cols * rows);
 
         return *this;
     }
-    MATRIX_INLINE matrix operator + (const matrix& rhs) const noexcept
+    MATRIX_INLINE matrix& operator *= (const matrix& rhs) noexcept
     {
-        matrix<T> result = *this;
-        return result += rhs;
+        return *this = *this * rhs;
     }
-    MATRIX_INLINE matrix operator - (const matrix& rhs) const noexcept
+    MATRIX_INLINE matrix& operator *= (const T& val) noexcept
     {
-        matrix<T> result = *this;
-        return result -= rhs;
+        HAIFISCH_PROFILE_SCOPE("scale", cols * rows);
+        detail::elementwise<T>(simd::elementwise_op::scale, mat, nullptr, val, cols * rows);
+
+        return *this;
     }
     MATRIX_INLINE matrix operator * (const matrix& rhs) const noexcept
     {
-        matrix<T> result = *this;
-        return result *= rhs;
+        assert(rows == rhs.cols);
+        HAIFISCH_PROFILE_SCOPE("multiply", cols * rows * rhs.rows);
+
+        if constexpr (is_half_v<T>)
+        {
+            /// Accumulated in float by the widening GEMM, rounded once on store.
+            matrix result(cols, rhs.rows);
+            gemm(1.0f, *this, rhs, 0.0f, result);
+            return result;
+        }
+        else
+        {
+            if (std::min({ cols, rows, rhs.rows }) > strassen_mul_impl<T>::default_cutoff)
+            {
+                strassen_mul_impl<T> impl;
+                return impl.process(*this, rhs);
+            }
+
+            blocked_mul_impl<T> impl;
+            return impl.process(*this, rhs);
+        }
     }
     MATRIX_INLINE bool operator == (const matrix& other) const noexcept
     {
         if (rows != other.rows) return false;
         if (cols != other.cols) return false;
-        return memcmp(mat, other.mat, sizeof(T) * cols * rows) == 0;
+        return detail::equal(mat, other.mat, cols * rows);
     }
     MATRIX_INLINE bool operator != (const matrix& other) const noexcept
     {
@@ -293,19 +505,18 @@ protected:
     {
         if (mat)
         {
-            using alloc_traits = std::allocator_traits<decltype(allocator)>;
-            alloc_traits::destroy(allocator, mat);
-            alloc_traits::deallocate(allocator, mat, 1);
+            allocator.deallocate(mat, cols * rows);
+            mat = nullptr;
         }
     }
 
     MATRIX_INLINE void construct(const matrix& rhs)
     {
-        if (mat != nullptr && (cols * rows) == (rhs.cols * rhs.rows))
+        if (this == &rhs)
         {
-            std::memset(mat, 0, rows * cols);
+            return;
         }
-        else
+        if (mat == nullptr || (cols * rows) != (rhs.cols * rhs.rows))
         {
             destroy();
             mat = allocator.allocate(rhs.cols * rhs.rows);
@@ -314,10 +525,7 @@ protected:
         cols = rhs.cols;
         rows = rhs.rows;
 
-        for (std::size_t i = 0; i < cols * rows; i++)
-        {
-            mat[i] = rhs.mat[i];
-        }
+        detail::copy(mat, rhs.mat, cols * rows);
     }
 
 private:
@@ -331,17 +539,19 @@ template <typename T, typename Allocator>
 matrix<T> naive_mul_impl<T, Allocator>::process(const matrix<T>& lhs, const matrix<T>& rhs)
 {
     matrix<T> transposed = transpose(lhs);
-    matrix<T> result(lhs.height(), lhs.width());
+    matrix<T> result(lhs.width(), rhs.height());
 
+    HAIFISCH_PROFILE_TEAM(team);
     #pragma omp parallel
     {
+        HAIFISCH_PROFILE_MEMBER(team);
         #pragma omp for nowait collapse(2)
-        for (std::size_t i = 0; i < lhs.height(); i++)
+        for (std::size_t i = 0; i < lhs.width(); i++)
         {
             for (std::size_t j = 0; j < rhs.height(); j++)
             {
                 T accumulator = {};
-                for (std::size_t k = 0; k < rhs.width(); k++)
+                for (std::size_t k = 0; k < lhs.height(); k++)
                 {
                     accumulator += (transposed(k, i) * rhs(k, j));
                 }
@@ -354,71 +564,425 @@ matrix<T> naive_mul_impl<T, Allocator>::process(const matrix<T>& lhs, const matr
 }
 
 template <typename T, typename Allocator>
-matrix<T> strassen_mul_impl<T, Allocator>::process(T* allocated_block, const matrix<T>& lhs, const matrix<T>& rhs)
+matrix<T> blocked_mul_impl<T, Allocator>::process(const matrix<T>& lhs, const matrix<T>& rhs)
 {
-    (void) allocated_block;
+    assert(lhs.height() == rhs.width());
 
-    if (lhs.height() == 1)
+    matrix<T> result(lhs.width(), rhs.height());
+    multiply(lhs.view(), rhs.view(), result.view());
+
+    return result;
+}
+
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::max_threads() noexcept
+{
+#ifdef _OPENMP
+    return static_cast<std::size_t>(omp_get_max_threads());
+#else
+    return 1;
+#endif // _OPENMP
+}
+
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::thread_index() noexcept
+{
+#ifdef _OPENMP
+    return static_cast<std::size_t>(omp_get_thread_num());
+#else
+    return 0;
+#endif // _OPENMP
+}
+
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::default_task_depth() noexcept
+{
+    const std::size_t threads = max_threads();
+
+    std::size_t depth = 0;
+    for (std::size_t leaves = 1; leaves < threads; leaves *= 7)
     {
-        matrix<T> result(1, 1);
-        result(0, 0) = lhs(0, 0) * rhs(0, 0);
-        return result;
+        depth++;
     }
+    return depth;
+}
 
-    matrix<T> C(rhs.height(), rhs.height());
-    size_t k = lhs.height() / 2;
+/// The recursion followed by one pool slot per thread for the products of
+/// the deepest task level, if they share them.
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::workspace_size(std::size_t m, std::size_t k, std::size_t n) const noexcept
+{
+    return level_size(m, k, n, 0) + threads * pool_slot_size(m, k, n);
+}
 
-    matrix<T> a11(k, k);
-    matrix<T> a12(k, k);
-    matrix<T> a21(k, k);
-    matrix<T> a22(k, k);
+/// A sequential level needs one S, T and P temporary followed by the
+/// workspace of its child. A task level needs three P temporaries, and all
+/// but the deepest one a slot per product (see multiply_tasks). Leaves and
+/// the peeling GEMMs, which run once the level's temporaries are dead, pack
+/// their panels into the same space.
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::level_size(std::size_t m, std::size_t k, std::size_t n, std::size_t depth) const noexcept
+{
+    const std::size_t packing = detail::gemm_workspace<T>(m, n, k);
+    if (std::min({ m, k, n }) <= cutoff)
+    {
+        return packing;
+    }
 
-    matrix<T> b11(k, k);
-    matrix<T> b12(k, k);
-    matrix<T> b21(k, k);
-    matrix<T> b22(k, k);
+    const std::size_t hm = m / 2;
+    const std::size_t hk = k / 2;
+    const std::size_t hn = n / 2;
+    if (pooled(depth))
+    {
+        return std::max(packing, 3 * hm * hn);
+    }
+    if (depth < task_depth)
+    {
+        return std::max(packing, 3 * hm * hn
+                                 + 3 * product_size(hm, hk, hn, depth, true, true)
+                                 + 2 * product_size(hm, hk, hn, depth, true, false)
+                                 + 2 * product_size(hm, hk, hn, depth, false, true));
+    }
+    return std::max(packing, hm * hk + hk * hn + hm * hn + level_size(hm, hk, hn, depth + 1));
+}
 
-    for (size_t i = 0; i < k; ++i)
+/// The slot of one product of a task level with (hm x hk) * (hk x hn)
+/// operands: S when the A operand is a sum, T when the B operand is, and
+/// the workspace of the recursion.
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::product_size(std::size_t m, std::size_t k, std::size_t n, std::size_t depth,
+                                                          bool sum_a, bool sum_b) const noexcept
+{
+    return (sum_a ? m * k : 0) + (sum_b ? k * n : 0) + level_size(m, k, n, depth + 1);
+}
+
+/// A thread runs one product of the deepest task level at a time: they
+/// have no task scheduling point of their own, and a tied task only lets
+/// its thread pick up its descendants. So when those products outnumber
+/// the threads, they share one slot per thread, sized for both sums,
+/// instead of owning one each.
+template <typename T, typename Allocator>
+bool strassen_mul_impl<T, Allocator>::pooled(std::size_t depth) const noexcept
+{
+    if (depth + 1 != task_depth)
     {
-        for (size_t j = 0; j < k; ++j)
+        return false;
+    }
+    std::size_t products = 1;
+    for (std::size_t level = 0; level < task_depth && products <= threads; ++level)
+    {
+        products *= 7;
+    }
+    return products > threads;
+}
+
+/// Zero when the deepest task level does not pool or the recursion never
+/// gets there.
+template <typename T, typename Allocator>
+std::size_t strassen_mul_impl<T, Allocator>::pool_slot_size(std::size_t m, std::size_t k, std::size_t n) const noexcept
+{
+    if (task_depth == 0 || !pooled(task_depth - 1))
+    {
+        return 0;
+    }
+    for (std::size_t depth = 0; depth < task_depth; ++depth)
+    {
+        if (std::min({ m, k, n }) <= cutoff)
         {
-            a11(i, j) = lhs(i, j);
-            a12(i, j) = lhs(i, k + j);
-            a21(i, j) = lhs(k + i, j);
-            a22(i, j) = lhs(k + i, k + j);
-
-            b11(i, j) = rhs(i, j);
-            b12(i, j) = rhs(i, k + j);
-            b21(i, j) = rhs(k + i, j);
-            b22(i, j) = rhs(k + i, k + j);
+            return 0;
         }
+        m /= 2;
+        k /= 2;
+        n /= 2;
     }
+    return product_size(m, k, n, task_depth - 1, true, true);
+}
+
+template <typename T, typename Allocator>
+matrix<T> strassen_mul_impl<T, Allocator>::process(const matrix<T>& lhs, const matrix<T>& rhs)
+{
+    detail::aligned_buffer<T> arena(workspace_size(lhs.width(), lhs.height(), rhs.height()));
+    return process(arena.get(), lhs, rhs);
+}
 
-    matrix<T> p1 = process(a11, b12 - b22);
-    matrix<T> p2 = process(a11 + a12, b22);
-    matrix<T> p3 = process(a21 + a22, b11);
-    matrix<T> p4 = process(a22, b21 - b11);
-    matrix<T> p5 = process(a11 + a22, b11 + b22);
-    matrix<T> p6 = process(a12 - a22, b21 + b22);
-    matrix<T> p7 = process(a11 - a21, b11 + b12);
+template <typename T, typename Allocator>
+matrix<T> strassen_mul_impl<T, Allocator>::process(T* allocated_block, const matrix<T>& lhs, const matrix<T>& rhs)
+{
+    matrix<T> C(lhs.width(), rhs.height());
+    process(allocated_block, lhs.view(), rhs.view(), C.view());
+    return C;
+}
 
-    matrix<T> c11 = ((p5 + p4) + p6) - p2;
-    matrix<T> c12 = p1 + p2;
-    matrix<T> c21 = p3 + p4;
-    matrix<T> c22 = ((p5 + p1) - p3) - p7;
+/// allocated_block must hold at least workspace_size(m, k, n) elements.
+/// Every temporary of the recursion, the packed panels of the GEMM calls
+/// included, is carved out of it, and quadrants are addressed in place
+/// through views instead of copied.
+template <typename T, typename Allocator>
+void strassen_mul_impl<T, Allocator>::process(T* allocated_block, const_view lhs, const_view rhs, view result)
+{
+    assert(lhs.height() == rhs.width());
+    assert(result.width() == lhs.width());
+    assert(result.height() == rhs.height());
 
-    for (size_t i = 0; i < k; ++i)
+    if (task_depth > 0 && std::min({ lhs.width(), lhs.height(), rhs.height() }) > cutoff)
     {
-        for (size_t j = 0; j < k; ++j)
+        T* pool = allocated_block + level_size(lhs.width(), lhs.height(), rhs.height(), 0);
+        HAIFISCH_PROFILE_TEAM(team);
+        #pragma omp parallel num_threads(threads)
         {
-            C(i, j) = c11(i, j);
-            C(i, j + k) = c12(i, j);
-            C(k + i, j) = c21(i, j);
-            C(k + i, k + j) = c22(i, j);
+            HAIFISCH_PROFILE_MEMBER(team);
+            #pragma omp single
+            multiply(allocated_block, pool, 0, lhs, rhs, result);
         }
     }
+    else
+    {
+        multiply(allocated_block, nullptr, 0, lhs, rhs, result);
+    }
+}
 
-    return C;
+/// c = a * b for a (m x k), b (k x n) and c (m x n), m being the width.
+///
+/// Odd dimensions are handled by dynamic peeling: the recursion runs on the
+/// largest even-sized leading blocks and the stray last row of A, column of
+/// B and row/column of C are fixed up with GEMM calls afterwards.
+template <typename T, typename Allocator>
+void strassen_mul_impl<T, Allocator>::multiply(T* arena, T* pool, std::size_t depth, const_view a, const_view b, view c)
+{
+    const std::size_t m = a.width();
+    const std::size_t k = a.height();
+    const std::size_t n = b.height();
+
+    if (std::min({ m, k, n }) <= cutoff)
+    {
+        haifisch::multiply(a, b, c, T {}, arena);
+        return;
+    }
+
+    if (depth < task_depth)
+    {
+        multiply_tasks(arena, pool, depth, a, b, c);
+    }
+    else
+    {
+        multiply_sequential(arena, depth, a, b, c);
+    }
+
+    const std::size_t m2 = m / 2 * 2;
+    const std::size_t k2 = k / 2 * 2;
+    const std::size_t n2 = n / 2 * 2;
+
+    /// Peeled k: C[0:m2, 0:n2] += A[0:m2, k-1] * B[k-1, 0:n2]
+    if (k2 != k)
+    {
+        haifisch::multiply(a.block(0, k2, m2, 1), b.block(k2, 0, 1, n2), c.block(0, 0, m2, n2), T { 1 }, arena);
+    }
+    /// Peeled n: C[0:m, n-1] = A * B[:, n-1]
+    if (n2 != n)
+    {
+        haifisch::multiply(a, b.row(n2), c.row(n2), T {}, arena);
+    }
+    /// Peeled m: C[m-1, 0:n2] = A[m-1, :] * B[:, 0:n2]
+    if (m2 != m)
+    {
+        haifisch::multiply(a.column(m2), b.block(0, 0, k, n2), c.block(m2, 0, 1, n2), T {}, arena);
+    }
+}
+
+/// Even part of one level, keeping only three temporaries: S (sums of A
+/// quadrants), T (sums of B quadrants) and P (the current product), whose
+/// result is folded straight into the quadrants of C.
+template <typename T, typename Allocator>
+void strassen_mul_impl<T, Allocator>::multiply_sequential(T* arena, std::size_t depth, const_view a, const_view b, view c)
+{
+    using op = simd::elementwise_op;
+    const std::size_t hm = a.width() / 2;
+    const std::size_t hk = a.height() / 2;
+    const std::size_t hn = b.height() / 2;
+
+    const const_view a11 = a.block(0,  0,  hm, hk);
+    const const_view a21 = a.block(hm, 0,  hm, hk);
+    const const_view a12 = a.block(0,  hk, hm, hk);
+    const const_view a22 = a.block(hm, hk, hm, hk);
+
+    const const_view b11 = b.block(0,  0,  hk, hn);
+    const const_view b21 = b.block(hk, 0,  hk, hn);
+    const const_view b12 = b.block(0,  hn, hk, hn);
+    const const_view b22 = b.block(hk, hn, hk, hn);
+
+    const view c11 = c.block(0,  0,  hm, hn);
+    const view c21 = c.block(hm, 0,  hm, hn);
+    const view c12 = c.block(0,  hn, hm, hn);
+    const view c22 = c.block(hm, hn, hm, hn);
+
+    const view s(arena, hm, hk);
+    const view t(s.data() + hm * hk, hk, hn);
+    const view p(t.data() + hk * hn, hm, hn);
+    T* next = p.data() + hm * hn;
+
+    /// p1 = (a11 + a22)(b11 + b22): c11 = p1, c22 = p1
+    detail::combine(s, a11, a22, op::add);
+    detail::combine(t, b11, b22, op::add);
+    multiply(next, nullptr, depth + 1, s, t, p);
+    c11.assign(p);
+    c22.assign(p);
+
+    /// p2 = (a21 + a22) b11: c21 = p2, c22 -= p2
+    detail::combine(s, a21, a22, op::add);
+    multiply(next, nullptr, depth + 1, s, b11, p);
+    c21.assign(p);
+    c22 -= p;
+
+    /// p3 = a11 (b12 - b22): c12 = p3, c22 += p3
+    detail::combine(t, b12, b22, op::sub);
+    multiply(next, nullptr, depth + 1, a11, t, p);
+    c12.assign(p);
+    c22 += p;
+
+    /// p4 = a22 (b21 - b11): c11 += p4, c21 += p4
+    detail::combine(t, b21, b11, op::sub);
+    multiply(next, nullptr, depth + 1, a22, t, p);
+    c11 += p;
+    c21 += p;
+
+    /// p5 = (a11 + a12) b22: c11 -= p5, c12 += p5
+    detail::combine(s, a11, a12, op::add);
+    multiply(next, nullptr, depth + 1, s, b22, p);
+    c11 -= p;
+    c12 += p;
+
+    /// p6 = (a21 - a11)(b11 + b12): c22 += p6
+    detail::combine(s, a21, a11, op::sub);
+    detail::combine(t, b11, b12, op::add);
+    multiply(next, nullptr, depth + 1, s, t, p);
+    c22 += p;
+
+    /// p7 = (a12 - a22)(b21 + b22): c11 += p7
+    detail::combine(s, a12, a22, op::sub);
+    detail::combine(t, b21, b22, op::add);
+    multiply(next, nullptr, depth + 1, s, t, p);
+    c11 += p;
+}
+
+/// Even part of one level with the seven products spawned as OpenMP tasks.
+/// Four products are written straight into the C quadrant that consumes
+/// them first (p7 to c11, p3 to c12, p2 to c21, p6 to c22); only p1, p4 and
+/// p5 need a temporary. Every product works in a slot holding the S and T
+/// sums it actually uses and the workspace of its recursion: one of its own
+/// on the upper levels, the pool slot of the thread running it on the
+/// deepest (see pool_slot_size). C is assembled once all of them have
+/// finished. Must run inside the parallel region of process().
+template <typename T, typename Allocator>
+void strassen_mul_impl<T, Allocator>::multiply_tasks(T* arena, T* pool, std::size_t depth, const_view a, const_view b, view c)
+{
+    using op = simd::elementwise_op;
+    const std::size_t hm = a.width() / 2;
+    const std::size_t hk = a.height() / 2;
+    const std::size_t hn = b.height() / 2;
+
+    const const_view a11 = a.block(0,  0,  hm, hk);
+    const const_view a21 = a.block(hm, 0,  hm, hk);
+    const const_view a12 = a.block(0,  hk, hm, hk);
+    const const_view a22 = a.block(hm, hk, hm, hk);
+
+    const const_view b11 = b.block(0,  0,  hk, hn);
+    const const_view b21 = b.block(hk, 0,  hk, hn);
+    const const_view b12 = b.block(0,  hn, hk, hn);
+    const const_view b22 = b.block(hk, hn, hk, hn);
+    const const_view none;
+
+    const view c11 = c.block(0,  0,  hm, hn);
+    const view c21 = c.block(hm, 0,  hm, hn);
+    const view c12 = c.block(0,  hn, hm, hn);
+    const view c22 = c.block(hm, hn, hm, hn);
+
+    const view p1(arena, hm, hn);
+    const view p4(p1.data() + hm * hn, hm, hn);
+    const view p5(p4.data() + hm * hn, hm, hn);
+
+    /// A pooled level leaves slots[] empty, and each task takes the pool slot
+    /// of its thread once it runs.
+    const bool shared = pooled(depth);
+    const std::size_t pool_slot = shared ? product_size(hm, hk, hn, depth, true, true) : 0;
+    T* slots[7] = {};
+    if (!shared)
+    {
+        T* next = p5.data() + hm * hn;
+        const bool sums[7][2] = { { true, true }, { true, false }, { false, true }, { false, true },
+                                  { true, false }, { true, true }, { true, true } };
+        for (std::size_t i = 0; i < 7; ++i)
+        {
+            slots[i] = next;
+            next += product_size(hm, hk, hn, depth, sums[i][0], sums[i][1]);
+        }
+    }
+    const auto slot = [=](std::size_t i) { return shared ? pool + thread_index() * pool_slot : slots[i]; };
+
+    #pragma omp task
+    product(slot(0), pool, depth, a11, a22, op::add, b11, b22, op::add, p1);
+    #pragma omp task
+    product(slot(1), pool, depth, a21, a22, op::add, b11, none, op::add, c21);
+    #pragma omp task
+    product(slot(2), pool, depth, a11, none, op::add, b12, b22, op::sub, c12);
+    #pragma omp task
+    product(slot(3), pool, depth, a22, none, op::add, b21, b11, op::sub, p4);
+    #pragma omp task
+    product(slot(4), pool, depth, a11, a12, op::add, b22, none, op::add, p5);
+    #pragma omp task
+    product(slot(5), pool, depth, a21, a11, op::sub, b11, b12, op::add, c22);
+    #pragma omp task
+    product(slot(6), pool, depth, a12, a22, op::sub, b21, b22, op::add, c11);
+    #pragma omp taskwait
+
+    /// c22 = p6 + p1 - p2 + p3, while c21 and c12 still hold p2 and p3
+    c22 += p1;
+    c22 -= c21;
+    c22 += c12;
+
+    /// c11 = p7 + p1 + p4 - p5
+    c11 += p1;
+    c11 += p4;
+    c11 -= p5;
+
+    /// c12 = p3 + p5
+    c12 += p5;
+
+    /// c21 = p2 + p4
+    c21 += p4;
+}
+
+/// One product of a task level: p = (ax aop ay) * (bx bop by), where an
+/// empty ay or by means the quadrant is used as is. The slot holds S if ay
+/// is given, then T if by is, followed by the workspace of the recursion.
+template <typename T, typename Allocator>
+void strassen_mul_impl<T, Allocator>::product(T* slot, T* pool, std::size_t depth,
+                                              const_view ax, const_view ay, simd::elementwise_op aop,
+                                              const_view bx, const_view by, simd::elementwise_op bop, view p)
+{
+    const std::size_t hm = ax.width();
+    const std::size_t hk = ax.height();
+    const std::size_t hn = bx.height();
+    T* next = slot;
+
+    const_view lhs = ax;
+    if (ay.data() != nullptr)
+    {
+        const view s(next, hm, hk);
+        detail::combine(s, ax, ay, aop);
+        lhs = s;
+        next += hm * hk;
+    }
+
+    const_view rhs = bx;
+    if (by.data() != nullptr)
+    {
+        const view t(next, hk, hn);
+        detail::combine(t, bx, by, bop);
+        rhs = t;
+        next += hk * hn;
+    }
+
+    multiply(next, pool, depth + 1, lhs, rhs, p);
 }
 
 template <typename T>
@@ -447,41 +1011,306 @@ std::ostream& operator << (std::ostream& ostream, const matrix<T>& mat)
     return ostream;
 }
 
-template <typename T>
-MATRIX_INLINE vector<T> operator *= (matrix<T>& mat, const vector<T>& vec) noexcept
+/// c = alpha * op(a) * op(b) + beta * c into an existing c of the right
+/// shape; nothing is allocated and transposed operands are not copied.
+template <typename T, typename Allocator>
+void gemm(T alpha, gemm_op op_a, const matrix<T, Allocator>& a, gemm_op op_b, const matrix<T, Allocator>& b,
+          T beta, matrix<T, Allocator>& c)
 {
-    assert(mat.height() == vec.size());
+    HAIFISCH_PROFILE_SCOPE("gemm", c.width() * c.height() * (op_a == gemm_op::none ? a.height() : a.width()));
+    gemm(alpha, op_a, matrix_view<const T>(a.view()), op_b, matrix_view<const T>(b.view()), beta, c.view());
+}
+
+/// c = alpha * a * b + beta * c
+template <typename T, typename Allocator>
+void gemm(T alpha, const matrix<T, Allocator>& a, const matrix<T, Allocator>& b, T beta, matrix<T, Allocator>& c)
+{
+    gemm(alpha, gemm_op::none, a, gemm_op::none, b, beta, c);
+}
+
+/// c = alpha * op(a) * op(b) + beta * c for bfloat16 or float16 operands,
+/// accumulated in float; c holds float or rounded half-precision results.
+template <typename H, typename C, typename AllocatorH, typename AllocatorC, typename = std::enable_if_t<is_half_v<H>>>
+void gemm(float alpha, gemm_op op_a, const matrix<H, AllocatorH>& a, gemm_op op_b, const matrix<H, AllocatorH>& b,
+          float beta, matrix<C, AllocatorC>& c)
+{
+    gemm(alpha, op_a, matrix_view<const H>(a.view()), op_b, matrix_view<const H>(b.view()), beta, c.view());
+}
+
+/// c = alpha * a * b + beta * c for half-precision a and b
+template <typename H, typename C, typename AllocatorH, typename AllocatorC, typename = std::enable_if_t<is_half_v<H>>>
+void gemm(float alpha, const matrix<H, AllocatorH>& a, const matrix<H, AllocatorH>& b, float beta, matrix<C, AllocatorC>& c)
+{
+    gemm(alpha, gemm_op::none, a, gemm_op::none, b, beta, c);
+}
+
+/// op(a) x = alpha b (left) or x op(a) = alpha b (right) in place of b.
+template <typename T, typename Allocator>
+void trsm(trsm_side side, triangle uplo, gemm_op op, diagonal diag, T alpha, const matrix<T, Allocator>& a,
+          matrix<T, Allocator>& b)
+{
+    trsm(side, uplo, op, diag, alpha, matrix_view<const T>(a.view()), b.view());
+}
+
+/// LU factorisation with partial pivoting in place of a; see the view
+/// overload.
+template <typename T, typename Allocator>
+std::size_t lu_factor(matrix<T, Allocator>& a, std::vector<std::size_t>& pivots)
+{
+    return lu_factor(a.view(), pivots);
+}
+
+/// Solves a x = b in place of b from the output of lu_factor().
+template <typename T, typename Allocator>
+void lu_solve(const matrix<T, Allocator>& lu, const std::vector<std::size_t>& pivots, matrix<T, Allocator>& b)
+{
+    lu_solve(matrix_view<const T>(lu.view()), pivots, b.view());
+}
+
+/// Solves a x = b in place of the vector b from the output of lu_factor().
+template <typename T, typename Allocator>
+void lu_solve(const matrix<T, Allocator>& lu, const std::vector<std::size_t>& pivots, vector<T, Allocator>& b)
+{
+    lu_solve(matrix_view<const T>(lu.view()), pivots, matrix_view<T>(b.data(), b.size(), 1));
+}
+
+/// Cholesky factorisation in place of the lower triangle of a.
+template <typename T, typename Allocator>
+std::size_t cholesky_factor(matrix<T, Allocator>& a)
+{
+    return cholesky_factor(a.view());
+}
+
+/// Solves a x = b in place of b from the factor of cholesky_factor().
+template <typename T, typename Allocator>
+void cholesky_solve(const matrix<T, Allocator>& l, matrix<T, Allocator>& b)
+{
+    cholesky_solve(matrix_view<const T>(l.view()), b.view());
+}
+
+/// Solves a x = b in place of the vector b from the factor of
+/// cholesky_factor().
+template <typename T, typename Allocator>
+void cholesky_solve(const matrix<T, Allocator>& l, vector<T, Allocator>& b)
+{
+    cholesky_solve(matrix_view<const T>(l.view()), matrix_view<T>(b.data(), b.size(), 1));
+}
+
+template <typename T, typename Allocator>
+T sum(const matrix<T, Allocator>& x) noexcept
+{
+    return sum(matrix_view<const T>(x.view()));
+}
+
+template <typename T, typename Allocator>
+T minimum(const matrix<T, Allocator>& x) noexcept
+{
+    return minimum(matrix_view<const T>(x.view()));
+}
 
-    vector<T> result(vec.size());
-    for (std::size_t i = 0; i < mat.width(); i++)
+template <typename T, typename Allocator>
+T maximum(const matrix<T, Allocator>& x) noexcept
+{
+    return maximum(matrix_view<const T>(x.view()));
+}
+
+template <typename T, typename Allocator>
+T norm_frobenius(const matrix<T, Allocator>& x) noexcept
+{
+    return norm_frobenius(matrix_view<const T>(x.view()));
+}
+
+template <typename T, typename Allocator>
+T norm_inf(const matrix<T, Allocator>& x)
+{
+    return norm_inf(matrix_view<const T>(x.view()));
+}
+
+/// New matrix of f applied to every element of x; its element type is
+/// what f returns.
+template <typename T, typename Allocator, typename F>
+auto map(const matrix<T, Allocator>& x, const F& f)
+{
+    matrix<std::decay_t<std::invoke_result_t<const F&, T>>> result(x.width(), x.height());
+    detail::map(result.data(), static_cast<const T*>(x.data()), x.width() * x.height(), f);
+    return result;
+}
+
+/// New matrix of f applied to every pair of elements of a and b.
+template <typename T, typename Allocator, typename F>
+auto zip(const matrix<T, Allocator>& a, const matrix<T, Allocator>& b, const F& f)
+{
+    assert(a.width() == b.width());
+    assert(a.height() == b.height());
+
+    matrix<std::decay_t<std::invoke_result_t<const F&, T, T>>> result(a.width(), a.height());
+    detail::zip(result.data(), static_cast<const T*>(a.data()), static_cast<const T*>(b.data()), a.width() * a.height(), f);
+    return result;
+}
+
+/// y = alpha * A x + beta * y, with y[i] the sum over j of A(i, j) * x[j].
+/// y is not read when beta is zero.
+template <typename A, typename T, typename Allocator>
+void gemv(T alpha, matrix_view<A> a, const vector<T, Allocator>& x, T beta, vector<T, Allocator>& y) noexcept
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T>, "operands must share the element type");
+    assert(a.height() == x.size());
+    assert(a.width() == y.size());
+
+    detail::gemv(a.width(), a.height(), alpha, a.data(), a.stride(), x.data(), beta, y.data());
+}
+
+/// y = alpha * A^T x + beta * y, with y[j] the sum over i of A(i, j) * x[i].
+/// y is not read when beta is zero.
+template <typename A, typename T, typename Allocator>
+void gemv_t(T alpha, matrix_view<A> a, const vector<T, Allocator>& x, T beta, vector<T, Allocator>& y) noexcept
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T>, "operands must share the element type");
+    assert(a.width() == x.size());
+    assert(a.height() == y.size());
+
+    detail::gemv_t(a.width(), a.height(), alpha, a.data(), a.stride(), x.data(), beta, y.data());
+}
+
+/// y = alpha * A x + beta * y for sparse A. csr rows are shared among the
+/// threads by their entry counts; csc scatters into per-thread copies of y.
+template <typename T, typename Allocator>
+void gemv(T alpha, const sparse_matrix<T>& a, const vector<T, Allocator>& x, T beta, vector<T, Allocator>& y)
+{
+    assert(a.height() == x.size());
+    assert(a.width() == y.size());
+
+    if (a.format() == sparse_format::csr)
     {
-        T accumulator = {};
-        for (std::size_t j = 0; j < mat.height(); j++)
-        {
-            accumulator += mat.at(i, j) * vec[i];
-        }
-        result.at(i) = accumulator;
+        detail::sparse_gather(a.outer_size(), a.offsets(), a.indices(), a.values(), alpha, x.data(), beta, y.data());
+    }
+    else
+    {
+        detail::sparse_scatter(a.outer_size(), a.inner_size(), a.offsets(), a.indices(), a.values(), alpha, x.data(), beta, y.data());
     }
-    return result;
 }
 
-template <typename T>
-MATRIX_INLINE matrix<T> transpose(const matrix<T>& rhs) noexcept
+/// y = alpha * A^T x + beta * y for sparse A; csc gathers, csr scatters.
+template <typename T, typename Allocator>
+void gemv_t(T alpha, const sparse_matrix<T>& a, const vector<T, Allocator>& x, T beta, vector<T, Allocator>& y)
 {
-    std::size_t height = rhs.height();
-    std::size_t width = rhs.width();
-    matrix<T> transposed(height, width);
+    assert(a.width() == x.size());
+    assert(a.height() == y.size());
 
-    for (std::size_t i = 0; i < height; ++i)
+    if (a.format() == sparse_format::csc)
     {
-        for (std::size_t j = 0; j < height; ++j)
-        {
-            transposed(i, j) = rhs(j, i);
-        }
+        detail::sparse_gather(a.outer_size(), a.offsets(), a.indices(), a.values(), alpha, x.data(), beta, y.data());
     }
+    else
+    {
+        detail::sparse_scatter(a.outer_size(), a.inner_size(), a.offsets(), a.indices(), a.values(), alpha, x.data(), beta, y.data());
+    }
+}
+
+/// y += alpha * x
+template <typename T, typename Allocator>
+void axpy(T alpha, const vector<T, Allocator>& x, vector<T, Allocator>& y) noexcept
+{
+    assert(x.size() == y.size());
+
+    detail::axpy(x.size(), alpha, x.data(), y.data());
+}
+
+template <typename T, typename Allocator>
+T dot(const vector<T, Allocator>& x, const vector<T, Allocator>& y) noexcept
+{
+    assert(x.size() == y.size());
+
+    return detail::dot(x.size(), x.data(), y.data());
+}
+
+/// Euclidean norm, as the square root of dot(x, x): exact scaling against
+/// overflow is left out in favour of a single fused pass.
+template <typename T, typename Allocator>
+T nrm2(const vector<T, Allocator>& x) noexcept
+{
+    static_assert(std::is_floating_point_v<T>, "nrm2 needs a floating point element type");
+
+    return std::sqrt(dot(x, x));
+}
+
+/// x *= alpha
+template <typename T, typename Allocator>
+void scal(T alpha, vector<T, Allocator>& x) noexcept
+{
+    detail::elementwise<T>(simd::elementwise_op::scale, x.data(), nullptr, alpha, x.size());
+}
+
+template <typename T, typename Allocator>
+MATRIX_INLINE inline vector<T, Allocator> operator * (const matrix<T, Allocator>& mat, const vector<T, Allocator>& vec) noexcept
+{
+    assert(mat.height() == vec.size());
+
+    vector<T, Allocator> result(mat.width());
+    gemv(T { 1 }, mat.view(), vec, T {}, result);
+    return result;
+}
+
+template <typename T, typename Allocator>
+vector<T, Allocator> operator * (const sparse_matrix<T>& mat, const vector<T, Allocator>& vec)
+{
+    vector<T, Allocator> result(mat.width());
+    gemv(T { 1 }, mat, vec, T {}, result);
+    return result;
+}
+
+template <typename T, typename Allocator>
+matrix<T, Allocator> operator * (const sparse_matrix<T>& lhs, const matrix<T, Allocator>& rhs)
+{
+    assert(lhs.height() == rhs.width());
+
+    matrix<T, Allocator> result(lhs.width(), rhs.height());
+    multiply(lhs, matrix_view<const T>(rhs.view()), result.view());
+    return result;
+}
+
+/// An expression operand of a matrix product is evaluated into a temporary
+/// first; the product itself needs random access to both operands.
+template <typename E, typename T, typename Allocator>
+MATRIX_INLINE inline matrix<T, Allocator> operator * (const matrix_expression<E>& lhs, const matrix<T, Allocator>& rhs) noexcept
+{
+    return matrix<T, Allocator>(lhs) * rhs;
+}
+
+template <typename T, typename Allocator, typename E>
+MATRIX_INLINE inline matrix<T, Allocator> operator * (const matrix<T, Allocator>& lhs, const matrix_expression<E>& rhs) noexcept
+{
+    return lhs * matrix<T, Allocator>(rhs);
+}
+
+template <typename L, typename R>
+MATRIX_INLINE inline matrix<typename L::value_type> operator * (const matrix_expression<L>& lhs, const matrix_expression<R>& rhs) noexcept
+{
+    using value_type = typename L::value_type;
+    return matrix<value_type>(lhs) * matrix<value_type>(rhs);
+}
+
+template <typename T>
+MATRIX_INLINE inline vector<T> operator *= (matrix<T>& mat, const vector<T>& vec) noexcept
+{
+    return mat * vec;
+}
+
+template <typename T>
+MATRIX_INLINE inline matrix<T> transpose(const matrix<T>& rhs) noexcept
+{
+    HAIFISCH_PROFILE_SCOPE("transpose", rhs.width() * rhs.height());
+    matrix<T> transposed(rhs.height(), rhs.width());
+    transpose(rhs.view(), transposed.view());
 
     return transposed;
 }
+
+template <typename E>
+MATRIX_INLINE inline matrix<typename E::value_type> transpose(const matrix_expression<E>& expr) noexcept
+{
+    return transpose(matrix<typename E::value_type>(expr));
+}
 } // namespace haifisch
 
 #undef MATRIX_INLINE
@@ -0,0 +1,416 @@
+#pragma once
+
+#ifndef HAIFISCH_POOL_HPP
+#define HAIFISCH_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "allocator.hpp"
+
+
+namespace haifisch
+{
+/// Counters of the matrix memory pool, summed over all threads.
+struct pool_statistics
+{
+    /// Allocations served from a thread cache.
+    std::uint64_t hits = 0;
+    /// Allocations that had to go to the upstream allocator.
+    std::uint64_t misses = 0;
+    /// Blocks freed by a thread other than the one that owns them.
+    std::uint64_t remote_frees = 0;
+    /// Blocks handed back to the upstream allocator.
+    std::uint64_t releases = 0;
+
+    double hit_rate() const noexcept
+    {
+        const std::uint64_t total = hits + misses;
+        return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+    }
+};
+
+namespace detail
+{
+/// Power-of-two size classes from 64 bytes to 1 MiB; larger blocks are
+/// left to the upstream allocator, which backs them with huge pages.
+constexpr std::size_t pool_min_class_bits = 6;
+constexpr std::size_t pool_classes = 15;
+
+/// Every pooled block is preceded by a header naming its owning cache. It
+/// is one cache line long, so payloads keep a 64-byte alignment.
+constexpr std::size_t pool_header_size = 64;
+
+/// Free blocks a cache keeps per size class before returning the surplus.
+constexpr std::size_t pool_max_cached = 64;
+
+constexpr std::size_t pool_class_bytes(std::size_t size_class) noexcept
+{
+    return std::size_t { 1 } << (size_class + pool_min_class_bits);
+}
+
+/// Smallest class holding bytes, or pool_classes when none does.
+constexpr std::size_t pool_size_class(std::size_t bytes) noexcept
+{
+    std::size_t size_class = 0;
+    while (size_class < pool_classes && pool_class_bytes(size_class) < bytes)
+    {
+        size_class++;
+    }
+    return size_class;
+}
+
+class thread_cache;
+
+struct pool_header
+{
+    thread_cache* owner;
+};
+
+struct pool_block
+{
+    pool_block* next;
+};
+
+/// Free lists of one thread.
+///
+/// Only the owning thread touches the local lists. Other threads free into
+/// a per-class Treiber stack, which the owner takes over in one exchange
+/// when its local list runs dry; with a single consumer taking whole
+/// lists, the stack has no ABA problem. Caches are never destroyed: when
+/// a thread exits, its cache returns its free blocks and waits in the
+/// registry for the next thread to adopt it, so headers of blocks still in
+/// flight always point to a live cache.
+class thread_cache
+{
+public:
+    /// Cache of the calling thread, or nullptr once its thread-local
+    /// state is gone (during thread exit), in which case callers bypass
+    /// the pool.
+    static thread_cache* local() noexcept;
+
+    static pool_statistics statistics() noexcept
+    {
+        pool_statistics result;
+        for (thread_cache* cache = registry().load(std::memory_order_acquire); cache != nullptr; cache = cache->next_cache)
+        {
+            result.hits += cache->hits.load(std::memory_order_relaxed);
+            result.misses += cache->misses.load(std::memory_order_relaxed);
+            result.remote_frees += cache->remote_frees.load(std::memory_order_relaxed);
+            result.releases += cache->releases.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    void* allocate(std::size_t size_class)
+    {
+        size_class_list& list = lists[size_class];
+        if (list.free == nullptr)
+        {
+            take_remote(list);
+        }
+        if (list.free != nullptr)
+        {
+            pool_block* block = list.free;
+            list.free = block->next;
+            list.count--;
+            count(hits);
+            return block;
+        }
+
+        count(misses);
+        return allocate_upstream(this, size_class);
+    }
+
+    void deallocate(void* payload, std::size_t size_class) noexcept
+    {
+        thread_cache* owner = header_of(payload)->owner;
+        if (owner == nullptr)
+        {
+            ::operator delete(header_of(payload), std::align_val_t { pool_header_size });
+        }
+        else if (owner == this)
+        {
+            push_local(payload, size_class);
+        }
+        else
+        {
+            owner->push_remote(payload, size_class);
+        }
+    }
+
+    /// Allocation used when the calling thread has no cache any more.
+    static void* allocate_upstream(thread_cache* owner, std::size_t size_class)
+    {
+        void* raw = ::operator new(pool_header_size + pool_class_bytes(size_class), std::align_val_t { pool_header_size });
+        static_cast<pool_header*>(raw)->owner = owner;
+        return static_cast<char*>(raw) + pool_header_size;
+    }
+
+    static void deallocate_unowned(void* payload, std::size_t size_class) noexcept
+    {
+        thread_cache* owner = header_of(payload)->owner;
+        if (owner == nullptr)
+        {
+            ::operator delete(header_of(payload), std::align_val_t { pool_header_size });
+        }
+        else
+        {
+            owner->push_remote(payload, size_class);
+        }
+    }
+
+    /// Returns every cached block upstream.
+    void trim() noexcept
+    {
+        for (size_class_list& list : lists)
+        {
+            take_remote(list);
+            while (list.free != nullptr)
+            {
+                pool_block* block = list.free;
+                list.free = block->next;
+                release(block);
+            }
+            list.count = 0;
+        }
+    }
+
+private:
+    struct size_class_list
+    {
+        pool_block* free = nullptr;
+        std::size_t count = 0;
+        std::atomic<pool_block*> remote { nullptr };
+    };
+
+    friend struct thread_cache_handle;
+
+    static std::atomic<thread_cache*>& registry() noexcept
+    {
+        static std::atomic<thread_cache*> head { nullptr };
+        return head;
+    }
+
+    /// Takes over a cache left by an exited thread, or registers a new one.
+    static thread_cache* adopt()
+    {
+        for (thread_cache* cache = registry().load(std::memory_order_acquire); cache != nullptr; cache = cache->next_cache)
+        {
+            bool expected = false;
+            if (cache->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            {
+                return cache;
+            }
+        }
+
+        thread_cache* cache = new thread_cache;
+        cache->in_use.store(true, std::memory_order_relaxed);
+        cache->next_cache = registry().load(std::memory_order_relaxed);
+        while (!registry().compare_exchange_weak(cache->next_cache, cache, std::memory_order_release, std::memory_order_relaxed))
+        { }
+        return cache;
+    }
+
+    void abandon() noexcept
+    {
+        trim();
+        in_use.store(false, std::memory_order_release);
+    }
+
+    static pool_header* header_of(void* payload) noexcept
+    {
+        return reinterpret_cast<pool_header*>(static_cast<char*>(payload) - pool_header_size);
+    }
+
+    static void count(std::atomic<std::uint64_t>& counter) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void release(pool_block* block) noexcept
+    {
+        ::operator delete(header_of(block), std::align_val_t { pool_header_size });
+        count(releases);
+    }
+
+    void push_local(void* payload, std::size_t size_class) noexcept
+    {
+        size_class_list& list = lists[size_class];
+        pool_block* block = static_cast<pool_block*>(payload);
+        if (list.count >= pool_max_cached)
+        {
+            release(block);
+            return;
+        }
+        block->next = list.free;
+        list.free = block;
+        list.count++;
+    }
+
+    void push_remote(void* payload, std::size_t size_class) noexcept
+    {
+        std::atomic<pool_block*>& remote = lists[size_class].remote;
+        pool_block* block = static_cast<pool_block*>(payload);
+        block->next = remote.load(std::memory_order_relaxed);
+        while (!remote.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+        { }
+        remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void take_remote(size_class_list& list) noexcept
+    {
+        pool_block* taken = list.remote.exchange(nullptr, std::memory_order_acquire);
+        while (taken != nullptr)
+        {
+            pool_block* next = taken->next;
+            push_local(taken, static_cast<std::size_t>(&list - lists));
+            taken = next;
+        }
+    }
+
+    size_class_list lists[pool_classes];
+    std::atomic<std::uint64_t> hits { 0 };
+    std::atomic<std::uint64_t> misses { 0 };
+    std::atomic<std::uint64_t> remote_frees { 0 };
+    std::atomic<std::uint64_t> releases { 0 };
+    std::atomic<bool> in_use { false };
+    thread_cache* next_cache = nullptr;
+};
+
+/// Binds a cache to the calling thread and gives it back at thread exit.
+struct thread_cache_handle
+{
+    thread_cache* cache = nullptr;
+
+    ~thread_cache_handle()
+    {
+        if (cache != nullptr)
+        {
+            cache->abandon();
+        }
+        released() = true;
+    }
+
+    static bool& released() noexcept
+    {
+        static thread_local bool value = false;
+        return value;
+    }
+};
+
+inline thread_cache* thread_cache::local() noexcept
+{
+    if (thread_cache_handle::released())
+    {
+        return nullptr;
+    }
+
+    static thread_local thread_cache_handle handle;
+    if (handle.cache == nullptr)
+    {
+        handle.cache = adopt();
+    }
+    return handle.cache;
+}
+} // namespace detail
+
+/// Pool counters summed over every thread that ever allocated through it.
+inline pool_statistics pool_stats() noexcept
+{
+    return detail::thread_cache::statistics();
+}
+
+/// Returns the free blocks cached by the calling thread to the system.
+inline void pool_trim() noexcept
+{
+    if (detail::thread_cache* cache = detail::thread_cache::local())
+    {
+        cache->trim();
+    }
+}
+
+/// Allocator recycling small blocks through thread-local, size-classed
+/// free lists; blocks above 1 MiB, or needing more than a cache line of
+/// alignment, come straight from aligned_allocator<T, Policy>.
+///
+/// A block may be freed on any thread: it goes back to the cache of the
+/// thread that allocated it through a lock-free stack.
+template <typename T, typename Policy = storage_policy<>>
+class recycling_allocator
+{
+public:
+    using value_type = T;
+    using policy_type = Policy;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = recycling_allocator<U, Policy>;
+    };
+
+    recycling_allocator() noexcept = default;
+    template <typename U>
+    recycling_allocator(const recycling_allocator<U, Policy>&) noexcept
+    { }
+
+    T* allocate(std::size_t n)
+    {
+        const std::size_t size_class = pooled_class(n);
+        if (size_class == detail::pool_classes)
+        {
+            return aligned_allocator<T, Policy>().allocate(n);
+        }
+
+        detail::thread_cache* cache = detail::thread_cache::local();
+        if (cache == nullptr)
+        {
+            return static_cast<T*>(detail::thread_cache::allocate_upstream(nullptr, size_class));
+        }
+        return static_cast<T*>(cache->allocate(size_class));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept
+    {
+        const std::size_t size_class = pooled_class(n);
+        if (size_class == detail::pool_classes)
+        {
+            aligned_allocator<T, Policy>().deallocate(ptr, n);
+            return;
+        }
+
+        detail::thread_cache* cache = detail::thread_cache::local();
+        if (cache == nullptr)
+        {
+            detail::thread_cache::deallocate_unowned(ptr, size_class);
+            return;
+        }
+        cache->deallocate(ptr, size_class);
+    }
+
+    template <typename U>
+    bool operator == (const recycling_allocator<U, Policy>&) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator != (const recycling_allocator<U, Policy>&) const noexcept
+    {
+        return false;
+    }
+
+private:
+    static constexpr std::size_t pooled_class(std::size_t n) noexcept
+    {
+        if constexpr (Policy::alignment > detail::pool_header_size || alignof(T) > detail::pool_header_size)
+        {
+            return detail::pool_classes;
+        }
+        return detail::pool_size_class(n * sizeof(T));
+    }
+};
+} // namespace haifisch
+
+#endif // HAIFISCH_POOL_HPP
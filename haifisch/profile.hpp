@@ -0,0 +1,505 @@
+#pragma once
+
+#ifndef HAIFISCH_PROFILE_HPP
+#define HAIFISCH_PROFILE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(HAIFISCH_PROFILE) && defined(__linux__)
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif // HAIFISCH_PROFILE && __linux__
+
+#ifdef HAIFISCH_PROFILE
+# include "../util/logger.hpp"
+#endif // HAIFISCH_PROFILE
+
+/// HAIFISCH_PROFILE_SCOPE(kernel, work) attributes the hardware counters of
+/// the enclosing block to kernel, in the size class of work (elements or
+/// multiply-adds). Only the outermost scope of a thread records, so a kernel
+/// built on another is not counted twice.
+///
+/// A parallel region adds its threads to the scope of the encountering
+/// thread: HAIFISCH_PROFILE_TEAM(team) before the region names that scope,
+/// and HAIFISCH_PROFILE_MEMBER(team) at the top of the region counts every
+/// other thread of the team into it.
+///
+/// Without HAIFISCH_PROFILE defined all three expand to nothing and work is
+/// never evaluated.
+#ifdef HAIFISCH_PROFILE
+# define HAIFISCH_PROFILE_CONCAT_(a, b) a##b
+# define HAIFISCH_PROFILE_CONCAT(a, b) HAIFISCH_PROFILE_CONCAT_(a, b)
+# define HAIFISCH_PROFILE_SCOPE(kernel, work) \
+    ::haifisch::profile::scope HAIFISCH_PROFILE_CONCAT(haifisch_profile_scope_, __LINE__) { kernel, work }
+# define HAIFISCH_PROFILE_TEAM(team) \
+    ::haifisch::profile::scope* const team = ::haifisch::profile::current()
+# define HAIFISCH_PROFILE_MEMBER(team) \
+    const ::haifisch::profile::member HAIFISCH_PROFILE_CONCAT(haifisch_profile_member_, __LINE__) { team }
+#else
+# define HAIFISCH_PROFILE_SCOPE(kernel, work) static_cast<void>(0)
+# define HAIFISCH_PROFILE_TEAM(team) static_cast<void>(0)
+# define HAIFISCH_PROFILE_MEMBER(team) static_cast<void>(0)
+#endif // HAIFISCH_PROFILE
+
+
+namespace haifisch
+{
+namespace profile
+{
+enum class counter : std::size_t
+{
+    cycles,
+    instructions,
+    l1d_misses,
+    llc_misses,
+    dtlb_misses,
+    fp_instructions,
+    count
+};
+
+constexpr std::size_t counter_count = static_cast<std::size_t>(counter::count);
+
+constexpr const char* counter_name(counter c) noexcept
+{
+    switch (c)
+    {
+        case counter::cycles:          return "cycles";
+        case counter::instructions:    return "instructions";
+        case counter::l1d_misses:      return "l1d_misses";
+        case counter::llc_misses:      return "llc_misses";
+        case counter::dtlb_misses:     return "dtlb_misses";
+        case counter::fp_instructions: return "fp_instructions";
+        default:                       return "";
+    }
+}
+
+/// Counter totals of one kernel and size class. A counter the kernel or the
+/// host could not open stays unavailable and reads zero.
+struct counters
+{
+    std::array<std::uint64_t, counter_count> values {};
+    std::array<bool, counter_count> available {};
+    std::uint64_t calls = 0;
+    double seconds = 0;
+
+    std::uint64_t operator [] (counter c) const noexcept
+    {
+        return values[static_cast<std::size_t>(c)];
+    }
+
+    counters& operator += (const counters& rhs) noexcept
+    {
+        for (std::size_t i = 0; i < counter_count; ++i)
+        {
+            values[i] += rhs.values[i];
+            available[i] = available[i] || rhs.available[i];
+        }
+        calls += rhs.calls;
+        seconds += rhs.seconds;
+        return *this;
+    }
+};
+
+/// Size classes are powers of two of the work a call does: class c holds
+/// calls with 2^c <= work < 2^(c + 1).
+constexpr unsigned size_class(std::size_t work) noexcept
+{
+    unsigned c = 0;
+    while (work > 1)
+    {
+        work >>= 1;
+        ++c;
+    }
+    return c;
+}
+
+struct entry
+{
+    std::string kernel;
+    unsigned size_class;
+    counters totals;
+};
+
+namespace detail
+{
+struct registry
+{
+    std::mutex mutex;
+    std::map<std::pair<std::string, unsigned>, counters> totals;
+};
+
+inline registry& global_registry()
+{
+    static registry instance;
+    return instance;
+}
+} // namespace detail
+
+/// Adds one sample to the totals of kernel in the class of work.
+inline void record(const char* kernel, std::size_t work, const counters& sample)
+{
+    detail::registry& reg = detail::global_registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    reg.totals[{ kernel, size_class(work) }] += sample;
+}
+
+/// Totals so far, ordered by kernel and size class.
+inline std::vector<entry> snapshot()
+{
+    detail::registry& reg = detail::global_registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    std::vector<entry> entries;
+    entries.reserve(reg.totals.size());
+    for (const auto& [key, totals] : reg.totals)
+    {
+        entries.push_back({ key.first, key.second, totals });
+    }
+    return entries;
+}
+
+inline void reset()
+{
+    detail::registry& reg = detail::global_registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    reg.totals.clear();
+}
+
+/// One line per kernel and size class; unavailable counters print as "-".
+inline std::string format(const entry& e)
+{
+    std::string line = e.kernel + " 2^" + std::to_string(e.size_class)
+                     + " calls=" + std::to_string(e.totals.calls)
+                     + " ms=" + std::to_string(e.totals.seconds * 1e3);
+    for (std::size_t i = 0; i < counter_count; ++i)
+    {
+        line += ' ';
+        line += counter_name(static_cast<counter>(i));
+        line += '=';
+        line += e.totals.available[i] ? std::to_string(e.totals.values[i]) : "-";
+    }
+    const std::uint64_t cycles = e.totals[counter::cycles];
+    if (cycles > 0 && e.totals.available[static_cast<std::size_t>(counter::instructions)])
+    {
+        line += " ipc=" + std::to_string(static_cast<double>(e.totals[counter::instructions]) / static_cast<double>(cycles));
+    }
+    return line;
+}
+
+inline void report(std::ostream& os)
+{
+    for (const entry& e : snapshot())
+    {
+        os << format(e) << '\n';
+    }
+}
+
+#ifdef HAIFISCH_PROFILE
+/// Sends the report through logger, one debug record per entry.
+inline void log_report()
+{
+    for (const entry& e : snapshot())
+    {
+        HAIFISCH_LOG(logflag::debug) << "profile " << format(e);
+    }
+}
+
+namespace detail
+{
+/// The counters of the calling thread, opened on first use as one perf
+/// event group led by cycles so they are scheduled together. Counting is
+/// per thread and user space only; OpenMP workers keep their own groups and
+/// reach a scope through member. Every event that cannot be opened (no PMU,
+/// perf_event_paranoid, a virtual machine) is left out.
+class thread_counters
+{
+public:
+    struct reading
+    {
+        std::array<std::uint64_t, counter_count> values {};
+        std::uint64_t enabled = 0;
+        std::uint64_t running = 0;
+    };
+
+    thread_counters() noexcept
+    {
+#ifdef __linux__
+        leader = open(counter::cycles, -1);
+        if (leader < 0)
+        {
+            return;
+        }
+        slots.push_back(counter::cycles);
+        for (std::size_t i = 1; i < counter_count; ++i)
+        {
+            const int fd = open(static_cast<counter>(i), leader);
+            if (fd >= 0)
+            {
+                members.push_back(fd);
+                slots.push_back(static_cast<counter>(i));
+            }
+        }
+#endif // __linux__
+    }
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator = (const thread_counters&) = delete;
+    ~thread_counters()
+    {
+#ifdef __linux__
+        for (const int fd : members)
+        {
+            ::close(fd);
+        }
+        if (leader >= 0)
+        {
+            ::close(leader);
+        }
+#endif // __linux__
+    }
+
+    const std::vector<counter>& opened() const noexcept
+    {
+        return slots;
+    }
+
+    reading read() const noexcept
+    {
+        reading r;
+#ifdef __linux__
+        if (leader < 0)
+        {
+            return r;
+        }
+        // PERF_FORMAT_GROUP with both times: nr, enabled, running, values.
+        std::uint64_t buffer[3 + counter_count] = {};
+        if (::read(leader, buffer, sizeof(buffer)) <= 0)
+        {
+            return r;
+        }
+        r.enabled = buffer[1];
+        r.running = buffer[2];
+        for (std::size_t i = 0; i < buffer[0] && i < slots.size(); ++i)
+        {
+            r.values[static_cast<std::size_t>(slots[i])] = buffer[3 + i];
+        }
+#endif // __linux__
+        return r;
+    }
+
+private:
+#ifdef __linux__
+    static bool configure(counter c, perf_event_attr& attr) noexcept
+    {
+        constexpr auto cache_miss = [](std::uint64_t cache) noexcept
+        {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        switch (c)
+        {
+            case counter::cycles:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                return true;
+            case counter::instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                return true;
+            case counter::l1d_misses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D);
+                return true;
+            case counter::llc_misses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                return true;
+            case counter::dtlb_misses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB);
+                return true;
+            case counter::fp_instructions:
+# if defined(__x86_64__) || defined(__i386__)
+                // FP_ARITH_INST_RETIRED with every umask: scalar and packed
+                // arithmetic of all widths. The encoding is Intel's.
+                __builtin_cpu_init();
+                if (!__builtin_cpu_is("intel"))
+                {
+                    return false;
+                }
+                attr.type = PERF_TYPE_RAW;
+                attr.config = 0xc7 | (0xff << 8);
+                return true;
+# else
+                return false;
+# endif
+            default:
+                return false;
+        }
+    }
+
+    static int open(counter c, int group) noexcept
+    {
+        perf_event_attr attr {};
+        attr.size = sizeof(attr);
+        if (!configure(c, attr))
+        {
+            return -1;
+        }
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+
+    int leader = -1;
+    std::vector<int> members;
+#endif // __linux__
+    std::vector<counter> slots;
+};
+
+inline const thread_counters& this_thread_counters()
+{
+    static thread_local const thread_counters instance;
+    return instance;
+}
+
+/// What the calling thread counted since start, scaled for multiplexing:
+/// the group only counted while it was scheduled on a PMU.
+inline counters counted_since(const thread_counters::reading& start)
+{
+    const thread_counters& group = this_thread_counters();
+    const thread_counters::reading end = group.read();
+    const std::uint64_t enabled = end.enabled - start.enabled;
+    const std::uint64_t running = end.running - start.running;
+    const double scale = running > 0 ? static_cast<double>(enabled) / static_cast<double>(running) : 0.0;
+
+    counters sample;
+    for (const counter c : group.opened())
+    {
+        const std::size_t i = static_cast<std::size_t>(c);
+        sample.available[i] = true;
+        sample.values[i] = static_cast<std::uint64_t>(static_cast<double>(end.values[i] - start.values[i]) * scale);
+    }
+    return sample;
+}
+} // namespace detail
+
+class scope;
+
+namespace detail
+{
+/// The scope whose totals already include the calling thread: the one it
+/// opened, or the one of the team it works in.
+inline scope*& counting_scope() noexcept
+{
+    static thread_local scope* owner = nullptr;
+    return owner;
+}
+} // namespace detail
+
+/// The scope the calling thread counts into, or nullptr outside of one.
+inline scope* current() noexcept
+{
+    return detail::counting_scope();
+}
+
+/// Reads the thread's counters and the clock on construction and
+/// destruction and records the difference together with what the members
+/// of its parallel regions added. A scope opened while the thread already
+/// counts into one records nothing.
+class scope
+{
+public:
+    scope(const char* kernel_, std::size_t work_) noexcept
+        : kernel(kernel_)
+        , work(work_)
+        , outermost(current() == nullptr)
+    {
+        if (outermost)
+        {
+            detail::counting_scope() = this;
+            start = detail::this_thread_counters().read();
+            started = clock::now();
+        }
+    }
+    scope(const scope&) = delete;
+    scope& operator = (const scope&) = delete;
+    ~scope()
+    {
+        if (!outermost)
+        {
+            return;
+        }
+        const auto finished = clock::now();
+        counters sample = detail::counted_since(start);
+        sample.calls = 1;
+        sample.seconds = std::chrono::duration<double>(finished - started).count();
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            sample += team;
+        }
+        detail::counting_scope() = nullptr;
+        record(kernel, work, sample);
+    }
+
+    /// Adds the counters of a team member.
+    void add(const counters& sample)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        team += sample;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    const char* kernel;
+    std::size_t work;
+    bool outermost;
+    detail::thread_counters::reading start;
+    clock::time_point started;
+    std::mutex mutex;
+    counters team;
+};
+
+/// Counts the calling thread into owner for its lifetime, unless the thread
+/// is already counted, as the thread that opened owner is.
+class member
+{
+public:
+    explicit member(scope* owner_) noexcept
+        : owner(owner_ != nullptr && current() == nullptr ? owner_ : nullptr)
+    {
+        if (owner != nullptr)
+        {
+            detail::counting_scope() = owner;
+            start = detail::this_thread_counters().read();
+        }
+    }
+    member(const member&) = delete;
+    member& operator = (const member&) = delete;
+    ~member()
+    {
+        if (owner != nullptr)
+        {
+            owner->add(detail::counted_since(start));
+            detail::counting_scope() = nullptr;
+        }
+    }
+
+private:
+    scope* owner;
+    detail::thread_counters::reading start;
+};
+#endif // HAIFISCH_PROFILE
+} // namespace profile
+} // namespace haifisch
+
+#endif // HAIFISCH_PROFILE_HPP
@@ -0,0 +1,603 @@
+#pragma once
+
+#ifndef HAIFISCH_QUANTIZED_HPP
+#define HAIFISCH_QUANTIZED_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "view.hpp"
+
+#ifdef HAIFISCH_X86
+# include <immintrin.h>
+#endif // HAIFISCH_X86
+
+
+namespace haifisch
+{
+/// Affine quantization, real = scale * (q - zero_point): one pair for the
+/// whole operand, or one per row of a left operand (per column of a right
+/// operand) for per-channel weights.
+class quantization
+{
+public:
+    quantization(float scale_ = 1.0f, std::int32_t zero_point_ = 0)
+        : scales(1, scale_)
+        , zero_points(1, zero_point_)
+    { }
+    quantization(std::vector<float> scales_, std::vector<std::int32_t> zero_points_)
+        : scales(std::move(scales_))
+        , zero_points(std::move(zero_points_))
+    {
+        assert(!scales.empty() && scales.size() == zero_points.size());
+    }
+
+    [[gnu::always_inline]] inline std::size_t size() const noexcept
+    {
+        return scales.size();
+    }
+    [[gnu::always_inline]] inline float scale(std::size_t index) const noexcept
+    {
+        return scales.size() == 1 ? scales[0] : scales[index];
+    }
+    [[gnu::always_inline]] inline std::int32_t zero_point(std::size_t index) const noexcept
+    {
+        return zero_points.size() == 1 ? zero_points[0] : zero_points[index];
+    }
+
+private:
+    std::vector<float> scales;
+    std::vector<std::int32_t> zero_points;
+};
+
+namespace detail
+{
+/// Bytes of k multiplied per accumulator lane and step: vpdpbusd sums four
+/// u8 x s8 products into every int32 lane, so both operands are packed in
+/// groups of four consecutive k.
+constexpr std::size_t quantized_group = 4;
+
+/// Block sizes of the quantized driver: an mc x kc block of packed A
+/// (128 KiB) and the mc x nc int32 accumulator of a thread stay in L2.
+constexpr std::size_t quantized_mc = 128;
+constexpr std::size_t quantized_nc = 256;
+constexpr std::size_t quantized_kc = 1024;
+
+/// Accumulates, or stores when !accumulate, the rows x cols tile of
+/// product sums of groups packed groups of A and B into c (leading
+/// dimension ldc).
+using quantized_kernel_t = void (*)(std::size_t groups, const std::uint8_t* a, const std::int8_t* b,
+                                    std::int32_t* c, std::size_t ldc, std::size_t rows, std::size_t cols,
+                                    bool accumulate) noexcept;
+
+struct quantized_kernel
+{
+    quantized_kernel_t function;
+    std::size_t mr;
+    std::size_t nr;
+};
+
+template <std::size_t MR, std::size_t NR>
+[[gnu::always_inline]] inline void store_quantized_tile(const std::int32_t* tile, std::int32_t* c, std::size_t ldc,
+                                                        std::size_t rows, std::size_t cols, bool accumulate) noexcept
+{
+    for (std::size_t y = 0; y < cols; ++y)
+    {
+        for (std::size_t x = 0; x < rows; ++x)
+        {
+            c[y * ldc + x] = (accumulate ? c[y * ldc + x] : 0) + tile[y * MR + x];
+        }
+    }
+}
+
+constexpr std::size_t quantized_generic_mr = 8;
+constexpr std::size_t quantized_generic_nr = 4;
+
+inline void quantized_kernel_generic(std::size_t groups, const std::uint8_t* a, const std::int8_t* b,
+                                     std::int32_t* c, std::size_t ldc, std::size_t rows, std::size_t cols,
+                                     bool accumulate) noexcept
+{
+    constexpr std::size_t MR = quantized_generic_mr;
+    constexpr std::size_t NR = quantized_generic_nr;
+    constexpr std::size_t G = quantized_group;
+
+    std::int32_t tile[NR * MR] = {};
+    for (std::size_t g = 0; g < groups; ++g)
+    {
+        const std::uint8_t* a_group = a + g * MR * G;
+        const std::int8_t* b_group = b + g * NR * G;
+        for (std::size_t y = 0; y < NR; ++y)
+        {
+            for (std::size_t x = 0; x < MR; ++x)
+            {
+                std::int32_t sum = 0;
+                for (std::size_t j = 0; j < G; ++j)
+                {
+                    sum += std::int32_t { a_group[x * G + j] } * std::int32_t { b_group[y * G + j] };
+                }
+                tile[y * MR + x] += sum;
+            }
+        }
+    }
+    store_quantized_tile<MR, NR>(tile, c, ldc, rows, cols, accumulate);
+}
+
+#ifdef HAIFISCH_X86
+constexpr std::size_t quantized_avx2_mr = 8;
+constexpr std::size_t quantized_avx2_nr = 4;
+
+/// AVX2 has no unsaturated byte dot product: vpmaddubsw saturates its
+/// int16 pair sums, which u8 x s8 operands overflow. Both operands are
+/// widened to int16 instead and multiplied with vpmaddwd, whose int32 pair
+/// sums are exact. An accumulator holds two partial sums per row, folded
+/// with one horizontal add at the end.
+[[gnu::target("avx2,fma")]]
+inline void quantized_kernel_avx2(std::size_t groups, const std::uint8_t* a, const std::int8_t* b,
+                                  std::int32_t* c, std::size_t ldc, std::size_t rows, std::size_t cols,
+                                  bool accumulate) noexcept
+{
+    constexpr std::size_t MR = quantized_avx2_mr;
+    constexpr std::size_t NR = quantized_avx2_nr;
+    constexpr std::size_t G = quantized_group;
+
+    __m256i acc[NR][2];
+    for (auto& column : acc)
+    {
+        column[0] = _mm256_setzero_si256();
+        column[1] = _mm256_setzero_si256();
+    }
+
+    for (std::size_t g = 0; g < groups; ++g)
+    {
+        /// Rows 0-3 and 4-7, four k each, as int16.
+        const __m128i a_bytes_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + g * MR * G));
+        const __m128i a_bytes_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + g * MR * G + 16));
+        const __m256i a_low = _mm256_cvtepu8_epi16(a_bytes_low);
+        const __m256i a_high = _mm256_cvtepu8_epi16(a_bytes_high);
+
+        /// The four k of every column, repeated across the register.
+        const __m256i b_words = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + g * NR * G)));
+        const __m256i b_columns[NR] = {
+            _mm256_permute4x64_epi64(b_words, 0x00), _mm256_permute4x64_epi64(b_words, 0x55),
+            _mm256_permute4x64_epi64(b_words, 0xaa), _mm256_permute4x64_epi64(b_words, 0xff)
+        };
+        for (std::size_t y = 0; y < NR; ++y)
+        {
+            acc[y][0] = _mm256_add_epi32(acc[y][0], _mm256_madd_epi16(a_low, b_columns[y]));
+            acc[y][1] = _mm256_add_epi32(acc[y][1], _mm256_madd_epi16(a_high, b_columns[y]));
+        }
+    }
+
+    alignas(32) std::int32_t tile[NR * MR];
+    for (std::size_t y = 0; y < NR; ++y)
+    {
+        /// Pairs [x0 x0 x1 x1 | x2 x2 x3 x3] and the same for x4-x7 fold
+        /// to [x0 x1 x4 x5 | x2 x3 x6 x7]; the permute restores the order.
+        const __m256i folded = _mm256_hadd_epi32(acc[y][0], acc[y][1]);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(tile + y * MR), _mm256_permute4x64_epi64(folded, 0xd8));
+    }
+    store_quantized_tile<MR, NR>(tile, c, ldc, rows, cols, accumulate);
+}
+
+constexpr std::size_t quantized_vnni_mr = 32;
+constexpr std::size_t quantized_vnni_nr = 8;
+
+/// AVX-512 VNNI: vpdpbusd adds four exact u8 x s8 products to each of 16
+/// int32 lanes, so one instruction covers 16 rows x 4 k of one column.
+[[gnu::target("avx512f,avx512bw,avx512vnni")]]
+inline void quantized_kernel_vnni(std::size_t groups, const std::uint8_t* a, const std::int8_t* b,
+                                  std::int32_t* c, std::size_t ldc, std::size_t rows, std::size_t cols,
+                                  bool accumulate) noexcept
+{
+    constexpr std::size_t MR = quantized_vnni_mr;
+    constexpr std::size_t NR = quantized_vnni_nr;
+    constexpr std::size_t G = quantized_group;
+
+    __m512i acc[NR][2];
+    for (auto& column : acc)
+    {
+        column[0] = _mm512_setzero_si512();
+        column[1] = _mm512_setzero_si512();
+    }
+
+    for (std::size_t g = 0; g < groups; ++g)
+    {
+        const __m512i a_low = _mm512_loadu_si512(a + g * MR * G);
+        const __m512i a_high = _mm512_loadu_si512(a + g * MR * G + 64);
+        for (std::size_t y = 0; y < NR; ++y)
+        {
+            std::int32_t column_bytes;
+            std::memcpy(&column_bytes, b + (g * NR + y) * G, sizeof(column_bytes));
+            const __m512i b_column = _mm512_set1_epi32(column_bytes);
+            acc[y][0] = _mm512_dpbusd_epi32(acc[y][0], a_low, b_column);
+            acc[y][1] = _mm512_dpbusd_epi32(acc[y][1], a_high, b_column);
+        }
+    }
+
+    if (rows == MR && cols == NR)
+    {
+        for (std::size_t y = 0; y < NR; ++y)
+        {
+            std::int32_t* target = c + y * ldc;
+            if (accumulate)
+            {
+                acc[y][0] = _mm512_add_epi32(acc[y][0], _mm512_loadu_si512(target));
+                acc[y][1] = _mm512_add_epi32(acc[y][1], _mm512_loadu_si512(target + 16));
+            }
+            _mm512_storeu_si512(target, acc[y][0]);
+            _mm512_storeu_si512(target + 16, acc[y][1]);
+        }
+        return;
+    }
+
+    alignas(64) std::int32_t tile[NR * MR];
+    for (std::size_t y = 0; y < NR; ++y)
+    {
+        _mm512_store_si512(tile + y * MR, acc[y][0]);
+        _mm512_store_si512(tile + y * MR + 16, acc[y][1]);
+    }
+    store_quantized_tile<MR, NR>(tile, c, ldc, rows, cols, accumulate);
+}
+#endif // HAIFISCH_X86
+
+/// Kernel of the active ISA level; VNNI is a separate CPUID bit on top of
+/// AVX-512.
+inline quantized_kernel select_quantized_kernel() noexcept
+{
+#ifdef HAIFISCH_X86
+    switch (simd::active_isa())
+    {
+        case simd::isa::avx512:
+            if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw"))
+            {
+                return { quantized_kernel_vnni, quantized_vnni_mr, quantized_vnni_nr };
+            }
+            return { quantized_kernel_avx2, quantized_avx2_mr, quantized_avx2_nr };
+        case simd::isa::avx2:
+            return { quantized_kernel_avx2, quantized_avx2_mr, quantized_avx2_nr };
+        default:
+            break;
+    }
+#endif // HAIFISCH_X86
+    return { quantized_kernel_generic, quantized_generic_mr, quantized_generic_nr };
+}
+
+/// Signed bytes of A enter the u8 side of the kernels offset by 128; the
+/// epilogue subtracts 128 times the column sums of B again.
+template <typename A8>
+constexpr std::int32_t quantized_shift = std::is_signed_v<A8> ? 128 : 0;
+
+/// Packs rows [x0, x0 + rows) and k [p0, p0 + depth) of A (element (x, p)
+/// at a[p * lda + x]) into mr-row panels of groups: per group, mr rows of
+/// quantized_group consecutive k. Padding is zero.
+template <typename A8>
+void pack_quantized_a(const A8* a, std::size_t lda, std::size_t x0, std::size_t rows, std::size_t p0,
+                      std::size_t depth, std::size_t mr, std::uint8_t* packed) noexcept
+{
+    constexpr std::size_t G = quantized_group;
+    const std::size_t groups = (depth + G - 1) / G;
+
+    for (std::size_t panel = 0; panel * mr < rows; ++panel)
+    {
+        const std::size_t first = panel * mr;
+        const std::size_t count = std::min(mr, rows - first);
+        std::uint8_t* target = packed + panel * groups * mr * G;
+        for (std::size_t g = 0; g < groups; ++g)
+        {
+            for (std::size_t j = 0; j < G; ++j)
+            {
+                const std::size_t p = g * G + j;
+                std::uint8_t* slot = target + g * mr * G + j;
+                if (p >= depth)
+                {
+                    for (std::size_t x = 0; x < mr; ++x)
+                    {
+                        slot[x * G] = 0;
+                    }
+                    continue;
+                }
+                const A8* line = a + (p0 + p) * lda + x0 + first;
+                for (std::size_t x = 0; x < count; ++x)
+                {
+                    slot[x * G] = static_cast<std::uint8_t>(std::int32_t { line[x] } + quantized_shift<A8>);
+                }
+                for (std::size_t x = count; x < mr; ++x)
+                {
+                    slot[x * G] = 0;
+                }
+            }
+        }
+    }
+}
+
+/// Packs columns [y0, y0 + cols) of B (element (p, y) at b[y * ldb + p])
+/// over all k into nr-column panels of groups, zero-padded.
+inline void pack_quantized_b(const std::int8_t* b, std::size_t ldb, std::size_t y0, std::size_t cols,
+                             std::size_t k, std::size_t nr, std::int8_t* packed) noexcept
+{
+    constexpr std::size_t G = quantized_group;
+    const std::size_t groups = (k + G - 1) / G;
+
+    for (std::size_t panel = 0; panel * nr < cols; ++panel)
+    {
+        std::int8_t* target = packed + panel * groups * nr * G;
+        for (std::size_t y = 0; y < nr; ++y)
+        {
+            const std::size_t column = panel * nr + y;
+            const std::int8_t* line = b + (y0 + column) * ldb;
+            for (std::size_t p = 0; p < groups * G; ++p)
+            {
+                target[(p / G * nr + y) * G + p % G] = column < cols && p < k ? line[p] : 0;
+            }
+        }
+    }
+}
+
+/// Per-row and per-column terms of the epilogue. With za and zb the zero
+/// points of row x of A and column y of B,
+///   sum (a - za)(b - zb) = sum ab - zb * rowsum_a(x) - za * colsum_b(y) + k za zb,
+/// and the kernels' sum ab carries an extra shift * colsum_b(y).
+struct quantized_terms
+{
+    std::vector<std::int32_t> row_sums;
+    std::vector<std::int32_t> row_zeros;
+    std::vector<float> row_scales;
+    std::vector<std::int32_t> column_sums;
+    std::vector<std::int32_t> column_zeros;
+    std::vector<float> column_scales;
+    std::int32_t shift;
+    std::int32_t depth;
+
+    /// Corrects the column y of a block, rows [x0, x0 + rows), in place.
+    void correct(std::size_t x0, std::size_t y, std::size_t rows, std::int32_t* column) const noexcept
+    {
+        const std::int32_t column_sum = column_sums[y];
+        const std::int32_t zb = column_zeros[y];
+        const std::int32_t* za = row_zeros.data() + x0;
+        const std::int32_t* sums = row_sums.data() + x0;
+        for (std::size_t x = 0; x < rows; ++x)
+        {
+            column[x] += depth * za[x] * zb - column_sum * (za[x] + shift) - zb * sums[x];
+        }
+    }
+};
+
+template <typename A8>
+quantized_terms make_quantized_terms(std::size_t m, std::size_t n, std::size_t k,
+                                     const A8* a, std::size_t lda, const std::int8_t* b, std::size_t ldb,
+                                     const quantization& qa, const quantization& qb)
+{
+    quantized_terms terms { std::vector<std::int32_t>(m), std::vector<std::int32_t>(m), std::vector<float>(m),
+                            std::vector<std::int32_t>(n), std::vector<std::int32_t>(n), std::vector<float>(n),
+                            quantized_shift<A8>, static_cast<std::int32_t>(k) };
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        const A8* line = a + p * lda;
+        for (std::size_t x = 0; x < m; ++x)
+        {
+            terms.row_sums[x] += line[x];
+        }
+    }
+    for (std::size_t x = 0; x < m; ++x)
+    {
+        terms.row_zeros[x] = qa.zero_point(x);
+        terms.row_scales[x] = qa.scale(x);
+    }
+    for (std::size_t y = 0; y < n; ++y)
+    {
+        std::int32_t sum = 0;
+        for (std::size_t p = 0; p < k; ++p)
+        {
+            sum += b[y * ldb + p];
+        }
+        terms.column_sums[y] = sum;
+        terms.column_zeros[y] = qb.zero_point(y);
+        terms.column_scales[y] = qb.scale(y);
+    }
+    return terms;
+}
+
+/// C = A B over quantized operands, A m x k of u8 or s8 and B k x n of s8,
+/// with exact int32 accumulation (k up to 2^16).
+///
+/// B is packed once and shared. Every thread takes an mc-row block of A,
+/// packs it once over all of k, and walks the columns in nc-wide steps,
+/// accumulating each mc x nc block of C in its own int32 buffer. Once a
+/// block has seen all of k, its columns are corrected and handed to
+/// output(x0, y0, rows, cols, block, ld) while still in cache.
+template <typename A8, typename Output>
+void quantized_gemm(std::size_t m, std::size_t n, std::size_t k,
+                    const A8* a, std::size_t lda, const std::int8_t* b, std::size_t ldb,
+                    const quantized_terms& terms, const Output& output)
+{
+    constexpr std::size_t G = quantized_group;
+    const quantized_kernel kernel = select_quantized_kernel();
+    const std::size_t groups = (k + G - 1) / G;
+    const std::size_t mc = quantized_mc;
+    const std::size_t nc = round_up(quantized_nc, kernel.nr);
+    const std::size_t kc = quantized_kc;
+    const std::size_t m_blocks = (m + mc - 1) / mc;
+    const std::size_t b_panels = (n + kernel.nr - 1) / kernel.nr;
+    const std::size_t panel_bytes = groups * G;
+
+    aligned_buffer<std::int8_t> packed_b(std::max<std::size_t>(b_panels * kernel.nr * panel_bytes, 1));
+
+    #pragma omp parallel if (m * n * k >= gemm_parallel_threshold)
+    {
+        #pragma omp for schedule(static)
+        for (std::size_t panel = 0; panel < b_panels; ++panel)
+        {
+            const std::size_t first = panel * kernel.nr;
+            pack_quantized_b(b, ldb, first, std::min(kernel.nr, n - first), k, kernel.nr,
+                             packed_b.get() + panel * kernel.nr * panel_bytes);
+        }
+
+        aligned_buffer<std::uint8_t> packed_a(std::max<std::size_t>(round_up(mc, kernel.mr) * panel_bytes, 1));
+        aligned_buffer<std::int32_t> block(mc * nc);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (std::size_t m_block = 0; m_block < m_blocks; ++m_block)
+        {
+            const std::size_t x0 = m_block * mc;
+            const std::size_t rows = std::min(mc, m - x0);
+            pack_quantized_a(a, lda, x0, rows, 0, k, kernel.mr, packed_a.get());
+
+            for (std::size_t y0 = 0; y0 < n; y0 += nc)
+            {
+                const std::size_t cols = std::min(nc, n - y0);
+                if (k == 0)
+                {
+                    std::fill_n(block.get(), mc * nc, 0);
+                }
+                for (std::size_t p0 = 0; p0 < k; p0 += kc)
+                {
+                    const std::size_t depth_groups = (std::min(kc, k - p0) + G - 1) / G;
+                    for (std::size_t y = 0; y < cols; y += kernel.nr)
+                    {
+                        const std::int8_t* b_panel = packed_b.get() + (y0 + y) * panel_bytes + p0 * kernel.nr;
+                        for (std::size_t x = 0; x < rows; x += kernel.mr)
+                        {
+                            kernel.function(depth_groups, packed_a.get() + x * panel_bytes + p0 * kernel.mr, b_panel,
+                                            block.get() + y * mc + x, mc,
+                                            std::min(kernel.mr, rows - x), std::min(kernel.nr, cols - y), p0 > 0);
+                        }
+                    }
+                }
+                for (std::size_t y = 0; y < cols; ++y)
+                {
+                    terms.correct(x0, y0 + y, rows, block.get() + y * mc);
+                }
+                output(x0, y0, rows, cols, static_cast<const std::int32_t*>(block.get()), mc);
+            }
+        }
+    }
+}
+
+template <typename T>
+constexpr bool is_quantized_v = std::is_same_v<T, std::int8_t> || std::is_same_v<T, std::uint8_t>;
+
+/// Runs the quantized product of the views; output as in quantized_gemm().
+template <typename A, typename B, typename Output>
+void quantized_product(matrix_view<A> a, const quantization& qa, matrix_view<B> b, const quantization& qb,
+                       const Output& output)
+{
+    using a_type = std::remove_const_t<A>;
+    static_assert(is_quantized_v<a_type> && std::is_same_v<std::remove_const_t<B>, std::int8_t>,
+                  "quantized products multiply int8 or uint8 by int8");
+    assert(a.height() == b.width());
+    assert(qa.size() == 1 || qa.size() == a.width());
+    assert(qb.size() == 1 || qb.size() == b.height());
+
+    const std::size_t m = a.width();
+    const std::size_t n = b.height();
+    const std::size_t k = a.height();
+    const a_type* a_data = a.data();
+    const std::int8_t* b_data = b.data();
+
+    const quantized_terms terms = make_quantized_terms(m, n, k, a_data, a.stride(), b_data, b.stride(), qa, qb);
+    quantized_gemm(m, n, k, a_data, a.stride(), b_data, b.stride(), terms,
+        [&](std::size_t x0, std::size_t y0, std::size_t rows, std::size_t cols, const std::int32_t* block, std::size_t ld) {
+            for (std::size_t y = 0; y < cols; ++y)
+            {
+                output(x0, y0 + y, rows, block + y * ld, terms);
+            }
+        });
+}
+} // namespace detail
+
+/// dst = clamp(round(src / scale) + zero_point), with the scale and zero
+/// point of row x for per-row parameters.
+template <typename S, typename Q>
+void quantize(matrix_view<S> src, const quantization& q, matrix_view<Q> dst) noexcept
+{
+    static_assert(detail::is_quantized_v<Q>, "quantize produces int8 or uint8");
+    assert(src.width() == dst.width() && src.height() == dst.height());
+    assert(q.size() == 1 || q.size() == src.width());
+
+    const float lowest = static_cast<float>(std::numeric_limits<Q>::min());
+    const float highest = static_cast<float>(std::numeric_limits<Q>::max());
+    for (std::size_t y = 0; y < src.height(); ++y)
+    {
+        for (std::size_t x = 0; x < src.width(); ++x)
+        {
+            const float value = std::nearbyint(static_cast<float>(src(x, y)) / q.scale(x)) + static_cast<float>(q.zero_point(x));
+            dst(x, y) = static_cast<Q>(std::clamp(value, lowest, highest));
+        }
+    }
+}
+
+/// c(x, y) = sum over p of (a(x, p) - za) * (b(p, y) - zb), exactly: the
+/// zero-point corrected int32 accumulators of the product of a (int8 or
+/// uint8) and b (int8). qa holds one pair or one per row of a, qb one pair
+/// or one per column of b; their scales are not applied here.
+template <typename A, typename B>
+void quantized_gemm(matrix_view<A> a, const quantization& qa, matrix_view<B> b, const quantization& qb,
+                    matrix_view<std::int32_t> c)
+{
+    assert(c.width() == a.width() && c.height() == b.height());
+
+    detail::quantized_product(a, qa, b, qb,
+        [=](std::size_t x0, std::size_t y, std::size_t rows, const std::int32_t* column, const detail::quantized_terms&) {
+            std::memcpy(c.at_pointer(x0, y), column, rows * sizeof(std::int32_t));
+        });
+}
+
+/// Dequantized product: c(x, y) = scale_a(x) * scale_b(y) times the
+/// corrected accumulator.
+template <typename A, typename B>
+void quantized_gemm(matrix_view<A> a, const quantization& qa, matrix_view<B> b, const quantization& qb,
+                    matrix_view<float> c)
+{
+    assert(c.width() == a.width() && c.height() == b.height());
+
+    detail::quantized_product(a, qa, b, qb,
+        [=](std::size_t x0, std::size_t y, std::size_t rows, const std::int32_t* column, const detail::quantized_terms& terms) {
+            const float column_scale = terms.column_scales[y];
+            const float* row_scales = terms.row_scales.data() + x0;
+            float* target = c.at_pointer(x0, y);
+            for (std::size_t x = 0; x < rows; ++x)
+            {
+                target[x] = row_scales[x] * column_scale * static_cast<float>(column[x]);
+            }
+        });
+}
+
+/// Requantized product: the dequantized value is quantized again with the
+/// per-tensor parameters qc, rounding to nearest and saturating to Q.
+template <typename A, typename B, typename Q>
+void quantized_gemm(matrix_view<A> a, const quantization& qa, matrix_view<B> b, const quantization& qb,
+                    matrix_view<Q> c, const quantization& qc)
+{
+    static_assert(detail::is_quantized_v<Q>, "requantized output is int8 or uint8");
+    assert(c.width() == a.width() && c.height() == b.height());
+    assert(qc.size() == 1);
+
+    const float lowest = static_cast<float>(std::numeric_limits<Q>::min());
+    const float highest = static_cast<float>(std::numeric_limits<Q>::max());
+    const float inverse_scale = 1.0f / qc.scale(0);
+    const float output_zero = static_cast<float>(qc.zero_point(0));
+    detail::quantized_product(a, qa, b, qb,
+        [=](std::size_t x0, std::size_t y, std::size_t rows, const std::int32_t* column, const detail::quantized_terms& terms) {
+            const float column_scale = terms.column_scales[y] * inverse_scale;
+            const float* row_scales = terms.row_scales.data() + x0;
+            Q* target = c.at_pointer(x0, y);
+            for (std::size_t x = 0; x < rows; ++x)
+            {
+                const float q = std::nearbyint(row_scales[x] * column_scale * static_cast<float>(column[x])) + output_zero;
+                target[x] = static_cast<Q>(std::clamp(q, lowest, highest));
+            }
+        });
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_QUANTIZED_HPP
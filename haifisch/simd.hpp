@@ -0,0 +1,439 @@
+#pragma once
+
+#ifndef HAIFISCH_SIMD_HPP
+#define HAIFISCH_SIMD_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAIFISCH_X86
+#endif // __x86_64__ || __i386__
+
+
+namespace haifisch
+{
+namespace simd
+{
+/// Instruction set levels the kernels are built for, in ascending order.
+/// The binary itself targets the baseline ISA; wider kernels are compiled
+/// through target attributes and selected at runtime.
+enum class isa : std::uint32_t
+{
+    generic,
+    sse2,
+    avx2,
+    avx512
+};
+
+/// Element types that get hand-vectorized kernels.
+template <typename T>
+constexpr bool has_kernels_v = std::is_same_v<T, float> || std::is_same_v<T, double> || std::is_same_v<T, std::int32_t>;
+
+/// GCC vector extension type of N elements of T.
+template <typename T, std::size_t N>
+struct simd_vector
+{
+    typedef T type __attribute__((vector_size(N * sizeof(T))));
+};
+
+/// Width of a native vector register of the given level, in bytes.
+constexpr std::size_t register_bytes(isa level) noexcept
+{
+    switch (level)
+    {
+        case isa::avx512: return 64;
+        case isa::avx2:   return 32;
+        default:          return 16;
+    }
+}
+
+/// Highest level supported by both the CPU and the operating system.
+inline isa detect_isa() noexcept
+{
+#ifdef HAIFISCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return isa::avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return isa::avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return isa::sse2;
+    }
+#endif // HAIFISCH_X86
+    return isa::generic;
+}
+
+/// The HAIFISCH_ISA environment variable (generic, sse2, avx2, avx512)
+/// caps the level picked at startup.
+inline isa startup_isa() noexcept
+{
+    const isa detected = detect_isa();
+    const char* env = std::getenv("HAIFISCH_ISA");
+    if (env == nullptr)
+    {
+        return detected;
+    }
+
+    const std::string_view requested = env;
+    isa cap = detected;
+    if (requested == "generic") cap = isa::generic;
+    if (requested == "sse2")    cap = isa::sse2;
+    if (requested == "avx2")    cap = isa::avx2;
+    if (requested == "avx512")  cap = isa::avx512;
+
+    return std::min(cap, detected);
+}
+
+inline isa& isa_storage() noexcept
+{
+    static isa level = startup_isa();
+    return level;
+}
+
+/// Level every dispatched kernel currently uses.
+inline isa active_isa() noexcept
+{
+    return isa_storage();
+}
+
+/// Switches the dispatched kernels to the given level, clamped to what the
+/// host supports. Returns the level actually selected.
+inline isa force_isa(isa level) noexcept
+{
+    isa_storage() = std::min(level, detect_isa());
+    return isa_storage();
+}
+
+enum class elementwise_op
+{
+    add,
+    sub,
+    scale,
+    fill
+};
+
+/// Applies op over n elements: dst op= src for add/sub, dst *= value for
+/// scale and dst = value for fill. W is the number of elements processed
+/// per vector step.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void elementwise_body(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    using vec_t = typename simd_vector<T, W>::type;
+
+    const std::size_t vector_end = n - n % W;
+
+    std::size_t i = 0;
+    switch (op)
+    {
+        case elementwise_op::add:
+            for (; i < vector_end; i += W)
+            {
+                vec_t x, y;
+                std::memcpy(&x, dst + i, sizeof(x));
+                std::memcpy(&y, src + i, sizeof(y));
+                x += y;
+                std::memcpy(dst + i, &x, sizeof(x));
+            }
+            for (; i < n; ++i)
+            {
+                dst[i] += src[i];
+            }
+            break;
+
+        case elementwise_op::sub:
+            for (; i < vector_end; i += W)
+            {
+                vec_t x, y;
+                std::memcpy(&x, dst + i, sizeof(x));
+                std::memcpy(&y, src + i, sizeof(y));
+                x -= y;
+                std::memcpy(dst + i, &x, sizeof(x));
+            }
+            for (; i < n; ++i)
+            {
+                dst[i] -= src[i];
+            }
+            break;
+
+        case elementwise_op::scale:
+            for (; i < vector_end; i += W)
+            {
+                vec_t x;
+                std::memcpy(&x, dst + i, sizeof(x));
+                x *= value;
+                std::memcpy(dst + i, &x, sizeof(x));
+            }
+            for (; i < n; ++i)
+            {
+                dst[i] *= value;
+            }
+            break;
+
+        case elementwise_op::fill:
+        {
+            vec_t x = {};
+            x += value;
+            for (; i < vector_end; i += W)
+            {
+                std::memcpy(dst + i, &x, sizeof(x));
+            }
+            for (; i < n; ++i)
+            {
+                dst[i] = value;
+            }
+            break;
+        }
+    }
+}
+
+/// Four registers per step hide the load latency of the streaming loops.
+template <typename T, isa Level>
+constexpr std::size_t elementwise_width = 4 * register_bytes(Level) / sizeof(T);
+
+template <typename T>
+void elementwise_generic(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    elementwise_body<T, elementwise_width<T, isa::generic>>(op, dst, src, value, n);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T>
+[[gnu::target("sse2")]]
+void elementwise_sse2(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    elementwise_body<T, elementwise_width<T, isa::sse2>>(op, dst, src, value, n);
+}
+
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void elementwise_avx2(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    elementwise_body<T, elementwise_width<T, isa::avx2>>(op, dst, src, value, n);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+void elementwise_avx512(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    elementwise_body<T, elementwise_width<T, isa::avx512>>(op, dst, src, value, n);
+}
+#endif // HAIFISCH_X86
+
+/// Elementwise entry point used by haifisch::matrix. Types without
+/// hand-written kernels take the plain loop.
+template <typename T>
+void elementwise(elementwise_op op, T* dst, const T* src, T value, std::size_t n) noexcept
+{
+    if constexpr (has_kernels_v<T>)
+    {
+        switch (active_isa())
+        {
+#ifdef HAIFISCH_X86
+            case isa::avx512: return elementwise_avx512(op, dst, src, value, n);
+            case isa::avx2:   return elementwise_avx2(op, dst, src, value, n);
+            case isa::sse2:   return elementwise_sse2(op, dst, src, value, n);
+#endif // HAIFISCH_X86
+            default:          return elementwise_generic(op, dst, src, value, n);
+        }
+    }
+    else
+    {
+        switch (op)
+        {
+            case elementwise_op::add:
+                for (std::size_t i = 0; i < n; i++) dst[i] += src[i];
+                break;
+            case elementwise_op::sub:
+                for (std::size_t i = 0; i < n; i++) dst[i] -= src[i];
+                break;
+            case elementwise_op::scale:
+                for (std::size_t i = 0; i < n; i++) dst[i] *= value;
+                break;
+            case elementwise_op::fill:
+                std::fill_n(dst, n, value);
+                break;
+        }
+    }
+}
+
+enum class reduce_op
+{
+    sum,
+    sum_squares,
+    min,
+    max
+};
+
+/// Folds v into the accumulator a; V is an element or a vector of them.
+/// Both are passed by reference so that no vector crosses a call boundary
+/// of a function compiled for another ISA level.
+template <reduce_op Op, typename V>
+[[gnu::always_inline]] inline void reduce_step(V& a, const V& v) noexcept
+{
+    if constexpr (Op == reduce_op::sum)
+    {
+        a += v;
+    }
+    else if constexpr (Op == reduce_op::sum_squares)
+    {
+        a += v * v;
+    }
+    else if constexpr (Op == reduce_op::min)
+    {
+        a = v < a ? v : a;
+    }
+    else
+    {
+        a = a < v ? v : a;
+    }
+}
+
+/// Operation that merges two partial results of Op.
+constexpr reduce_op merge_op(reduce_op op) noexcept
+{
+    return op == reduce_op::sum_squares ? reduce_op::sum : op;
+}
+
+/// Merges the partial result b into a.
+template <typename T>
+[[gnu::always_inline]] inline T reduce_merge(reduce_op op, T a, T b) noexcept
+{
+    switch (merge_op(op))
+    {
+        case reduce_op::min: reduce_step<reduce_op::min>(a, b); break;
+        case reduce_op::max: reduce_step<reduce_op::max>(a, b); break;
+        default:             reduce_step<reduce_op::sum>(a, b); break;
+    }
+    return a;
+}
+
+/// Reduces n > 0 elements with four independent vector accumulators of W
+/// elements each, so the loop is bound by loads rather than by the latency
+/// of the combining instruction.
+template <typename T, std::size_t W, reduce_op Op>
+[[gnu::always_inline]] inline T reduce_body(const T* x, std::size_t n) noexcept
+{
+    using vec_t = typename simd_vector<T, W>::type;
+    constexpr reduce_op Merge = merge_op(Op);
+
+    const T identity = Op == reduce_op::min || Op == reduce_op::max ? x[0] : T {};
+    vec_t acc[4];
+    for (vec_t& a : acc)
+    {
+        a = vec_t {} + identity;
+    }
+
+    const std::size_t step = 4 * W;
+    const std::size_t vector_end = n - n % step;
+    for (std::size_t i = 0; i < vector_end; i += step)
+    {
+        for (std::size_t r = 0; r < 4; ++r)
+        {
+            vec_t v;
+            std::memcpy(&v, x + i + r * W, sizeof(v));
+            reduce_step<Op>(acc[r], v);
+        }
+    }
+
+    reduce_step<Merge>(acc[0], acc[1]);
+    reduce_step<Merge>(acc[2], acc[3]);
+    reduce_step<Merge>(acc[0], acc[2]);
+    T result = acc[0][0];
+    for (std::size_t lane = 1; lane < W; ++lane)
+    {
+        const T value = acc[0][lane];
+        reduce_step<Merge>(result, value);
+    }
+    for (std::size_t i = vector_end; i < n; ++i)
+    {
+        reduce_step<Op>(result, x[i]);
+    }
+    return result;
+}
+
+/// Runtime op to the reduce_body() instantiation of vector width W.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline T reduce_dispatch(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    switch (op)
+    {
+        case reduce_op::sum:         return reduce_body<T, W, reduce_op::sum>(x, n);
+        case reduce_op::sum_squares: return reduce_body<T, W, reduce_op::sum_squares>(x, n);
+        case reduce_op::min:         return reduce_body<T, W, reduce_op::min>(x, n);
+        case reduce_op::max:         return reduce_body<T, W, reduce_op::max>(x, n);
+    }
+    return T {};
+}
+
+template <typename T>
+T reduce_generic(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    return reduce_dispatch<T, register_bytes(isa::generic) / sizeof(T)>(op, x, n);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T>
+[[gnu::target("sse2")]]
+T reduce_sse2(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    return reduce_dispatch<T, register_bytes(isa::sse2) / sizeof(T)>(op, x, n);
+}
+
+template <typename T>
+[[gnu::target("avx2,fma")]]
+T reduce_avx2(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    return reduce_dispatch<T, register_bytes(isa::avx2) / sizeof(T)>(op, x, n);
+}
+
+template <typename T>
+[[gnu::target("avx512f,fma")]]
+T reduce_avx512(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    return reduce_dispatch<T, register_bytes(isa::avx512) / sizeof(T)>(op, x, n);
+}
+#endif // HAIFISCH_X86
+
+/// Reduction entry point: sum, sum of squares, minimum or maximum of the
+/// n > 0 elements at x. Types without hand-written kernels take the plain
+/// loop.
+template <typename T>
+T reduce(reduce_op op, const T* x, std::size_t n) noexcept
+{
+    if constexpr (has_kernels_v<T>)
+    {
+        switch (active_isa())
+        {
+#ifdef HAIFISCH_X86
+            case isa::avx512: return reduce_avx512(op, x, n);
+            case isa::avx2:   return reduce_avx2(op, x, n);
+            case isa::sse2:   return reduce_sse2(op, x, n);
+#endif // HAIFISCH_X86
+            default:          return reduce_generic(op, x, n);
+        }
+    }
+    else
+    {
+        T result = op == reduce_op::min || op == reduce_op::max ? x[0] : T {};
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            result = reduce_merge(op, result, op == reduce_op::sum_squares ? x[i] * x[i] : x[i]);
+        }
+        return result;
+    }
+}
+} // namespace simd
+} // namespace haifisch
+
+#endif // HAIFISCH_SIMD_HPP
@@ -0,0 +1,519 @@
+#pragma once
+
+#ifndef HAIFISCH_SOLVE_HPP
+#define HAIFISCH_SOLVE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "gemm.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+/// Side of the triangular operand in trsm(): op(A) X = alpha B (left) or
+/// X op(A) = alpha B (right).
+enum class trsm_side
+{
+    left,
+    right
+};
+
+/// Triangle of a square operand that holds its elements.
+enum class triangle
+{
+    lower,
+    upper
+};
+
+/// unit: the diagonal is taken to be ones and never read.
+enum class diagonal
+{
+    non_unit,
+    unit
+};
+
+namespace detail
+{
+/// Columns per panel of the blocked factorizations and solves. Every task
+/// updates one such column block, so the trailing updates run as GEMMs of
+/// at least this depth.
+constexpr std::size_t factor_block = 128;
+
+/// Element (i, j) of op(A) for column-major A.
+template <typename T>
+[[gnu::always_inline]] inline T op_at(const T* a, std::size_t lda, bool trans, std::size_t i, std::size_t j) noexcept
+{
+    return trans ? a[i * lda + j] : a[j * lda + i];
+}
+
+/// Rows i and ipiv[i] of the columns [0, cols) trade places for i in
+/// [first, last), in that order.
+template <typename T>
+void swap_rows(T* a, std::size_t lda, std::size_t cols, std::size_t first, std::size_t last, const std::size_t* ipiv) noexcept
+{
+    for (std::size_t c = 0; c < cols; ++c)
+    {
+        T* column = a + c * lda;
+        for (std::size_t i = first; i < last; ++i)
+        {
+            if (ipiv[i] != i)
+            {
+                std::swap(column[i], column[ipiv[i]]);
+            }
+        }
+    }
+}
+
+/// op(A) X = B in place of the n x nrhs matrix B, op(A) being lower
+/// triangular when lower and upper otherwise. Substitution walks
+/// contiguous columns of A: by column updates without transposition, by
+/// dot products with it.
+template <typename T>
+void trsm_left_unblocked(bool lower, bool trans, bool unit, std::size_t n, std::size_t nrhs,
+                         const T* a, std::size_t lda, T* b, std::size_t ldb) noexcept
+{
+    for (std::size_t c = 0; c < nrhs; ++c)
+    {
+        T* x = b + c * ldb;
+        for (std::size_t step = 0; step < n; ++step)
+        {
+            const std::size_t k = lower ? step : n - 1 - step;
+            if (trans)
+            {
+                T sum = x[k];
+                const std::size_t first = lower ? 0 : k + 1;
+                const std::size_t last = lower ? k : n;
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    sum -= a[k * lda + i] * x[i];
+                }
+                x[k] = unit ? sum : sum / a[k * lda + k];
+            }
+            else
+            {
+                if (!unit)
+                {
+                    x[k] /= a[k * lda + k];
+                }
+                const T xk = x[k];
+                const std::size_t first = lower ? k + 1 : 0;
+                const std::size_t last = lower ? n : k;
+                for (std::size_t i = first; i < last; ++i)
+                {
+                    x[i] -= xk * a[k * lda + i];
+                }
+            }
+        }
+    }
+}
+
+/// X op(A) = B in place of the m x n matrix B, op(A) being n x n. Every
+/// step updates a whole contiguous column of X.
+template <typename T>
+void trsm_right_unblocked(bool lower, bool trans, bool unit, std::size_t m, std::size_t n,
+                          const T* a, std::size_t lda, T* b, std::size_t ldb) noexcept
+{
+    for (std::size_t step = 0; step < n; ++step)
+    {
+        /// Lower op(A): column j depends on the columns after it.
+        const std::size_t j = lower ? n - 1 - step : step;
+        T* x = b + j * ldb;
+        const std::size_t first = lower ? j + 1 : 0;
+        const std::size_t last = lower ? n : j;
+        for (std::size_t k = first; k < last; ++k)
+        {
+            const T factor = op_at(a, lda, trans, k, j);
+            const T* xk = b + k * ldb;
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                x[i] -= factor * xk[i];
+            }
+        }
+        if (!unit)
+        {
+            const T inverse = T { 1 } / op_at(a, lda, trans, j, j);
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                x[i] *= inverse;
+            }
+        }
+    }
+}
+
+/// Blocked solve on one slice of B: factor_block-sized diagonal blocks are
+/// solved directly and the rest of B is updated through the GEMM engine.
+template <typename T>
+void trsm_blocked(trsm_side side, bool lower, gemm_op op, bool unit, std::size_t m, std::size_t n,
+                  const T* a, std::size_t lda, T* b, std::size_t ldb)
+{
+    const bool trans = op == gemm_op::transpose;
+    const std::size_t size = side == trsm_side::left ? m : n;
+    const std::size_t blocks = (size + factor_block - 1) / factor_block;
+
+    for (std::size_t step = 0; step < blocks; ++step)
+    {
+        /// Lower op(A) is solved forwards from the left, backwards from the
+        /// right; upper the other way round.
+        const bool forward = (side == trsm_side::left) == lower;
+        const std::size_t block = forward ? step : blocks - 1 - step;
+        const std::size_t k0 = block * factor_block;
+        const std::size_t kb = std::min(factor_block, size - k0);
+        const T* diag = a + k0 * lda + k0;
+
+        /// Rows (left) or columns (right) of B still to be updated.
+        const std::size_t rest0 = forward ? k0 + kb : 0;
+        const std::size_t rest = forward ? size - k0 - kb : k0;
+
+        if (side == trsm_side::left)
+        {
+            trsm_left_unblocked(lower, trans, unit, kb, n, diag, lda, b + k0, ldb);
+            if (rest > 0)
+            {
+                /// B[rest, :] -= op(A)[rest, block] X[block, :]
+                const T* panel = trans ? a + rest0 * lda + k0 : a + k0 * lda + rest0;
+                gemm(op, gemm_op::none, rest, n, kb, T { -1 }, panel, lda, b + k0, ldb, T { 1 }, b + rest0, ldb);
+            }
+        }
+        else
+        {
+            trsm_right_unblocked(lower, trans, unit, m, kb, diag, lda, b + k0 * ldb, ldb);
+            if (rest > 0)
+            {
+                /// B[:, rest] -= X[:, block] op(A)[block, rest]
+                const T* panel = trans ? a + k0 * lda + rest0 : a + rest0 * lda + k0;
+                gemm(gemm_op::none, op, m, rest, kb, T { -1 }, b + k0 * ldb, ldb, panel, lda, T { 1 }, b + rest0 * ldb, ldb);
+            }
+        }
+    }
+}
+
+/// op(A) X = alpha B (left) or X op(A) = alpha B (right) in place of the
+/// m x n matrix B. The solutions of different columns (left) or rows
+/// (right) of B are independent, so large right-hand sides are cut into
+/// slices of factor_block that the OpenMP threads solve concurrently.
+template <typename T>
+void trsm(trsm_side side, triangle uplo, gemm_op op, diagonal diag, std::size_t m, std::size_t n,
+          T alpha, const T* a, std::size_t lda, T* b, std::size_t ldb)
+{
+    if (alpha != T { 1 })
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                b[j * ldb + i] *= alpha;
+            }
+        }
+    }
+
+    /// With transposition a lower triangle acts as an upper one.
+    const bool lower = (uplo == triangle::lower) != (op == gemm_op::transpose);
+    const bool unit = diag == diagonal::unit;
+    const std::size_t order = side == trsm_side::left ? m : n;
+    const std::size_t independent = side == trsm_side::left ? n : m;
+    const std::size_t slices = (independent + factor_block - 1) / factor_block;
+
+    #pragma omp parallel for schedule(dynamic, 1) if (slices > 1 && order * order * independent >= gemm_parallel_threshold)
+    for (std::size_t slice = 0; slice < slices; ++slice)
+    {
+        const std::size_t first = slice * factor_block;
+        const std::size_t count = std::min(factor_block, independent - first);
+        if (side == trsm_side::left)
+        {
+            trsm_blocked(side, lower, op, unit, m, count, a, lda, b + first * ldb, ldb);
+        }
+        else
+        {
+            trsm_blocked(side, lower, op, unit, count, n, a, lda, b + first, ldb);
+        }
+    }
+}
+
+/// Unblocked LU with partial pivoting of the panel of columns [k0, k0 + kb)
+/// and rows [k0, m); row swaps are applied within the panel only. Returns
+/// 1 + the index of the first zero pivot, or 0.
+template <typename T>
+std::size_t lu_panel(std::size_t m, std::size_t k0, std::size_t kb, T* a, std::size_t lda, std::size_t* ipiv) noexcept
+{
+    std::size_t info = 0;
+    for (std::size_t c = k0; c < k0 + kb; ++c)
+    {
+        T* column = a + c * lda;
+        std::size_t pivot = c;
+        for (std::size_t i = c + 1; i < m; ++i)
+        {
+            if (std::abs(column[i]) > std::abs(column[pivot]))
+            {
+                pivot = i;
+            }
+        }
+        ipiv[c] = pivot;
+        if (pivot != c)
+        {
+            for (std::size_t j = k0; j < k0 + kb; ++j)
+            {
+                std::swap(a[j * lda + c], a[j * lda + pivot]);
+            }
+        }
+
+        if (column[c] == T {})
+        {
+            info = info == 0 ? c + 1 : info;
+            continue;
+        }
+        const T inverse = T { 1 } / column[c];
+        for (std::size_t i = c + 1; i < m; ++i)
+        {
+            column[i] *= inverse;
+        }
+        for (std::size_t j = c + 1; j < k0 + kb; ++j)
+        {
+            T* target = a + j * lda;
+            const T factor = target[c];
+            for (std::size_t i = c + 1; i < m; ++i)
+            {
+                target[i] -= column[i] * factor;
+            }
+        }
+    }
+    return info;
+}
+
+/// Right-looking blocked LU with partial pivoting of the column-major
+/// m x n matrix A, in place: A = P L U with unit lower L. ipiv receives
+/// min(m, n) row indices, row i having been swapped with row ipiv[i].
+/// Returns 1 + the index of the first zero pivot, or 0.
+///
+/// Every panel factorisation and every update of one column block by one
+/// panel is an OpenMP task; dependencies on the column blocks let the next
+/// panel start as soon as its own block is updated, while the rest of the
+/// trailing matrix is still being updated (look-ahead).
+template <typename T>
+std::size_t lu_factor(std::size_t m, std::size_t n, T* a, std::size_t lda, std::size_t* ipiv)
+{
+    const std::size_t panels = (std::min(m, n) + factor_block - 1) / factor_block;
+    const std::size_t blocks = (n + factor_block - 1) / factor_block;
+    std::vector<char> dependencies(blocks + 1);
+    char* dep = dependencies.data();
+    std::size_t info = 0;
+
+    #pragma omp parallel if (m * n * std::min(m, n) >= gemm_parallel_threshold)
+    #pragma omp single
+    for (std::size_t k = 0; k < panels; ++k)
+    {
+        const std::size_t k0 = k * factor_block;
+        const std::size_t kb = std::min(factor_block, std::min(m, n) - k0);
+
+        #pragma omp task default(shared) firstprivate(k0, kb) depend(inout: dep[k])
+        {
+            const std::size_t panel_info = lu_panel(m, k0, kb, a, lda, ipiv);
+            if (info == 0 && panel_info != 0)
+            {
+                info = panel_info;
+            }
+
+            /// With m < n the last panel ends inside its column block; the
+            /// rest of that block still needs the swaps and the triangular
+            /// solve. No rows remain below the panel to update.
+            const std::size_t tail = std::min(n, k0 + factor_block) - (k0 + kb);
+            if (tail != 0)
+            {
+                T* rest = a + (k0 + kb) * lda;
+                swap_rows(rest, lda, tail, k0, k0 + kb, ipiv);
+                trsm_left_unblocked(true, false, true, kb, tail, a + k0 * lda + k0, lda, rest + k0, lda);
+            }
+        }
+
+        for (std::size_t j = 0; j < blocks; ++j)
+        {
+            if (j == k)
+            {
+                continue;
+            }
+            #pragma omp task default(shared) firstprivate(j, k, k0, kb) depend(in: dep[k]) depend(inout: dep[j])
+            {
+                const std::size_t j0 = j * factor_block;
+                const std::size_t jb = std::min(factor_block, n - j0);
+                T* block = a + j0 * lda;
+                swap_rows(block, lda, jb, k0, k0 + kb, ipiv);
+                if (j > k)
+                {
+                    trsm_left_unblocked(true, false, true, kb, jb, a + k0 * lda + k0, lda, block + k0, lda);
+                    if (m > k0 + kb)
+                    {
+                        gemm(gemm_op::none, gemm_op::none, m - k0 - kb, jb, kb, T { -1 },
+                             a + k0 * lda + k0 + kb, lda, block + k0, lda, T { 1 }, block + k0 + kb, lda);
+                    }
+                }
+            }
+        }
+    }
+    return info;
+}
+
+/// Unblocked Cholesky of the kb x kb diagonal block at d (lower).
+/// Returns 1 + the local index of the first non-positive pivot, or 0.
+template <typename T>
+std::size_t cholesky_block(std::size_t kb, T* d, std::size_t lda) noexcept
+{
+    for (std::size_t j = 0; j < kb; ++j)
+    {
+        T* column = d + j * lda;
+        if (!(column[j] > T {}))
+        {
+            return j + 1;
+        }
+        column[j] = std::sqrt(column[j]);
+        const T inverse = T { 1 } / column[j];
+        for (std::size_t i = j + 1; i < kb; ++i)
+        {
+            column[i] *= inverse;
+        }
+        for (std::size_t c = j + 1; c < kb; ++c)
+        {
+            T* target = d + c * lda;
+            const T factor = column[c];
+            for (std::size_t i = c; i < kb; ++i)
+            {
+                target[i] -= column[i] * factor;
+            }
+        }
+    }
+    return 0;
+}
+
+/// Right-looking blocked Cholesky of the symmetric positive definite n x n
+/// matrix A, in place: A = L L^T with L in the lower triangle; the strict
+/// upper triangle is not touched. Returns 1 + the index of the first
+/// non-positive pivot, or 0. Tasks and dependencies as in lu_factor().
+template <typename T>
+std::size_t cholesky_factor(std::size_t n, T* a, std::size_t lda)
+{
+    const std::size_t blocks = (n + factor_block - 1) / factor_block;
+    std::vector<char> dependencies(blocks + 1);
+    char* dep = dependencies.data();
+    std::atomic<std::size_t> info { 0 };
+
+    #pragma omp parallel if (n * n * n >= gemm_parallel_threshold)
+    #pragma omp single
+    for (std::size_t k = 0; k < blocks; ++k)
+    {
+        const std::size_t k0 = k * factor_block;
+        const std::size_t kb = std::min(factor_block, n - k0);
+
+        #pragma omp task default(shared) firstprivate(k0, kb) depend(inout: dep[k])
+        if (info.load(std::memory_order_relaxed) == 0)
+        {
+            const std::size_t block_info = cholesky_block(kb, a + k0 * lda + k0, lda);
+            if (block_info != 0)
+            {
+                info.store(k0 + block_info, std::memory_order_relaxed);
+            }
+            else if (n > k0 + kb)
+            {
+                /// L21 = A21 L11^-T
+                trsm_right_unblocked(false, true, false, n - k0 - kb, kb, a + k0 * lda + k0, lda, a + k0 * lda + k0 + kb, lda);
+            }
+        }
+
+        for (std::size_t j = k + 1; j < blocks; ++j)
+        {
+            #pragma omp task default(shared) firstprivate(j, k0, kb) depend(in: dep[k]) depend(inout: dep[j])
+            if (info.load(std::memory_order_relaxed) == 0)
+            {
+                const std::size_t j0 = j * factor_block;
+                const std::size_t jb = std::min(factor_block, n - j0);
+                const T* lj = a + k0 * lda + j0;
+
+                /// Lower triangle of A_jj -= L_jk L_jk^T through a scratch block.
+                std::vector<T> product(jb * jb);
+                gemm(gemm_op::none, gemm_op::transpose, jb, jb, kb, T { 1 }, lj, lda, lj, lda, T {}, product.data(), jb);
+                for (std::size_t c = 0; c < jb; ++c)
+                {
+                    T* target = a + (j0 + c) * lda + j0;
+                    for (std::size_t i = c; i < jb; ++i)
+                    {
+                        target[i] -= product[c * jb + i];
+                    }
+                }
+                if (n > j0 + jb)
+                {
+                    gemm(gemm_op::none, gemm_op::transpose, n - j0 - jb, jb, kb, T { -1 },
+                         a + k0 * lda + j0 + jb, lda, lj, lda, T { 1 }, a + j0 * lda + j0 + jb, lda);
+                }
+            }
+        }
+    }
+    return info.load();
+}
+} // namespace detail
+
+/// op(a) x = alpha b (left) or x op(a) = alpha b (right), solved in place
+/// of b. a is square and only its uplo triangle is read.
+template <typename A, typename T>
+void trsm(trsm_side side, triangle uplo, gemm_op op, diagonal diag, T alpha, matrix_view<A> a, matrix_view<T> b)
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T>, "operands must share the element type");
+    assert(a.width() == a.height());
+    assert(a.width() == (side == trsm_side::left ? b.width() : b.height()));
+
+    detail::trsm(side, uplo, op, diag, b.width(), b.height(), alpha, static_cast<const T*>(a.data()), a.stride(),
+                 b.data(), b.stride());
+}
+
+/// LU factorisation with partial pivoting in place of a, with a(x, y) the
+/// element of row x and column y as in multiply(): a = P L U, L unit lower
+/// and U upper, both stored in a. pivots receives the row exchanges.
+/// Returns 0, or 1 + the index of the first zero pivot of a singular a.
+template <typename T>
+std::size_t lu_factor(matrix_view<T> a, std::vector<std::size_t>& pivots)
+{
+    static_assert(std::is_floating_point_v<T>, "lu_factor needs a floating point type");
+
+    pivots.resize(std::min(a.width(), a.height()));
+    return detail::lu_factor(a.width(), a.height(), a.data(), a.stride(), pivots.data());
+}
+
+/// Solves a x = b in place of b (n x nrhs) from the output of lu_factor().
+template <typename A, typename T>
+void lu_solve(matrix_view<A> lu, const std::vector<std::size_t>& pivots, matrix_view<T> b)
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T>, "operands must share the element type");
+    assert(lu.width() == lu.height() && pivots.size() == lu.width());
+    assert(b.width() == lu.width());
+
+    detail::swap_rows(b.data(), b.stride(), b.height(), 0, pivots.size(), pivots.data());
+    trsm(trsm_side::left, triangle::lower, gemm_op::none, diagonal::unit, T { 1 }, lu, b);
+    trsm(trsm_side::left, triangle::upper, gemm_op::none, diagonal::non_unit, T { 1 }, lu, b);
+}
+
+/// Cholesky factorisation in place of the lower triangle of the symmetric
+/// positive definite a: a = L L^T. Returns 0, or 1 + the index of the
+/// first non-positive pivot when a is not positive definite.
+template <typename T>
+std::size_t cholesky_factor(matrix_view<T> a)
+{
+    static_assert(std::is_floating_point_v<T>, "cholesky_factor needs a floating point type");
+    assert(a.width() == a.height());
+
+    return detail::cholesky_factor(a.width(), a.data(), a.stride());
+}
+
+/// Solves a x = b in place of b from the factor of cholesky_factor().
+template <typename A, typename T>
+void cholesky_solve(matrix_view<A> l, matrix_view<T> b)
+{
+    trsm(trsm_side::left, triangle::lower, gemm_op::none, diagonal::non_unit, T { 1 }, l, b);
+    trsm(trsm_side::left, triangle::lower, gemm_op::transpose, diagonal::non_unit, T { 1 }, l, b);
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_SOLVE_HPP
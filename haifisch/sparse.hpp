@@ -0,0 +1,558 @@
+#pragma once
+
+#ifndef HAIFISCH_SPARSE_HPP
+#define HAIFISCH_SPARSE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
+#include "blas.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+/// Compression direction of a sparse_matrix, named after the product
+/// convention in which x is the row index: csr keeps the entries of every
+/// x together, csc those of every y.
+enum class sparse_format
+{
+    csr,
+    csc
+};
+
+/// One (x, y, value) entry, for building a sparse_matrix.
+template <typename T>
+struct sparse_entry
+{
+    std::size_t x;
+    std::size_t y;
+    T value;
+};
+
+namespace detail
+{
+/// Index of the first outer line of thread part `part` out of `parts`,
+/// splitting the stored entries evenly rather than the lines.
+inline std::size_t sparse_split(const std::size_t* offsets, std::size_t outer, std::size_t part, std::size_t parts) noexcept
+{
+    if (part >= parts)
+    {
+        return outer;
+    }
+    const std::size_t target = offsets[outer] / parts * part + offsets[outer] % parts * part / parts;
+    return static_cast<std::size_t>(std::lower_bound(offsets, offsets + outer, target) - offsets);
+}
+
+/// Calls f(first, last) on ranges of outer lines holding about the same
+/// number of entries, one per OpenMP thread when parallel.
+template <typename F>
+void sparse_ranges(const std::size_t* offsets, std::size_t outer, bool parallel, F&& f)
+{
+    if (!parallel)
+    {
+        f(std::size_t { 0 }, outer);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        std::size_t threads = 1;
+        std::size_t thread = 0;
+#ifdef _OPENMP
+        threads = static_cast<std::size_t>(omp_get_num_threads());
+        thread = static_cast<std::size_t>(omp_get_thread_num());
+#endif // _OPENMP
+        const std::size_t first = sparse_split(offsets, outer, thread, threads);
+        const std::size_t last = sparse_split(offsets, outer, thread + 1, threads);
+        if (first < last)
+        {
+            f(first, last);
+        }
+    }
+}
+
+/// out[o] = alpha * sum of v * in[inner] over the entries of line o
+/// + beta * out[o]; out is not read when beta is zero. The lines are
+/// shared among the threads by their entry counts.
+template <typename T>
+void sparse_gather(std::size_t outer, const std::size_t* offsets, const std::uint32_t* indices, const T* values,
+                   T alpha, const T* in, T beta, T* out) noexcept
+{
+    sparse_ranges(offsets, outer, offsets[outer] + outer >= blas_parallel_threshold, [=](std::size_t first, std::size_t last) {
+        for (std::size_t o = first; o < last; ++o)
+        {
+            T sum = {};
+            for (std::size_t e = offsets[o]; e < offsets[o + 1]; ++e)
+            {
+                sum += values[e] * in[indices[e]];
+            }
+            out[o] = beta == T {} ? alpha * sum : alpha * sum + beta * out[o];
+        }
+    });
+}
+
+/// out[inner] = alpha * sum of v * in[o] over the entries of every line o
+/// + beta * out[inner]. Threads scatter into private copies of out that are
+/// added up at the end.
+template <typename T>
+void sparse_scatter(std::size_t outer, std::size_t inner, const std::size_t* offsets, const std::uint32_t* indices,
+                    const T* values, T alpha, const T* in, T beta, T* out)
+{
+    for (std::size_t i = 0; i < inner; ++i)
+    {
+        out[i] = beta == T {} ? T {} : beta * out[i];
+    }
+
+    auto scatter = [=](std::size_t first, std::size_t last, T* dst) {
+        for (std::size_t o = first; o < last; ++o)
+        {
+            const T scaled = alpha * in[o];
+            for (std::size_t e = offsets[o]; e < offsets[o + 1]; ++e)
+            {
+                dst[indices[e]] += values[e] * scaled;
+            }
+        }
+    };
+
+    if (offsets[outer] + outer < blas_parallel_threshold)
+    {
+        scatter(0, outer, out);
+        return;
+    }
+    sparse_ranges(offsets, outer, true, [&](std::size_t first, std::size_t last) {
+        std::vector<T> local(inner);
+        scatter(first, last, local.data());
+        #pragma omp critical
+        for (std::size_t i = 0; i < inner; ++i)
+        {
+            out[i] += local[i];
+        }
+    });
+}
+
+/// Columns of c computed together by the csr product; every entry of a is
+/// then loaded once per four columns.
+constexpr std::size_t spmm_columns = 4;
+} // namespace detail
+
+/// Sparse matrix in compressed sparse row (csr) or column (csc) form.
+///
+/// Dimensions and coordinates follow haifisch::matrix: the matrix is
+/// width() x height(), entries are addressed as (x, y), and products use
+/// the convention of multiply(), x being the row index. offsets() has
+/// outer_size() + 1 elements and line o owns the entries
+/// [offsets()[o], offsets()[o + 1]) of indices() and values(), sorted by
+/// their inner index without duplicates. Zeros of the dense source are not
+/// stored; entries that cancel in a sum are kept.
+template <typename T>
+class sparse_matrix
+{
+public:
+    using value_type = T;
+
+    /// Empty width x height matrix.
+    sparse_matrix(std::size_t width_, std::size_t height_, sparse_format format_ = sparse_format::csr)
+        : cols(width_)
+        , rows(height_)
+        , fmt(format_)
+        , line_offsets(outer_size() + 1, 0)
+    {
+        assert(inner_size() <= std::numeric_limits<std::uint32_t>::max());
+    }
+    /// The nonzero elements of dense, found in two passes over its storage.
+    explicit sparse_matrix(matrix_view<const T> dense, sparse_format format_ = sparse_format::csr)
+        : sparse_matrix(dense.width(), dense.height(), format_)
+    {
+        for (std::size_t y = 0; y < rows; ++y)
+        {
+            for (std::size_t x = 0; x < cols; ++x)
+            {
+                if (dense(x, y) != T {})
+                {
+                    line_offsets[outer_of(x, y) + 1]++;
+                }
+            }
+        }
+        allocate_entries();
+
+        std::vector<std::size_t> next(line_offsets.begin(), line_offsets.end() - 1);
+        for (std::size_t y = 0; y < rows; ++y)
+        {
+            for (std::size_t x = 0; x < cols; ++x)
+            {
+                if (dense(x, y) != T {})
+                {
+                    const std::size_t e = next[outer_of(x, y)]++;
+                    line_indices[e] = static_cast<std::uint32_t>(inner_of(x, y));
+                    line_values[e] = dense(x, y);
+                }
+            }
+        }
+    }
+    /// Entries in any order; the values of repeated coordinates are summed.
+    sparse_matrix(std::size_t width_, std::size_t height_, std::vector<sparse_entry<T>> entries,
+                  sparse_format format_ = sparse_format::csr)
+        : sparse_matrix(width_, height_, format_)
+    {
+        std::sort(entries.begin(), entries.end(), [this](const sparse_entry<T>& lhs, const sparse_entry<T>& rhs) {
+            return std::make_pair(outer_of(lhs.x, lhs.y), inner_of(lhs.x, lhs.y))
+                 < std::make_pair(outer_of(rhs.x, rhs.y), inner_of(rhs.x, rhs.y));
+        });
+
+        line_indices.reserve(entries.size());
+        line_values.reserve(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const sparse_entry<T>& entry = entries[i];
+            assert(entry.x < cols && entry.y < rows);
+            const std::size_t outer = outer_of(entry.x, entry.y);
+            const std::uint32_t inner = static_cast<std::uint32_t>(inner_of(entry.x, entry.y));
+            if (i > 0 && outer_of(entries[i - 1].x, entries[i - 1].y) == outer && line_indices.back() == inner)
+            {
+                line_values.back() += entry.value;
+                continue;
+            }
+            line_indices.push_back(inner);
+            line_values.push_back(entry.value);
+            line_offsets[outer + 1]++;
+        }
+        for (std::size_t o = 0; o < outer_size(); ++o)
+        {
+            line_offsets[o + 1] += line_offsets[o];
+        }
+    }
+
+    [[gnu::always_inline]] inline std::size_t width() const noexcept
+    {
+        return cols;
+    }
+    [[gnu::always_inline]] inline std::size_t height() const noexcept
+    {
+        return rows;
+    }
+    [[gnu::always_inline]] inline sparse_format format() const noexcept
+    {
+        return fmt;
+    }
+    [[gnu::always_inline]] inline std::size_t nonzeros() const noexcept
+    {
+        return line_values.size();
+    }
+    /// Number of compressed lines: width() for csr, height() for csc.
+    [[gnu::always_inline]] inline std::size_t outer_size() const noexcept
+    {
+        return fmt == sparse_format::csr ? cols : rows;
+    }
+    [[gnu::always_inline]] inline std::size_t inner_size() const noexcept
+    {
+        return fmt == sparse_format::csr ? rows : cols;
+    }
+    [[gnu::always_inline]] inline const std::size_t* offsets() const noexcept
+    {
+        return line_offsets.data();
+    }
+    [[gnu::always_inline]] inline const std::uint32_t* indices() const noexcept
+    {
+        return line_indices.data();
+    }
+    [[gnu::always_inline]] inline const T* values() const noexcept
+    {
+        return line_values.data();
+    }
+
+    /// Element (x, y), zero when not stored; a binary search in its line.
+    T operator () (std::size_t x, std::size_t y) const noexcept
+    {
+        assert(x < cols && y < rows);
+        const std::size_t outer = outer_of(x, y);
+        const std::uint32_t* first = line_indices.data() + line_offsets[outer];
+        const std::uint32_t* last = line_indices.data() + line_offsets[outer + 1];
+        const std::uint32_t* found = std::lower_bound(first, last, static_cast<std::uint32_t>(inner_of(x, y)));
+        return found != last && *found == inner_of(x, y) ? line_values[found - line_indices.data()] : T {};
+    }
+
+    /// Writes the matrix into dense, which must have its shape.
+    void to_dense(matrix_view<T> dense) const noexcept
+    {
+        assert(dense.width() == cols && dense.height() == rows);
+
+        dense.fill(T {});
+        for (std::size_t o = 0; o < outer_size(); ++o)
+        {
+            for (std::size_t e = line_offsets[o]; e < line_offsets[o + 1]; ++e)
+            {
+                if (fmt == sparse_format::csr)
+                {
+                    dense(o, line_indices[e]) = line_values[e];
+                }
+                else
+                {
+                    dense(line_indices[e], o) = line_values[e];
+                }
+            }
+        }
+    }
+
+    /// The same matrix in the other format, by a counting sort of the
+    /// entries on their inner index.
+    sparse_matrix converted(sparse_format format_) const
+    {
+        if (format_ == fmt)
+        {
+            return *this;
+        }
+
+        sparse_matrix result(cols, rows, format_);
+        for (std::uint32_t inner : line_indices)
+        {
+            result.line_offsets[inner + 1]++;
+        }
+        result.allocate_entries();
+
+        std::vector<std::size_t> next(result.line_offsets.begin(), result.line_offsets.end() - 1);
+        for (std::size_t o = 0; o < outer_size(); ++o)
+        {
+            for (std::size_t e = line_offsets[o]; e < line_offsets[o + 1]; ++e)
+            {
+                const std::size_t slot = next[line_indices[e]]++;
+                result.line_indices[slot] = static_cast<std::uint32_t>(o);
+                result.line_values[slot] = line_values[e];
+            }
+        }
+        return result;
+    }
+
+    /// The transpose shares the arrays of *this with the other format.
+    sparse_matrix transposed() const
+    {
+        sparse_matrix result = *this;
+        std::swap(result.cols, result.rows);
+        result.fmt = fmt == sparse_format::csr ? sparse_format::csc : sparse_format::csr;
+        return result;
+    }
+
+    sparse_matrix& operator *= (const T& scalar) noexcept
+    {
+        for (T& value : line_values)
+        {
+            value *= scalar;
+        }
+        return *this;
+    }
+
+    bool operator == (const sparse_matrix& other) const noexcept
+    {
+        return cols == other.cols && rows == other.rows && fmt == other.fmt && line_offsets == other.line_offsets
+            && line_indices == other.line_indices && line_values == other.line_values;
+    }
+    bool operator != (const sparse_matrix& other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+    /// lhs + scale * rhs over the union of both patterns, in the format of
+    /// lhs. Counts every merged line, then fills the lines in parallel.
+    static sparse_matrix add(const sparse_matrix& lhs, const sparse_matrix& rhs_any, T scale)
+    {
+        assert(lhs.cols == rhs_any.cols && lhs.rows == rhs_any.rows);
+
+        std::optional<sparse_matrix> conversion;
+        if (rhs_any.fmt != lhs.fmt)
+        {
+            conversion = rhs_any.converted(lhs.fmt);
+        }
+        const sparse_matrix& rhs = conversion ? *conversion : rhs_any;
+        sparse_matrix result(lhs.cols, lhs.rows, lhs.fmt);
+        const std::size_t outer = lhs.outer_size();
+        const bool parallel = lhs.nonzeros() + rhs.nonzeros() + outer >= detail::blas_parallel_threshold;
+
+        auto merge = [&](std::size_t o, auto&& emit) {
+            std::size_t i = lhs.line_offsets[o];
+            std::size_t j = rhs.line_offsets[o];
+            const std::size_t i_end = lhs.line_offsets[o + 1];
+            const std::size_t j_end = rhs.line_offsets[o + 1];
+            while (i < i_end || j < j_end)
+            {
+                if (j == j_end || (i < i_end && lhs.line_indices[i] < rhs.line_indices[j]))
+                {
+                    emit(lhs.line_indices[i], lhs.line_values[i]);
+                    ++i;
+                }
+                else if (i == i_end || rhs.line_indices[j] < lhs.line_indices[i])
+                {
+                    emit(rhs.line_indices[j], scale * rhs.line_values[j]);
+                    ++j;
+                }
+                else
+                {
+                    emit(lhs.line_indices[i], lhs.line_values[i] + scale * rhs.line_values[j]);
+                    ++i;
+                    ++j;
+                }
+            }
+        };
+
+        #pragma omp parallel for schedule(dynamic, 256) if (parallel)
+        for (std::size_t o = 0; o < outer; ++o)
+        {
+            std::size_t count = 0;
+            merge(o, [&count](std::uint32_t, T) { count++; });
+            result.line_offsets[o + 1] = count;
+        }
+        result.allocate_entries();
+
+        #pragma omp parallel for schedule(dynamic, 256) if (parallel)
+        for (std::size_t o = 0; o < outer; ++o)
+        {
+            std::size_t e = result.line_offsets[o];
+            merge(o, [&result, &e](std::uint32_t index, T value) {
+                result.line_indices[e] = index;
+                result.line_values[e] = value;
+                e++;
+            });
+        }
+        return result;
+    }
+
+private:
+    [[gnu::always_inline]] inline std::size_t outer_of(std::size_t x, std::size_t y) const noexcept
+    {
+        return fmt == sparse_format::csr ? x : y;
+    }
+    [[gnu::always_inline]] inline std::size_t inner_of(std::size_t x, std::size_t y) const noexcept
+    {
+        return fmt == sparse_format::csr ? y : x;
+    }
+
+    /// Turns per-line counts in line_offsets[o + 1] into offsets and sizes
+    /// the entry arrays.
+    void allocate_entries()
+    {
+        for (std::size_t o = 0; o < outer_size(); ++o)
+        {
+            line_offsets[o + 1] += line_offsets[o];
+        }
+        line_indices.resize(line_offsets.back());
+        line_values.resize(line_offsets.back());
+    }
+
+    std::size_t cols;
+    std::size_t rows;
+    sparse_format fmt;
+    std::vector<std::size_t> line_offsets;
+    std::vector<std::uint32_t> line_indices;
+    std::vector<T> line_values;
+};
+
+template <typename T>
+sparse_matrix<T> operator + (const sparse_matrix<T>& lhs, const sparse_matrix<T>& rhs)
+{
+    return sparse_matrix<T>::add(lhs, rhs, T { 1 });
+}
+
+template <typename T>
+sparse_matrix<T> operator - (const sparse_matrix<T>& lhs, const sparse_matrix<T>& rhs)
+{
+    return sparse_matrix<T>::add(lhs, rhs, T { -1 });
+}
+
+/// c = a * b + beta * c for sparse a and dense b and c, in the sense of
+/// multiply(). c is not read when beta is zero.
+///
+/// csr: every thread takes the lines of a holding an even share of its
+/// entries and computes their elements of c, four columns of c per pass.
+/// csc: the columns of c are shared among the threads; each is the sum of
+/// the lines of a scaled by the matching column of b.
+template <typename T, typename B>
+void multiply(const sparse_matrix<T>& a, matrix_view<B> b, matrix_view<T> c, T beta = T {})
+{
+    static_assert(std::is_same_v<std::remove_const_t<B>, T>, "operands must share the element type");
+    assert(a.height() == b.width());
+    assert(c.width() == a.width());
+    assert(c.height() == b.height());
+
+    const std::size_t n = b.height();
+    const std::size_t* offsets = a.offsets();
+    const std::uint32_t* indices = a.indices();
+    const T* values = a.values();
+    const bool parallel = (a.nonzeros() + a.outer_size()) * n >= detail::blas_parallel_threshold;
+
+    if (a.format() == sparse_format::csr)
+    {
+        constexpr std::size_t J = detail::spmm_columns;
+        detail::sparse_ranges(offsets, a.outer_size(), parallel, [&](std::size_t first, std::size_t last) {
+            std::size_t y0 = 0;
+            for (; y0 + J <= n; y0 += J)
+            {
+                for (std::size_t x = first; x < last; ++x)
+                {
+                    T sum[J] = {};
+                    for (std::size_t e = offsets[x]; e < offsets[x + 1]; ++e)
+                    {
+                        for (std::size_t j = 0; j < J; ++j)
+                        {
+                            sum[j] += values[e] * b(indices[e], y0 + j);
+                        }
+                    }
+                    for (std::size_t j = 0; j < J; ++j)
+                    {
+                        T& dst = c(x, y0 + j);
+                        dst = beta == T {} ? sum[j] : sum[j] + beta * dst;
+                    }
+                }
+            }
+            for (; y0 < n; ++y0)
+            {
+                for (std::size_t x = first; x < last; ++x)
+                {
+                    T sum = {};
+                    for (std::size_t e = offsets[x]; e < offsets[x + 1]; ++e)
+                    {
+                        sum += values[e] * b(indices[e], y0);
+                    }
+                    T& dst = c(x, y0);
+                    dst = beta == T {} ? sum : sum + beta * dst;
+                }
+            }
+        });
+        return;
+    }
+
+    detail::parallel_ranges(n, 1, parallel, [&](std::size_t first, std::size_t last) {
+        for (std::size_t y = first; y < last; ++y)
+        {
+            T* column = c.at_pointer(0, y);
+            for (std::size_t x = 0; x < c.width(); ++x)
+            {
+                column[x] = beta == T {} ? T {} : beta * column[x];
+            }
+            for (std::size_t p = 0; p < a.outer_size(); ++p)
+            {
+                const T scale = b(p, y);
+                if (scale == T {})
+                {
+                    continue;
+                }
+                for (std::size_t e = offsets[p]; e < offsets[p + 1]; ++e)
+                {
+                    column[indices[e]] += values[e] * scale;
+                }
+            }
+        }
+    });
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_SPARSE_HPP
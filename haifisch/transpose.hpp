@@ -0,0 +1,326 @@
+#pragma once
+
+#ifndef HAIFISCH_TRANSPOSE_HPP
+#define HAIFISCH_TRANSPOSE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "profile.hpp"
+#include "simd.hpp"
+#include "view.hpp"
+
+
+namespace haifisch
+{
+namespace detail
+{
+/// Side, in elements, of the cache blocks handed to one kernel call. Two
+/// 64 x 64 blocks of double fit in L2 together with their tiles.
+constexpr std::size_t transpose_block = 64;
+
+/// Transposes below this many elements do not open a parallel region.
+constexpr std::size_t transpose_parallel_threshold = 1 << 16;
+
+/// Side of the register tiles of one ISA level: one vector register per
+/// tile row, at most 4 x 4. Wider tiles touch twice as many pages per tile
+/// and measured slower once the matrix no longer fits in the TLB reach.
+/// Types that cannot live in a vector register use 1 x 1 tiles.
+template <typename T, simd::isa Level>
+constexpr std::size_t transpose_lanes = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && sizeof(T) <= 8
+                                      ? std::min<std::size_t>(simd::register_bytes(Level) / sizeof(T), 4)
+                                      : 1;
+
+/// Exchanges the upper right S x S sub-blocks of every 2S x 2S block of the
+/// rows lo and hi = lo + S with the lower left ones.
+template <std::size_t S, typename V, std::size_t... I>
+[[gnu::always_inline]] inline void transpose_exchange(V& lo, V& hi, std::index_sequence<I...>) noexcept
+{
+    constexpr std::size_t W = sizeof...(I);
+    const V new_lo = __builtin_shufflevector(lo, hi, ((I & S) ? W + I - S : I)...);
+    const V new_hi = __builtin_shufflevector(lo, hi, ((I & S) ? W + I : I + S)...);
+    lo = new_lo;
+    hi = new_hi;
+}
+
+/// log2(W) exchange stages turn W rows into W columns. The W / 2 row pairs
+/// of a stage are expanded from a pack so the rows stay in registers.
+template <std::size_t S, typename V, std::size_t W, std::size_t... P>
+[[gnu::always_inline]] inline void transpose_stage(V (&rows)[W], std::index_sequence<P...> pairs) noexcept
+{
+    (transpose_exchange<S>(rows[P / S * 2 * S + P % S], rows[P / S * 2 * S + P % S + S], std::make_index_sequence<W> {}), ...);
+    if constexpr (S > 1)
+    {
+        transpose_stage<S / 2>(rows, pairs);
+    }
+}
+
+/// dst(y, x) = src(x, y) for one W x W tile held in W registers. The whole
+/// tile is loaded before anything is stored, so src may equal dst.
+template <typename T, std::size_t W, std::size_t... I>
+[[gnu::always_inline]] inline void transpose_tile(const T* src, std::size_t lds, T* dst, std::size_t ldd, std::index_sequence<I...>) noexcept
+{
+    using vec_t = typename simd::simd_vector<T, W>::type;
+
+    vec_t rows[W];
+    (std::memcpy(&rows[I], src + I * lds, sizeof(vec_t)), ...);
+    transpose_stage<W / 2>(rows, std::make_index_sequence<W / 2> {});
+    (std::memcpy(dst + I * ldd, &rows[I], sizeof(vec_t)), ...);
+}
+
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void transpose_tile(const T* src, std::size_t lds, T* dst, std::size_t ldd) noexcept
+{
+    if constexpr (W == 1)
+    {
+        *dst = *src;
+    }
+    else
+    {
+        transpose_tile<T, W>(src, lds, dst, ldd, std::make_index_sequence<W> {});
+    }
+}
+
+/// Exchanges the tile at a with the transpose of the tile at b.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void transpose_swap_tile(T* a, T* b, std::size_t ld) noexcept
+{
+    T tile[W * W];
+    transpose_tile<T, W>(a, ld, tile, W);
+    transpose_tile<T, W>(b, ld, a, ld);
+    for (std::size_t i = 0; i < W; ++i)
+    {
+        std::memcpy(b + i * ld, tile + i * W, W * sizeof(T));
+    }
+}
+
+enum class transpose_mode
+{
+    copy,
+    swap,
+    square
+};
+
+/// Transposes one cache block with W x W register tiles and scalar edges.
+///
+/// copy:   b(y, x) = a(x, y) for the w x h block a.
+/// swap:   a(x, y) and b(y, x) trade places, a being w x h and b h x w.
+/// square: a (w x w) is transposed in place, b is unused.
+template <typename T, std::size_t W>
+[[gnu::always_inline]] inline void transpose_body(transpose_mode mode, T* a, std::size_t lda, T* b, std::size_t ldb,
+                                                  std::size_t w, std::size_t h) noexcept
+{
+    const std::size_t w_tiles = w - w % W;
+    const std::size_t h_tiles = h - h % W;
+
+    switch (mode)
+    {
+        case transpose_mode::copy:
+            /// Consecutive tiles fill the same lines of b.
+            for (std::size_t x = 0; x < w_tiles; x += W)
+            {
+                for (std::size_t y = 0; y < h_tiles; y += W)
+                {
+                    transpose_tile<T, W>(a + y * lda + x, lda, b + x * ldb + y, ldb);
+                }
+            }
+            for (std::size_t y = 0; y < h; ++y)
+            {
+                for (std::size_t x = y < h_tiles ? w_tiles : 0; x < w; ++x)
+                {
+                    b[x * ldb + y] = a[y * lda + x];
+                }
+            }
+            break;
+
+        case transpose_mode::swap:
+            for (std::size_t y = 0; y < h_tiles; y += W)
+            {
+                for (std::size_t x = 0; x < w_tiles; x += W)
+                {
+                    transpose_swap_tile<T, W>(a + y * lda + x, b + x * ldb + y, lda);
+                }
+            }
+            for (std::size_t y = 0; y < h; ++y)
+            {
+                for (std::size_t x = y < h_tiles ? w_tiles : 0; x < w; ++x)
+                {
+                    std::swap(a[y * lda + x], b[x * ldb + y]);
+                }
+            }
+            break;
+
+        case transpose_mode::square:
+            for (std::size_t y = 0; y < w_tiles; y += W)
+            {
+                transpose_tile<T, W>(a + y * lda + y, lda, a + y * lda + y, lda);
+                for (std::size_t x = y + W; x < w_tiles; x += W)
+                {
+                    transpose_swap_tile<T, W>(a + y * lda + x, a + x * lda + y, lda);
+                }
+            }
+            for (std::size_t y = w_tiles; y < w; ++y)
+            {
+                for (std::size_t x = 0; x < y; ++x)
+                {
+                    std::swap(a[y * lda + x], a[x * lda + y]);
+                }
+            }
+            break;
+    }
+}
+
+template <typename T>
+using transpose_kernel_t = void (*)(transpose_mode, T*, std::size_t, T*, std::size_t, std::size_t, std::size_t) noexcept;
+
+template <typename T>
+void transpose_generic(transpose_mode mode, T* a, std::size_t lda, T* b, std::size_t ldb, std::size_t w, std::size_t h) noexcept
+{
+    transpose_body<T, transpose_lanes<T, simd::isa::generic>>(mode, a, lda, b, ldb, w, h);
+}
+
+#ifdef HAIFISCH_X86
+template <typename T>
+[[gnu::target("avx2,fma")]]
+void transpose_avx2(transpose_mode mode, T* a, std::size_t lda, T* b, std::size_t ldb, std::size_t w, std::size_t h) noexcept
+{
+    transpose_body<T, transpose_lanes<T, simd::isa::avx2>>(mode, a, lda, b, ldb, w, h);
+}
+#endif // HAIFISCH_X86
+
+/// Kernel of the active ISA level. The baseline build already targets
+/// SSE2, so the generic kernel doubles as the SSE2 one, and 4 x 4 tiles
+/// never need more than a ymm register, so AVX-512 hosts run the AVX2 one.
+template <typename T>
+transpose_kernel_t<T> transpose_kernel() noexcept
+{
+#ifdef HAIFISCH_X86
+    if (simd::active_isa() >= simd::isa::avx2)
+    {
+        return transpose_avx2<T>;
+    }
+#endif // HAIFISCH_X86
+    return transpose_generic<T>;
+}
+
+/// dst(y, x) = src(x, y) for the w x h matrix src. The cache blocks are
+/// shared among the OpenMP threads.
+template <typename T>
+void transpose(const T* src, std::size_t lds, T* dst, std::size_t ldd, std::size_t w, std::size_t h) noexcept
+{
+    const transpose_kernel_t<T> kernel = transpose_kernel<T>();
+    const std::size_t x_blocks = (w + transpose_block - 1) / transpose_block;
+    const std::size_t y_blocks = (h + transpose_block - 1) / transpose_block;
+    T* a = const_cast<T*>(src);
+
+    HAIFISCH_PROFILE_TEAM(team);
+    #pragma omp parallel if (w * h >= transpose_parallel_threshold)
+    {
+        HAIFISCH_PROFILE_MEMBER(team);
+        #pragma omp for collapse(2) schedule(static)
+        for (std::size_t by = 0; by < y_blocks; ++by)
+        {
+            for (std::size_t bx = 0; bx < x_blocks; ++bx)
+            {
+                const std::size_t x = bx * transpose_block;
+                const std::size_t y = by * transpose_block;
+                kernel(transpose_mode::copy, a + y * lds + x, lds, dst + x * ldd + y, ldd,
+                       std::min(transpose_block, w - x), std::min(transpose_block, h - y));
+            }
+        }
+    }
+}
+
+/// Transposes the n x n matrix a in place: diagonal blocks are transposed
+/// within themselves and every other block trades places with its mirror.
+template <typename T>
+void transpose_square(T* a, std::size_t ld, std::size_t n) noexcept
+{
+    const transpose_kernel_t<T> kernel = transpose_kernel<T>();
+    const std::size_t blocks = (n + transpose_block - 1) / transpose_block;
+
+    HAIFISCH_PROFILE_TEAM(team);
+    #pragma omp parallel if (n * n >= transpose_parallel_threshold)
+    {
+        HAIFISCH_PROFILE_MEMBER(team);
+        #pragma omp for schedule(dynamic, 1)
+        for (std::size_t by = 0; by < blocks; ++by)
+        {
+            const std::size_t y = by * transpose_block;
+            const std::size_t h = std::min(transpose_block, n - y);
+            kernel(transpose_mode::square, a + y * ld + y, ld, nullptr, 0, h, h);
+
+            for (std::size_t x = y + transpose_block; x < n; x += transpose_block)
+            {
+                const std::size_t w = std::min(transpose_block, n - x);
+                kernel(transpose_mode::swap, a + y * ld + x, ld, a + x * ld + y, ld, w, h);
+            }
+        }
+    }
+}
+
+/// Transposes the contiguous w x h matrix a in place by cycle following:
+/// element y * w + x moves to x * h + y, i.e. index i goes to i * h mod
+/// (w * h - 1). Only a bit per element marks the visited ones.
+template <typename T>
+void transpose_cycles(T* a, std::size_t w, std::size_t h)
+{
+    const std::size_t size = w * h;
+    if (size < 3)
+    {
+        return;
+    }
+
+    const std::size_t modulus = size - 1;
+    std::vector<bool> visited(size);
+
+    for (std::size_t start = 1; start < modulus; ++start)
+    {
+        if (visited[start])
+        {
+            continue;
+        }
+
+        T carried = a[start];
+        std::size_t index = start;
+        do
+        {
+            const std::size_t next = static_cast<std::size_t>(static_cast<unsigned __int128>(index) * h % modulus);
+            std::swap(a[next], carried);
+            visited[next] = true;
+            index = next;
+        }
+        while (index != start);
+    }
+}
+} // namespace detail
+
+/// dst(y, x) = src(x, y). dst must be src.height() x src.width() and must
+/// not overlap src.
+template <typename S, typename T>
+void transpose(matrix_view<S> src, matrix_view<T> dst) noexcept
+{
+    static_assert(std::is_same_v<std::remove_const_t<S>, T>, "operands must share the element type");
+    assert(dst.width() == src.height());
+    assert(dst.height() == src.width());
+
+    detail::transpose(static_cast<const T*>(src.data()), src.stride(), dst.data(), dst.stride(), src.width(), src.height());
+}
+
+/// Transposes a square view in place.
+template <typename T>
+void transpose(matrix_view<T> square) noexcept
+{
+    static_assert(!std::is_const_v<T>, "cannot transpose a read-only view in place");
+    assert(square.width() == square.height());
+
+    detail::transpose_square(square.data(), square.stride(), square.width());
+}
+} // namespace haifisch
+
+#endif // HAIFISCH_TRANSPOSE_HPP
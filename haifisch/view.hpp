@@ -0,0 +1,273 @@
+#pragma once
+
+#ifndef HAIFISCH_VIEW_HPP
+#define HAIFISCH_VIEW_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "gemm.hpp"
+#include "simd.hpp"
+
+
+namespace haifisch
+{
+/// Non-owning window onto a block of matrix storage.
+///
+/// Element (x, y) lives at data[y * stride + x], like in haifisch::matrix,
+/// so a view of a whole matrix has stride == width and every block of it
+/// keeps the stride of its parent. Views are cheap to copy and never
+/// allocate; the viewed storage must outlive them. Use matrix_view<const T>
+/// for read-only access.
+template <typename T>
+class matrix_view
+{
+public:
+    using value_type = std::remove_const_t<T>;
+
+    constexpr matrix_view() noexcept = default;
+    constexpr matrix_view(T* data_, std::size_t cols_, std::size_t rows_, std::size_t stride_) noexcept
+        : ptr(data_)
+        , cols(cols_)
+        , rows(rows_)
+        , ld(stride_)
+    {
+        assert(rows < 2 || stride_ >= cols_);
+    }
+    constexpr matrix_view(T* data_, std::size_t cols_, std::size_t rows_) noexcept
+        : matrix_view(data_, cols_, rows_, cols_)
+    { }
+    /// matrix_view<T> converts to matrix_view<const T>.
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    constexpr matrix_view(const matrix_view<U>& other) noexcept
+        : matrix_view(other.data(), other.width(), other.height(), other.stride())
+    { }
+
+    [[gnu::always_inline]] inline constexpr std::size_t width() const noexcept
+    {
+        return cols;
+    }
+    [[gnu::always_inline]] inline constexpr std::size_t height() const noexcept
+    {
+        return rows;
+    }
+    /// Distance in elements between (x, y) and (x, y + 1).
+    [[gnu::always_inline]] inline constexpr std::size_t stride() const noexcept
+    {
+        return ld;
+    }
+    [[gnu::always_inline]] inline constexpr T* data() const noexcept
+    {
+        return ptr;
+    }
+    [[gnu::always_inline]] inline constexpr bool contiguous() const noexcept
+    {
+        return ld == cols || rows < 2;
+    }
+    [[gnu::always_inline]] inline constexpr T* at_pointer(std::size_t x, std::size_t y) const noexcept
+    {
+        return ptr + (ld * y + x);
+    }
+    [[gnu::always_inline]] inline constexpr T& at(std::size_t x, std::size_t y) const
+    {
+        assert(x < cols);
+        assert(y < rows);
+
+        return ptr[ld * y + x];
+    }
+    [[gnu::always_inline]] inline constexpr T& operator () (std::size_t x, std::size_t y) const noexcept
+    {
+        return at(x, y);
+    }
+
+    /// The w x h block whose first element is (x, y).
+    [[gnu::always_inline]] inline constexpr matrix_view block(std::size_t x, std::size_t y, std::size_t w, std::size_t h) const noexcept
+    {
+        assert(x + w <= cols);
+        assert(y + h <= rows);
+
+        return matrix_view(ptr + (ld * y + x), w, h, ld);
+    }
+    /// All elements (x, y) for one y, as a width x 1 view.
+    [[gnu::always_inline]] inline constexpr matrix_view row(std::size_t y) const noexcept
+    {
+        return block(0, y, cols, 1);
+    }
+    /// All elements (x, y) for one x, as a 1 x height view.
+    [[gnu::always_inline]] inline constexpr matrix_view column(std::size_t x) const noexcept
+    {
+        return block(x, 0, 1, rows);
+    }
+
+    void fill(value_type value) const noexcept
+    {
+        static_assert(!std::is_const_v<T>, "cannot fill a read-only view");
+        for_each_line([value](T* dst, std::size_t n) {
+            simd::elementwise<value_type>(simd::elementwise_op::fill, dst, nullptr, value, n);
+        });
+    }
+    /// Copies src, which must have the shape of *this, into the view.
+    void assign(matrix_view<const value_type> src) const noexcept
+    {
+        static_assert(!std::is_const_v<T>, "cannot assign to a read-only view");
+        assert(cols == src.width());
+        assert(rows == src.height());
+
+        const value_type* first = src.data();
+        for_each_line([&first, &src](T* dst, std::size_t n) {
+            std::memcpy(dst, first, n * sizeof(T));
+            first += src.stride();
+        }, src.contiguous());
+    }
+    const matrix_view& operator += (matrix_view<const value_type> rhs) const noexcept
+    {
+        update(simd::elementwise_op::add, rhs);
+        return *this;
+    }
+    const matrix_view& operator -= (matrix_view<const value_type> rhs) const noexcept
+    {
+        update(simd::elementwise_op::sub, rhs);
+        return *this;
+    }
+    const matrix_view& operator *= (value_type value) const noexcept
+    {
+        static_assert(!std::is_const_v<T>, "cannot scale a read-only view");
+        for_each_line([value](T* dst, std::size_t n) {
+            simd::elementwise<value_type>(simd::elementwise_op::scale, dst, nullptr, value, n);
+        });
+        return *this;
+    }
+
+private:
+    /// Calls f(line, n) over the storage of the view: once for the whole
+    /// block when it and the other operand are contiguous, else per y.
+    template <typename F>
+    [[gnu::always_inline]] inline void for_each_line(F&& f, bool other_contiguous = true) const
+    {
+        if (contiguous() && other_contiguous)
+        {
+            f(ptr, cols * rows);
+            return;
+        }
+        for (std::size_t y = 0; y < rows; ++y)
+        {
+            f(ptr + y * ld, cols);
+        }
+    }
+
+    void update(simd::elementwise_op op, matrix_view<const value_type> rhs) const noexcept
+    {
+        static_assert(!std::is_const_v<T>, "cannot update a read-only view");
+        assert(cols == rhs.width());
+        assert(rows == rhs.height());
+
+        const value_type* first = rhs.data();
+        for_each_line([op, &first, &rhs](T* dst, std::size_t n) {
+            simd::elementwise<value_type>(op, dst, first, value_type {}, n);
+            first += rhs.stride();
+        }, rhs.contiguous());
+    }
+
+    T* ptr = nullptr;
+    std::size_t cols = 0;
+    std::size_t rows = 0;
+    std::size_t ld = 0;
+};
+
+/// c = a * b + beta * c through the GEMM engine, with c(x, y) the sum over
+/// i of a(x, i) * b(i, y). c is not read when beta is zero. The packed
+/// panels go to workspace when given, which must hold
+/// detail::gemm_workspace<T>(c.width(), c.height(), a.height()) elements.
+template <typename A, typename B, typename T>
+void multiply(matrix_view<A> a, matrix_view<B> b, matrix_view<T> c, T beta = T {}, T* workspace = nullptr)
+{
+    static_assert(std::is_same_v<std::remove_const_t<A>, T> && std::is_same_v<std::remove_const_t<B>, T>,
+                  "operands must share the element type");
+    assert(a.height() == b.width());
+    assert(c.width() == a.width());
+    assert(c.height() == b.height());
+
+    detail::gemm(a.width(), b.height(), a.height(),
+                 static_cast<const T*>(a.data()), a.stride(),
+                 static_cast<const T*>(b.data()), b.stride(),
+                 c.data(), c.stride(), beta, workspace);
+}
+
+/// c = alpha * op(a) * op(b) + beta * c, with op(a) m x k, op(b) k x n and
+/// c m x n in the sense of multiply(). Transposed operands are read in
+/// place, and alpha and beta are applied when the tiles of c are written
+/// back. c is not read when beta is zero. a and b may also be bfloat16 or
+/// float16 for a float c; they are widened while packing and the product
+/// accumulates in float.
+template <typename A, typename B, typename T>
+void gemm(T alpha, gemm_op op_a, matrix_view<A> a, gemm_op op_b, matrix_view<B> b, T beta, matrix_view<T> c)
+{
+    using a_type = std::remove_const_t<A>;
+    using b_type = std::remove_const_t<B>;
+    static_assert((std::is_same_v<a_type, T> || (std::is_same_v<T, float> && is_half_v<a_type>)) &&
+                  (std::is_same_v<b_type, T> || (std::is_same_v<T, float> && is_half_v<b_type>)),
+                  "operands must share the element type, or be half precision for a float product");
+    const std::size_t m = op_a == gemm_op::none ? a.width() : a.height();
+    const std::size_t k = op_a == gemm_op::none ? a.height() : a.width();
+    const std::size_t n = op_b == gemm_op::none ? b.height() : b.width();
+    assert(k == (op_b == gemm_op::none ? b.width() : b.height()));
+    assert(c.width() == m);
+    assert(c.height() == n);
+
+    detail::gemm(op_a, op_b, m, n, k, alpha,
+                 static_cast<const a_type*>(a.data()), a.stride(),
+                 static_cast<const b_type*>(b.data()), b.stride(),
+                 beta, c.data(), c.stride());
+}
+
+/// c = alpha * op(a) * op(b) + beta * c with a half-precision c. The
+/// product accumulates in a float copy of c that is rounded to nearest
+/// even once at the end; c is only widened when beta is not zero.
+template <typename A, typename B, typename H, typename = std::enable_if_t<is_half_v<H>>>
+void gemm(float alpha, gemm_op op_a, matrix_view<A> a, gemm_op op_b, matrix_view<B> b, float beta, matrix_view<H> c)
+{
+    const std::size_t m = c.width();
+    const std::size_t n = c.height();
+    detail::aligned_buffer<float> product(m * n);
+    for (std::size_t y = 0; y < n && beta != 0.0f; ++y)
+    {
+        detail::convert_elements(&c(0, y), m, product.get() + y * m);
+    }
+
+    gemm(alpha, op_a, a, op_b, b, beta, matrix_view<float>(product.get(), m, n, m));
+
+    for (std::size_t y = 0; y < n; ++y)
+    {
+        detail::convert_elements(static_cast<const float*>(product.get() + y * m), m, &c(0, y));
+    }
+}
+
+/// c = alpha * a * b + beta * c
+template <typename A, typename B, typename T>
+void gemm(T alpha, matrix_view<A> a, matrix_view<B> b, T beta, matrix_view<T> c)
+{
+    gemm(alpha, gemm_op::none, a, gemm_op::none, b, beta, c);
+}
+
+namespace detail
+{
+/// dst = x op y for three views of one shape, op being add or sub.
+template <typename T>
+void combine(matrix_view<T> dst, matrix_view<const T> x, matrix_view<const T> y, simd::elementwise_op op) noexcept
+{
+    dst.assign(x);
+    if (op == simd::elementwise_op::sub)
+    {
+        dst -= y;
+    }
+    else
+    {
+        dst += y;
+    }
+}
+} // namespace detail
+} // namespace haifisch
+
+#endif // HAIFISCH_VIEW_HPP
@@ -1,4 +1,3 @@
-#include <chrono>
 #include <gtest/gtest.h>
 #include <numeric>
 #include <random>
@@ -11,11 +10,15 @@
 
 using namespace haifisch;
 
+/// The comparisons below check results against uBLAS and print a rough
+/// timing; haifisch_bench is the tool for real measurements.
+const bench::options sampling { 1, 3 };
+
 template <typename T>
 void debug_info(std::string_view label, const matrix<T>& rhs) noexcept
 {
-    logger(logflag::debug) << label << " capacity:   " << rhs.width() * rhs.height();
-    logger(logflag::debug) << label << " memory:     " << ((rhs.width() * rhs.height()) * sizeof (T)) / 1024.0 / 1024.0 << " MiB.";
+    HAIFISCH_LOG(logflag::debug) << label << " capacity:   " << rhs.width() * rhs.height();
+    HAIFISCH_LOG(logflag::debug) << label << " memory:     " << ((rhs.width() * rhs.height()) * sizeof (T)) / 1024.0 / 1024.0 << " MiB.";
 }
 
 template <typename T>
@@ -88,19 +91,13 @@ void test_matrix_transpose(std::size_t mat_x, std::size_t mat_y)
 
     debug_info("transpose mat", mat);
 
-    auto start = std::chrono::high_resolution_clock::now();
-
-    mat = transpose(mat);
-
-    auto timeSpent = std::chrono::high_resolution_clock::now() - start;
-    std::cout << "daz matrix transpose: " << mat.width() << "x" << mat.height() << "   -> " << "\033[0;31m" << std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent).count() << " s." << "\033[0;0m" << std::endl;
-
-    auto start2 = std::chrono::high_resolution_clock::now();
-
-    boost_transpose_mat = boost::numeric::ublas::trans(boost_mat);
+    matrix<T> transposed(mat_y, mat_x);
+    const bench::statistics stats = bench::measure(sampling, [&] { transpose(mat.view(), transposed.view()); });
+    mat = std::move(transposed);
+    std::cout << "daz matrix transpose: " << mat.width() << "x" << mat.height() << "   -> " << "\033[0;31m" << stats << "\033[0;0m" << std::endl;
 
-    auto timeSpent2 = std::chrono::high_resolution_clock::now() - start2;
-    std::cout << "boost matrix transpose: " << boost_transpose_mat.size1() << "x" << boost_transpose_mat.size2() << " -> " << "\033[0;31m" << std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent2).count() << " s." << "\033[0;0m"  << std::endl;
+    const bench::statistics boost_stats = bench::measure(sampling, [&] { boost_transpose_mat = boost::numeric::ublas::trans(boost_mat); });
+    std::cout << "boost matrix transpose: " << boost_transpose_mat.size1() << "x" << boost_transpose_mat.size2() << " -> " << "\033[0;31m" << boost_stats << "\033[0;0m"  << std::endl;
 
     std::vector<T> mat_v;
     std::vector<T> boost_v;
@@ -178,9 +175,9 @@ void test_multiplication()
     float_mat *= float_mat;
     double_mat *= double_mat;
 
-    logger(logflag::debug | logflag::yellow | logflag::spaces) << "int mat    " << int_mat    (0, 0);
-    logger(logflag::debug | logflag::yellow | logflag::spaces) << "float mat  " << float_mat  (0, 0);
-    logger(logflag::debug | logflag::yellow | logflag::spaces) << "double mat " << double_mat (0, 0);
+    HAIFISCH_LOG(logflag::debug | logflag::yellow | logflag::spaces) << "int mat    " << int_mat    (0, 0);
+    HAIFISCH_LOG(logflag::debug | logflag::yellow | logflag::spaces) << "float mat  " << float_mat  (0, 0);
+    HAIFISCH_LOG(logflag::debug | logflag::yellow | logflag::spaces) << "double mat " << double_mat (0, 0);
 }
 
 
@@ -237,19 +234,11 @@ void boost_ublas_test_mul(std::size_t mat_x, std::size_t mat_y)
 
     debug_info("mult_mat", mult_mat);
 
-    auto start = std::chrono::high_resolution_clock::now();
-
-    mult_mat = mat * mat_data;
-
-    auto timeSpent = std::chrono::high_resolution_clock::now() - start;
-    std::cout << "daz matrix: " << mult_mat.width() << "x" << mult_mat.height() << "   -> " << "\033[0;31m" << std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent).count() << " s." << "\033[0;0m" << std::endl;
-
-    auto start2 = std::chrono::high_resolution_clock::now();
-
-    boost_mult_mat = boost::numeric::ublas::prod(boost_mat, boost_mat_data);
+    const bench::statistics stats = bench::measure(sampling, [&] { mult_mat = mat * mat_data; });
+    std::cout << "daz matrix: " << mult_mat.width() << "x" << mult_mat.height() << "   -> " << "\033[0;31m" << stats << "\033[0;0m" << std::endl;
 
-    auto timeSpent2 = std::chrono::high_resolution_clock::now() - start2;
-    std::cout << "boost matrix: " << boost_mult_mat.size1() << "x" << boost_mult_mat.size2() << " -> " << "\033[0;31m" << std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent2).count() << " s." << "\033[0;0m"  << std::endl;
+    const bench::statistics boost_stats = bench::measure(sampling, [&] { boost_mult_mat = boost::numeric::ublas::prod(boost_mat, boost_mat_data); });
+    std::cout << "boost matrix: " << boost_mult_mat.size1() << "x" << boost_mult_mat.size2() << " -> " << "\033[0;31m" << boost_stats << "\033[0;0m"  << std::endl;
 
     std::vector<T> mat_v;
     std::vector<T> boost_v;
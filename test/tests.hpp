@@ -2,11 +2,23 @@
 
 #define matrix_num_threads 8
 
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <boost/numeric/ublas/matrix.hpp>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
 
 #include "matrix.hpp"
+#include "../util/func_benchmark.hpp"
+#include "../util/logger.hpp"
 
 
 using namespace haifisch;
@@ -168,34 +180,1140 @@ bool test_different_mul(const std::size_t size = 256)
     return true;
 }
 
+template <typename T>
+bool test_rect_mul(const std::size_t m, const std::size_t k, const std::size_t n)
+{
+    matrix<T> lhs(m, k);
+    matrix<T> rhs(k, n);
+    boost::numeric::ublas::matrix<T> boost_lhs(m, k);
+    boost::numeric::ublas::matrix<T> boost_rhs(k, n);
+
+    for (std::size_t i = 0; i < m; i++)
+    {
+        for (std::size_t j = 0; j < k; j++)
+        {
+            lhs(i, j) = boost_lhs(i, j) = static_cast<T>((i * 7 + j * 3) % 11) - 5;
+        }
+    }
+    for (std::size_t i = 0; i < k; i++)
+    {
+        for (std::size_t j = 0; j < n; j++)
+        {
+            rhs(i, j) = boost_rhs(i, j) = static_cast<T>((i * 5 + j * 2) % 13) - 6;
+        }
+    }
+
+    matrix<T> res = lhs * rhs;
+    boost::numeric::ublas::matrix<T> boost_res = boost::numeric::ublas::prod(boost_lhs, boost_rhs);
+
+    if (res.width() != boost_res.size1()) return false;
+    if (res.height() != boost_res.size2()) return false;
+
+    for (std::size_t i = 0; i < m; i++)
+    {
+        for (std::size_t j = 0; j < n; j++)
+        {
+            if (res(i, j) != boost_res(i, j))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+template <typename T>
+bool test_strassen(const std::size_t m, const std::size_t k, const std::size_t n,
+                   const std::size_t cutoff, const std::size_t task_depth = 0)
+{
+    matrix<T> lhs(m, k);
+    matrix<T> rhs(k, n);
+    for (std::size_t i = 0; i < m; i++)
+    {
+        for (std::size_t j = 0; j < k; j++)
+        {
+            lhs(i, j) = static_cast<T>((i * 7 + j * 3) % 11) - 5;
+        }
+    }
+    for (std::size_t i = 0; i < k; i++)
+    {
+        for (std::size_t j = 0; j < n; j++)
+        {
+            rhs(i, j) = static_cast<T>((i * 5 + j * 2) % 13) - 6;
+        }
+    }
+
+    strassen_mul_impl<T> strassen(cutoff, task_depth);
+    blocked_mul_impl<T> blocked;
+    return strassen.process(lhs, rhs) == blocked.process(lhs, rhs);
+}
+
+template <typename T>
+bool test_expression(const std::size_t cols, const std::size_t rows)
+{
+    matrix<T> a(cols, rows);
+    matrix<T> b(cols, rows);
+    matrix<T> c(cols, rows);
+    a.fill(10);
+    b.fill(4);
+    c.fill(2);
+
+    matrix<T> res = ((a + b) - c) * 3 - 2 * c + a / 5;
+    matrix<T> control(cols, rows);
+    control.fill(34);
+    if (res != control) return false;
+
+    res += a - b;
+    res -= -c;
+    control.fill(42);
+    if (!(res == control)) return false;
+
+    res = res - res;
+    control.fill(0);
+    return res == control && (a + b) == (b + a);
+}
+
+template <typename T>
+bool test_expression_product(const std::size_t cols, const std::size_t rows)
+{
+    matrix<T> a(cols, rows);
+    matrix<T> b(cols, rows);
+    matrix<T> c(rows, cols);
+    for (std::size_t i = 0; i < cols * rows; ++i)
+    {
+        a.data()[i] = static_cast<T>(i % 7);
+        b.data()[i] = static_cast<T>(i % 5);
+        c.data()[i] = static_cast<T>(i % 3);
+    }
+
+    const matrix<T> sum = a + b;
+    const matrix<T> difference = c - c * 2;
+    const matrix<T> product = sum * c;
+    if ((a + b) * c != product) return false;
+    if (sum * (c - c * 2) != sum * difference) return false;
+    if ((a + b) * (c - c * 2) != sum * difference) return false;
+
+    return transpose(a + b) == transpose(sum);
+}
+
+template <typename T>
+bool test_view(const std::size_t cols, const std::size_t rows)
+{
+    matrix<T> mat(cols, rows);
+    mat.fill(1);
+
+    const std::size_t w = cols / 2;
+    const std::size_t h = rows / 3;
+    matrix_view<T> inner = mat.block(cols / 4, rows / 3, w, h);
+    inner.fill(5);
+    inner *= 2;
+    inner.row(0).fill(3);
+    inner -= mat.block(0, 0, w, h);
+
+    for (std::size_t y = 0; y < rows; ++y)
+    {
+        for (std::size_t x = 0; x < cols; ++x)
+        {
+            const bool in_block = x >= cols / 4 && x < cols / 4 + w && y >= rows / 3 && y < rows / 3 + h;
+            const T expected = !in_block ? 1 : (y == rows / 3 ? 2 : 9);
+            if (mat(x, y) != expected) return false;
+        }
+    }
+
+    /// A product of blocks must match the product of their copies.
+    matrix<T> lhs(cols, rows);
+    matrix<T> rhs(rows, cols);
+    for (std::size_t i = 0; i < cols * rows; ++i)
+    {
+        lhs.data()[i] = static_cast<T>(i % 7);
+        rhs.data()[i] = static_cast<T>(i % 5);
+    }
+    matrix<T> lhs_copy(w, h);
+    matrix<T> rhs_copy(h, w);
+    lhs_copy.view().assign(lhs.block(1, 2, w, h));
+    rhs_copy.view().assign(rhs.block(2, 1, h, w));
+
+    matrix<T> out(cols, cols);
+    out.fill(0);
+    multiply(lhs.block(1, 2, w, h), rhs.block(2, 1, h, w), out.block(1, 1, w, w));
+    blocked_mul_impl<T> blocked;
+    matrix<T> control = blocked.process(lhs_copy, rhs_copy);
+
+    matrix<T> result(w, w);
+    result.view().assign(out.block(1, 1, w, w));
+    if (result != control) return false;
+
+    matrix<T> transposed(h, w);
+    transpose(lhs.block(1, 2, w, h), transposed.view());
+    return transposed == transpose(lhs_copy);
+}
+
+template <typename T, typename Allocator>
+bool test_allocator(const std::size_t cols, const std::size_t rows, const std::size_t alignment)
+{
+    matrix<T, Allocator> mat(cols, rows);
+    if (reinterpret_cast<std::uintptr_t>(mat.data()) % alignment != 0) return false;
+
+    mat.fill(3);
+    matrix<T, Allocator> copy = mat;
+    matrix<T, Allocator> moved = std::move(copy);
+    vector<T, Allocator> vec(cols);
+    vec[cols - 1] = 2;
+    return moved == mat && vec[cols - 1] == 2;
+}
+
+template <typename T>
+bool test_pool(const std::size_t size)
+{
+    const pool_statistics before = pool_stats();
+    for (int i = 0; i < 100; ++i)
+    {
+        matrix<T> lhs(size, size);
+        lhs.fill(1);
+        matrix<T> rhs = transpose(lhs) * 2 + lhs;
+        if (rhs(0, 0) != 3) return false;
+    }
+
+    /// Blocks allocated here and freed on other threads find their way back.
+    std::vector<matrix<T>*> handed_over;
+    for (int i = 0; i < 16; ++i)
+    {
+        handed_over.push_back(new matrix<T>(size, size));
+    }
+    std::thread consumer([&handed_over] {
+        for (matrix<T>* mat : handed_over)
+        {
+            delete mat;
+        }
+    });
+    consumer.join();
+    for (int i = 0; i < 16; ++i)
+    {
+        matrix<T> reused(size, size);
+    }
+
+    const pool_statistics after = pool_stats();
+    return after.hits - before.hits >= 100 && after.remote_frees - before.remote_frees >= 16;
+}
+
 template <typename T>
 bool test_transpose(const std::size_t cols, const std::size_t rows, const T value)
 {
-    matrix<T> template_mat(cols, rows);
-    template_mat.fill(value);
-    matrix<T> transpose_control(rows, cols);
-    transpose_control.fill(value);
-    template_mat.transpose();
-    return template_mat == transpose_control;
+    matrix<T> template_mat(cols, rows);
+    template_mat.fill(value);
+    matrix<T> transpose_control(rows, cols);
+    transpose_control.fill(value);
+    template_mat.transpose();
+    return template_mat == transpose_control;
+}
+
+template <typename T>
+bool test_transpose_values(const std::size_t cols, const std::size_t rows)
+{
+    matrix<T> mat(cols, rows);
+    for (std::size_t y = 0; y < rows; ++y)
+    {
+        for (std::size_t x = 0; x < cols; ++x)
+        {
+            mat(x, y) = static_cast<T>(y * cols + x);
+        }
+    }
+
+    matrix<T> copied = transpose(mat);
+    matrix<T> in_place = mat;
+    in_place.transpose();
+    if (copied != in_place) return false;
+    if (copied.width() != rows || copied.height() != cols) return false;
+
+    for (std::size_t y = 0; y < cols; ++y)
+    {
+        for (std::size_t x = 0; x < rows; ++x)
+        {
+            if (copied(x, y) != mat(y, x)) return false;
+        }
+    }
+
+    /// Round trip of an in-place transposed square block of a larger matrix.
+    const std::size_t side = std::min(cols, rows) - 1;
+    matrix<T> twice = mat;
+    transpose(twice.block(1, 0, side, side));
+    transpose(twice.block(1, 0, side, side));
+    return twice == mat;
+}
+
+template <typename T>
+bool test_vec_mul(const std::size_t size)
+{
+    matrix<T> template_mat(size, size);
+    vector<T> template_vec(size);
+
+    template_mat.fill(10);
+
+    for (std::size_t i = 0; i < size; i++)
+    {
+        template_vec.at(i) = i;
+    }
+
+    vector<T> res_vec = template_mat *= template_vec;
+    const T expected = static_cast<T>(10 * (size * (size - 1) / 2));
+    for (std::size_t i = 0; i < size; i++)
+    {
+        if (res_vec[i] != expected) return false;
+    }
+    return true;
+}
+
+/// gemv and gemv_t against plain loops over a strided block.
+template <typename T>
+bool test_gemv(const std::size_t m, const std::size_t n)
+{
+    matrix<T> mat(m + 3, n + 1);
+    for (std::size_t i = 0; i < (m + 3) * (n + 1); ++i)
+    {
+        mat.data()[i] = static_cast<T>(i % 11) - 5;
+    }
+    const matrix_view<T> a = mat.block(2, 1, m, n);
+
+    vector<T> x(n);
+    vector<T> xt(m);
+    for (std::size_t j = 0; j < n; ++j) x[j] = static_cast<T>(j % 7);
+    for (std::size_t i = 0; i < m; ++i) xt[i] = static_cast<T>(i % 5) - 2;
+
+    vector<T> y(m);
+    vector<T> yt(n);
+    y.fill(1);
+    yt.fill(2);
+    gemv(T { 2 }, a, x, T { 3 }, y);
+    gemv_t(T { 1 }, a, xt, T { -1 }, yt);
+
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        T sum = {};
+        for (std::size_t j = 0; j < n; ++j) sum += a(i, j) * x[j];
+        if (y[i] != 2 * sum + 3) return false;
+    }
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        T sum = {};
+        for (std::size_t i = 0; i < m; ++i) sum += a(i, j) * xt[i];
+        if (yt[j] != sum - 2) return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool test_blas1(const std::size_t size)
+{
+    vector<T> x(size);
+    vector<T> y(size);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        x[i] = static_cast<T>(i % 3);
+        y[i] = static_cast<T>(1);
+    }
+
+    vector<T> copied = x;
+    scal(T { 2 }, copied);
+    axpy(T { 3 }, copied, y);
+
+    T expected_dot = {};
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (y[i] != 1 + 6 * x[i]) return false;
+        expected_dot += x[i] * y[i];
+    }
+
+    vector<T> moved = std::move(copied);
+    return dot(x, y) == expected_dot && moved.size() == size && copied.size() == 0;
+}
+
+template <typename T>
+bool test_batched(const std::size_t count, const std::size_t m, const std::size_t k, const std::size_t n, const bool shared_b)
+{
+    const std::size_t ld = m + 1;
+    std::vector<T> a(count * ld * k);
+    std::vector<T> b((shared_b ? 1 : count) * k * n);
+    std::vector<T> c(count * ld * n, T { 1 });
+    for (std::size_t i = 0; i < a.size(); ++i) a[i] = static_cast<T>(i % 7) - 3;
+    for (std::size_t i = 0; i < b.size(); ++i) b[i] = static_cast<T>(i % 5) - 2;
+
+    const matrix_batch<const T> a_batch(a.data(), m, k, count, ld, ld * k);
+    const matrix_batch<const T> b_batch(b.data(), k, n, count, k, shared_b ? 0 : k * n);
+    const matrix_batch<T> c_batch(c.data(), m, n, count, ld, ld * n);
+    batched_multiply(a_batch, b_batch, c_batch, T { 2 });
+
+    for (std::size_t e = 0; e < count; ++e)
+    {
+        for (std::size_t y = 0; y < n; ++y)
+        {
+            for (std::size_t x = 0; x < m; ++x)
+            {
+                T sum = {};
+                for (std::size_t p = 0; p < k; ++p) sum += a_batch[e](x, p) * b_batch[e](p, y);
+                if (c_batch[e](x, y) != sum + 2) return false;
+            }
+            if (c[e * ld * n + y * ld + m] != 1) return false;
+        }
+    }
+    return true;
+}
+
+template <typename T, std::size_t R, std::size_t K, std::size_t C>
+bool test_fixed()
+{
+    matrix<T> lhs(R, K);
+    matrix<T> rhs(K, C);
+    for (std::size_t i = 0; i < R * K; ++i) lhs.data()[i] = static_cast<T>((i * 7) % 11) - 5;
+    for (std::size_t i = 0; i < K * C; ++i) rhs.data()[i] = static_cast<T>((i * 5) % 13) - 6;
+
+    const fixed_matrix<T, R, K> a(lhs.view());
+    const fixed_matrix<T, K, C> b(rhs.view());
+    const matrix<T> product(fixed_matrix<T, R, C>(a * b).view());
+    if (product != lhs * rhs) return false;
+
+    const fixed_matrix<T, K, R> at = transpose(a);
+    for (std::size_t i = 0; i < R; ++i)
+    {
+        for (std::size_t j = 0; j < K; ++j)
+        {
+            if (at(j, i) != lhs(i, j)) return false;
+        }
+    }
+    return a + a - a == a && -a * T { 2 } == a * T { -2 };
+}
+
+template <typename T, std::size_t N>
+bool test_fixed_inverse()
+{
+    fixed_matrix<T, N, N> a = fixed_matrix<T, N, N>::identity() * static_cast<T>(N);
+    for (std::size_t i = 0; i < N; ++i)
+    {
+        for (std::size_t j = 0; j < N; ++j)
+        {
+            a(i, j) += static_cast<T>((i * 3 + j * 5) % 7) / 4;
+        }
+    }
+
+    const fixed_matrix<T, N, N> residual = a * inverse(a) - fixed_matrix<T, N, N>::identity();
+    for (std::size_t i = 0; i < N * N; ++i)
+    {
+        if (std::abs(residual.data()[i]) > 1e-4) return false;
+    }
+    return std::abs(determinant(a) * determinant(inverse(a)) - 1) < 1e-4;
+}
+
+template <typename T>
+bool test_gemm(const std::size_t m, const std::size_t k, const std::size_t n, const gemm_op op_a, const gemm_op op_b)
+{
+    const bool ta = op_a == gemm_op::transpose;
+    const bool tb = op_b == gemm_op::transpose;
+    matrix<T> a(ta ? k : m, ta ? m : k);
+    matrix<T> b(tb ? n : k, tb ? k : n);
+    matrix<T> c(m + 2, n);
+    for (std::size_t i = 0; i < a.width() * a.height(); ++i) a.data()[i] = static_cast<T>((i * 7) % 11) - 5;
+    for (std::size_t i = 0; i < b.width() * b.height(); ++i) b.data()[i] = static_cast<T>((i * 5) % 13) - 6;
+    c.fill(3);
+
+    const matrix_view<T> dst = c.block(1, 0, m, n);
+    gemm(T { 2 }, op_a, matrix_view<const T>(a.view()), op_b, matrix_view<const T>(b.view()), T { -1 }, dst);
+
+    for (std::size_t y = 0; y < n; ++y)
+    {
+        for (std::size_t x = 0; x < m; ++x)
+        {
+            T sum = {};
+            for (std::size_t p = 0; p < k; ++p)
+            {
+                sum += (ta ? a(p, x) : a(x, p)) * (tb ? b(y, p) : b(p, y));
+            }
+            if (dst(x, y) != 2 * sum - 3) return false;
+        }
+        if (c(0, y) != 3 || c(m + 1, y) != 3) return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool test_mapped(const std::size_t width, const std::size_t height)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "haifisch_mapped_test.bin").string();
+
+    matrix<T> source(width + 3, height);
+    for (std::size_t i = 0; i < (width + 3) * height; ++i) source.data()[i] = static_cast<T>(i % 101);
+    const matrix_view<T> block = source.block(1, 0, width, height);
+    save_matrix(path, block);
+
+    bool equal = true;
+    {
+        const mapped_matrix<T> mapped(path);
+        equal = mapped.width() == width && mapped.height() == height && matrix<T>(mapped.view()) == matrix<T>(block);
+
+        mapped_matrix<T> cow(path, map_mode::copy_on_write);
+        cow.mutable_view()(0, 0) = T { 7 };
+        equal = equal && mapped.view()(0, 0) == block(0, 0) && cow.view()(0, 0) == T { 7 };
+    }
+    {
+        mapped_matrix<T> created = mapped_matrix<T>::create(path, height, width);
+        transpose(matrix_view<const T>(block), created.mutable_view());
+        created.sync();
+    }
+    {
+        const mapped_matrix<T> reopened(path);
+        equal = equal && reopened.view()(height - 1, 0) == block(0, height - 1);
+    }
+
+    std::remove(path.c_str());
+    return equal;
+}
+
+template <typename T>
+bool test_out_of_core(const std::size_t m, const std::size_t k, const std::size_t n)
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string a_path = (dir / "haifisch_ooc_a.bin").string();
+    const std::string b_path = (dir / "haifisch_ooc_b.bin").string();
+    const std::string c_path = (dir / "haifisch_ooc_c.bin").string();
+
+    matrix<T> a(m, k);
+    matrix<T> b(k, n);
+    for (std::size_t i = 0; i < m * k; ++i) a.data()[i] = static_cast<T>((i * 7) % 11) - 5;
+    for (std::size_t i = 0; i < k * n; ++i) b.data()[i] = static_cast<T>((i * 5) % 13) - 6;
+    save_matrix(a_path, a.view());
+    save_matrix(b_path, b.view());
+
+    matrix<T> expected(m, n);
+    multiply(a.view(), b.view(), expected.view());
+
+    /// A budget of 64 x 64 tiles forces many steps.
+    const std::size_t budget = 5 * 64 * 64 * sizeof(T);
+    bool equal = true;
+    {
+        const mapped_matrix<T> a_file(a_path);
+        const mapped_matrix<T> b_file(b_path);
+        const mapped_matrix<T> c_file = mapped_matrix<T>::create(c_path, m, n);
+        out_of_core_multiply(a_file, b_file, c_file, budget);
+        equal = matrix<T>(c_file.view()) == expected;
+    }
+
+    matrix<T> c(m, n);
+    c.fill(1);
+    out_of_core_multiply(a.view(), b.view(), c.view(), T { 2 }, budget);
+    for (std::size_t i = 0; i < m * n; ++i)
+    {
+        equal = equal && c.data()[i] == expected.data()[i] + 2;
+    }
+
+    std::remove(a_path.c_str());
+    std::remove(b_path.c_str());
+    std::remove(c_path.c_str());
+    return equal;
+}
+
+template <typename T>
+bool test_sparse(const std::size_t width, const std::size_t height, const sparse_format format)
+{
+    matrix<T> dense(width, height);
+    matrix<T> other(width, height);
+    for (std::size_t i = 0; i < width * height; ++i)
+    {
+        dense.data()[i] = i % 7 == 0 ? static_cast<T>(i % 5) + 1 : T {};
+        other.data()[i] = i % 3 == 0 ? static_cast<T>(i % 4) - 2 : T {};
+    }
+
+    const sparse_matrix<T> a(matrix_view<const T>(dense.view()), format);
+    const sparse_matrix<T> b(matrix_view<const T>(other.view()), format == sparse_format::csr ? sparse_format::csc : sparse_format::csr);
+    if (matrix<T>(a) != dense || a(3, 1) != dense(3, 1)) return false;
+    if (a.converted(sparse_format::csr).converted(sparse_format::csc).converted(format) != a) return false;
+    if (matrix<T>(a.transposed()) != transpose(dense)) return false;
+    if (matrix<T>(a + b) != dense + other || matrix<T>(a - b) != dense - other) return false;
+
+    vector<T> x(height);
+    vector<T> xt(width);
+    for (std::size_t i = 0; i < height; ++i) x[i] = static_cast<T>(i % 9) - 4;
+    for (std::size_t i = 0; i < width; ++i) xt[i] = static_cast<T>(i % 6) - 3;
+    if (a * x != dense * x) return false;
+
+    vector<T> yt(height);
+    vector<T> expected_t(height);
+    yt.fill(1);
+    expected_t.fill(1);
+    gemv_t(T { 2 }, a, xt, T { 3 }, yt);
+    gemv_t(T { 2 }, matrix_view<const T>(dense.view()), xt, T { 3 }, expected_t);
+    if (yt != expected_t) return false;
+
+    matrix<T> rhs(height, 7);
+    for (std::size_t i = 0; i < height * 7; ++i) rhs.data()[i] = static_cast<T>(i % 11) - 5;
+    if (a * rhs != dense * rhs) return false;
+
+    std::vector<sparse_entry<T>> entries = { { 1, 2, T { 4 } }, { 0, 0, T { 1 } }, { 1, 2, T { 5 } } };
+    const sparse_matrix<T> built(width, height, entries, format);
+    return built.nonzeros() == 2 && built(1, 2) == T { 9 } && built(0, 0) == T { 1 } && built(2, 2) == T {};
+}
+
+template <typename T>
+bool near(matrix_view<const T> x, matrix_view<const T> y, const T tolerance)
+{
+    for (std::size_t j = 0; j < x.height(); ++j)
+    {
+        for (std::size_t i = 0; i < x.width(); ++i)
+        {
+            if (std::abs(x(i, j) - y(i, j)) > tolerance * (1 + std::abs(y(i, j)))) return false;
+        }
+    }
+    return true;
+}
+
+/// Pseudo-random values in [-1, 1) that do not depend on the library.
+template <typename T>
+void fill_random(matrix<T>& m, std::size_t seed)
+{
+    for (std::size_t i = 0; i < m.width() * m.height(); ++i)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        m.data()[i] = static_cast<T>(static_cast<double>(seed >> 11) / static_cast<double>(1ull << 52) - 1);
+    }
+}
+
+template <typename T>
+bool test_trsm(const std::size_t n, const std::size_t nrhs, const T tolerance)
+{
+    matrix<T> a(n, n);
+    fill_random(a, n);
+    for (std::size_t i = 0; i < n; ++i) a(i, i) += static_cast<T>(n);
+
+    for (const trsm_side side : { trsm_side::left, trsm_side::right })
+    {
+        for (const triangle uplo : { triangle::lower, triangle::upper })
+        {
+            for (const gemm_op op : { gemm_op::none, gemm_op::transpose })
+            {
+                /// op(tri) with the other triangle zeroed, multiplied into b.
+                matrix<T> tri(n, n);
+                for (std::size_t j = 0; j < n; ++j)
+                {
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        const bool kept = uplo == triangle::lower ? i >= j : i <= j;
+                        tri(i, j) = kept ? a(i, j) : T {};
+                    }
+                }
+                matrix<T> x = side == trsm_side::left ? matrix<T>(n, nrhs) : matrix<T>(nrhs, n);
+                fill_random(x, nrhs);
+                matrix<T> b(x.width(), x.height());
+                if (side == trsm_side::left) gemm(T { 2 }, op, tri, gemm_op::none, x, T {}, b);
+                else gemm(T { 2 }, gemm_op::none, x, op, tri, T {}, b);
+
+                trsm(side, uplo, op, diagonal::non_unit, T { 0.5 }, a, b);
+                if (!near(matrix_view<const T>(b.view()), matrix_view<const T>(x.view()), tolerance)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename T>
+bool test_lu(const std::size_t n, const std::size_t nrhs, const T tolerance)
+{
+    matrix<T> a(n, n);
+    fill_random(a, n + 1);
+    matrix<T> x(n, nrhs);
+    fill_random(x, nrhs);
+    matrix<T> b = a * x;
+
+    matrix<T> lu = a;
+    std::vector<std::size_t> pivots;
+    if (lu_factor(lu, pivots) != 0) return false;
+    lu_solve(lu, pivots, b);
+    if (!near(matrix_view<const T>(b.view()), matrix_view<const T>(x.view()), tolerance)) return false;
+
+    vector<T> column(n);
+    vector<T> y(n);
+    for (std::size_t i = 0; i < n; ++i) column[i] = x(i, 0);
+    gemv(T { 1 }, matrix_view<const T>(a.view()), column, T {}, y);
+    lu_solve(lu, pivots, y);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (std::abs(y[i] - column[i]) > tolerance * (1 + std::abs(column[i]))) return false;
+    }
+
+    /// Two equal rows: the last pivot vanishes.
+    matrix<T> singular(3, 3);
+    for (std::size_t j = 0; j < 3; ++j)
+    {
+        singular(0, j) = static_cast<T>(j + 1);
+        singular(1, j) = static_cast<T>(2 * j + 1);
+        singular(2, j) = static_cast<T>(j + 1);
+    }
+    return lu_factor(singular, pivots) == 3;
+}
+
+/// Factors an m x n a and compares P L U with a.
+template <typename T>
+bool test_lu_rect(const std::size_t m, const std::size_t n, const T tolerance)
+{
+    matrix<T> a(m, n);
+    fill_random(a, m + n);
+
+    matrix<T> lu = a;
+    std::vector<std::size_t> pivots;
+    if (lu_factor(lu, pivots) != 0) return false;
+
+    const std::size_t r = std::min(m, n);
+    matrix<T> product(m, n);
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        for (std::size_t i = 0; i < m; ++i)
+        {
+            T sum = i < r && i <= j ? lu(i, j) : T {};
+            for (std::size_t p = 0; p < std::min({ i, j + 1, r }); ++p)
+            {
+                sum += lu(i, p) * lu(p, j);
+            }
+            product(i, j) = sum;
+        }
+    }
+    for (std::size_t i = 0; i < r; ++i)
+    {
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            std::swap(a(i, j), a(pivots[i], j));
+        }
+    }
+    return near(matrix_view<const T>(product.view()), matrix_view<const T>(a.view()), tolerance);
+}
+
+template <typename T>
+bool test_cholesky(const std::size_t n, const std::size_t nrhs, const T tolerance)
+{
+    matrix<T> m(n, n);
+    fill_random(m, n + 2);
+    matrix<T> a(n, n);
+    gemm(T { 1 }, gemm_op::none, m, gemm_op::transpose, m, T {}, a);
+    for (std::size_t i = 0; i < n; ++i) a(i, i) += static_cast<T>(n);
+
+    matrix<T> x(n, nrhs);
+    fill_random(x, nrhs + 1);
+    matrix<T> b = a * x;
+
+    matrix<T> l = a;
+    if (cholesky_factor(l) != 0) return false;
+    for (std::size_t j = 1; j < n; ++j)
+    {
+        if (l(0, j) != a(0, j)) return false;
+    }
+    cholesky_solve(l, b);
+    if (!near(matrix_view<const T>(b.view()), matrix_view<const T>(x.view()), tolerance)) return false;
+
+    matrix<T> indefinite = a;
+    indefinite(n - 1, n - 1) = -indefinite(n - 1, n - 1) * static_cast<T>(n);
+    return cholesky_factor(indefinite) == n;
+}
+
+template <typename T>
+bool test_reductions(const std::size_t width, const std::size_t height)
+{
+    matrix<T> a(width, height);
+    for (std::size_t i = 0; i < width * height; ++i)
+    {
+        a.data()[i] = static_cast<T>(static_cast<int>(i * 37 % 101) - 50);
+    }
+
+    T expected_sum = {};
+    T squares = {};
+    T low = a.data()[0];
+    T high = a.data()[0];
+    T inf = {};
+    for (std::size_t x = 0; x < width; ++x)
+    {
+        T row = {};
+        for (std::size_t y = 0; y < height; ++y)
+        {
+            expected_sum += a(x, y);
+            squares += a(x, y) * a(x, y);
+            low = std::min(low, a(x, y));
+            high = std::max(high, a(x, y));
+            row += a(x, y) < T {} ? -a(x, y) : a(x, y);
+        }
+        inf = std::max(inf, row);
+    }
+    if (sum(a) != expected_sum || minimum(a) != low || maximum(a) != high || norm_inf(a) != inf) return false;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if (std::abs(norm_frobenius(a) - std::sqrt(squares)) > std::sqrt(squares) * T { 1e-5 }) return false;
+    }
+
+    /// Strided view: the last row and column are left out.
+    const matrix_view<const T> inner = matrix_view<const T>(a.view()).block(0, 0, width - 1, height - 1);
+    T inner_sum = {};
+    for (std::size_t y = 0; y + 1 < height; ++y)
+    {
+        for (std::size_t x = 0; x + 1 < width; ++x) inner_sum += a(x, y);
+    }
+    if (sum(inner) != inner_sum) return false;
+
+    const matrix<T> doubled = map(a, [](T v) { return v + v; });
+    const matrix<T> difference = zip(doubled, a, [](T u, T v) { return u - v; });
+    if (difference != a || doubled != a + a) return false;
+
+    matrix<T> copy = a;
+    copy = copy;
+    if (copy != a) return false;
+    copy.fill(T { 3 });
+    return sum(copy) == static_cast<T>(3 * width * height);
+}
+
+template <typename A8>
+bool test_quantized(const std::size_t m, const std::size_t k, const std::size_t n, const bool per_row)
+{
+    matrix<A8> a(m, k);
+    matrix<std::int8_t> b(k, n);
+    for (std::size_t i = 0; i < m * k; ++i) a.data()[i] = static_cast<A8>(i * 97 % 256);
+    for (std::size_t i = 0; i < k * n; ++i) b.data()[i] = static_cast<std::int8_t>(i * 31 % 256);
+
+    std::vector<float> scales(m);
+    std::vector<std::int32_t> zero_points(m);
+    for (std::size_t x = 0; x < m; ++x)
+    {
+        scales[x] = 0.01f * static_cast<float>(x % 5 + 1);
+        zero_points[x] = static_cast<std::int32_t>(x % 7) - 3;
+    }
+    const quantization qa = per_row ? quantization(scales, zero_points) : quantization(0.02f, 5);
+    const quantization qb(0.05f, -2);
+
+    matrix<std::int32_t> expected(m, n);
+    for (std::size_t y = 0; y < n; ++y)
+    {
+        for (std::size_t x = 0; x < m; ++x)
+        {
+            std::int32_t sum = 0;
+            for (std::size_t p = 0; p < k; ++p)
+            {
+                sum += (std::int32_t { a(x, p) } - qa.zero_point(x)) * (std::int32_t { b(p, y) } - qb.zero_point(y));
+            }
+            expected(x, y) = sum;
+        }
+    }
+
+    matrix<std::int32_t> c(m, n);
+    quantized_gemm(matrix_view<const A8>(a.view()), qa, matrix_view<const std::int8_t>(b.view()), qb, c.view());
+    if (c != expected) return false;
+
+    matrix<float> real(m, n);
+    quantized_gemm(matrix_view<const A8>(a.view()), qa, matrix_view<const std::int8_t>(b.view()), qb, real.view());
+    const quantization qc(4.0f, 10);
+    matrix<std::uint8_t> requantized(m, n);
+    quantized_gemm(matrix_view<const A8>(a.view()), qa, matrix_view<const std::int8_t>(b.view()), qb, requantized.view(), qc);
+    matrix<std::uint8_t> expected_q(m, n);
+    quantize(matrix_view<const float>(real.view()), qc, expected_q.view());
+    for (std::size_t y = 0; y < n; ++y)
+    {
+        for (std::size_t x = 0; x < m; ++x)
+        {
+            const float value = qa.scale(x) * qb.scale(y) * static_cast<float>(expected(x, y));
+            if (std::abs(real(x, y) - value) > 1e-5f * (1 + std::abs(value))) return false;
+            if (std::abs(int { requantized(x, y) } - int { expected_q(x, y) }) > 1) return false;
+        }
+    }
+    return true;
 }
 
-template <typename T>
-bool test_vec_mul(const std::size_t size)
+template <typename H>
+bool test_mixed(const std::size_t m, const std::size_t k, const std::size_t n)
 {
-    matrix<T> template_mat(size, size);
-    vector<T> template_vec(size);
+    const float eps = std::is_same_v<H, bfloat16> ? 1.0f / 128 : 1.0f / 1024;
+    std::vector<float> values(37);
+    std::vector<H> narrowed(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i) values[i] = (static_cast<float>(i) - 18.3f) * 0.37f;
+    detail::convert_elements(values.data(), values.size(), narrowed.data());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        if (narrowed[i].bits != H(values[i]).bits) return false;
+        if (std::abs(static_cast<float>(narrowed[i]) - values[i]) > eps * std::abs(values[i])) return false;
+    }
+    if (static_cast<float>(H(1.0f)) != 1.0f || !std::isnan(static_cast<float>(H(std::nanf(""))))) return false;
+    if constexpr (std::is_same_v<H, float16>)
+    {
+        if (static_cast<float>(H(65504.0f)) != 65504.0f || !std::isinf(static_cast<float>(H(65520.0f)))) return false;
+        if (static_cast<float>(H(0x1p-24f)) != 0x1p-24f || static_cast<float>(H(0x1p-26f)) != 0.0f) return false;
+    }
 
-    template_mat.fill(10);
+    matrix<H> a(m, k);
+    matrix<H> at(k, m);
+    matrix<H> b(k, n);
+    fill_random(a, m + k);
+    fill_random(b, k + n);
+    for (std::size_t p = 0; p < k; ++p)
+    {
+        for (std::size_t x = 0; x < m; ++x) at(p, x) = a(x, p);
+    }
 
-    for (std::size_t i = 0; i < size; i++)
+    matrix<float> af(m, k);
+    matrix<float> bf(k, n);
+    matrix<float> expected(m, n);
+    for (std::size_t i = 0; i < m * k; ++i) af.data()[i] = a.data()[i];
+    for (std::size_t i = 0; i < k * n; ++i) bf.data()[i] = b.data()[i];
+    fill_random(expected, n);
+    matrix<float> c = expected;
+    gemm(1.5f, af, bf, 0.5f, expected);
+
+    gemm(1.5f, a, b, 0.5f, c);
+    if (!near(matrix_view<const float>(c.view()), matrix_view<const float>(expected.view()), 1e-4f)) return false;
+    c.fill(0.0f);
+    gemm(1.5f, gemm_op::transpose, at, gemm_op::none, b, 0.0f, c);
+    gemm(1.5f, af, bf, 0.0f, expected);
+    if (!near(matrix_view<const float>(c.view()), matrix_view<const float>(expected.view()), 1e-4f)) return false;
+
+    matrix<H> rounded(m, n);
+    gemm(1.5f, a, b, 0.0f, rounded);
+    for (std::size_t i = 0; i < m * n; ++i)
     {
-        template_vec.at(i) = i;
+        if (rounded.data()[i].bits != H(expected.data()[i]).bits &&
+            std::abs(rounded.data()[i] - expected.data()[i]) > eps * (1e-3f + std::abs(expected.data()[i]))) return false;
     }
+    return true;
+}
 
-    vector<T> res_vec = template_mat *= template_vec;
+/// Elementwise operations and products of half-precision matrices, each
+/// element computed in float and rounded once on store.
+template <typename H>
+bool test_half_matrix(const std::size_t cols, const std::size_t rows)
+{
+    matrix<H> a(cols, rows);
+    matrix<H> b(cols, rows);
+    fill_random(a, cols);
+    fill_random(b, rows);
+    const std::size_t size = cols * rows;
+
+    matrix<H> filled(cols, rows);
+    filled.fill(H(0.75f));
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (filled.data()[i].bits != H(0.75f).bits) return false;
+    }
+
+    matrix<H> sum = a;
+    sum += b;
+    matrix<H> difference = a;
+    difference -= b;
+    matrix<H> scaled = a;
+    scaled *= H(3.0f);
+    const matrix<H> fused = (a - b) * 2 + a;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const float x = a.data()[i];
+        const float y = b.data()[i];
+        if (sum.data()[i].bits != H(x + y).bits) return false;
+        if (difference.data()[i].bits != H(x - y).bits) return false;
+        if (scaled.data()[i].bits != H(x * 3.0f).bits) return false;
+        if (fused.data()[i].bits != H(static_cast<float>(H(static_cast<float>(H(x - y)) * 2.0f)) + x).bits) return false;
+    }
+    if (a + b != sum) return false;
+
+    matrix<H> bt(rows, cols);
+    for (std::size_t y = 0; y < rows; ++y)
+    {
+        for (std::size_t x = 0; x < cols; ++x) bt(y, x) = b(x, y);
+    }
+    matrix<H> expected(cols, cols);
+    gemm(1.0f, a, bt, 0.0f, expected);
+    return a * bt == expected;
+}
+
+/// A fresh log file path per call: the writer may still hold a recently
+/// written file open, so a removed path is not reused.
+std::string log_path(std::string_view name)
+{
+    static std::atomic<std::size_t> calls { 0 };
+    const std::string file = "haifisch_logger_" + std::string(name) + "_" + std::to_string(calls++) + ".log";
+    return (std::filesystem::temp_directory_path() / file).string();
+}
+
+/// The text of every line of a log file after its time and level tags;
+/// false when a line does not start with both, i.e. it was torn.
+bool read_log(const std::string& path, std::string_view level, std::vector<std::string>& payloads)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        // "[YYYY-MM-DD HH:MM:SS] " is 22 characters.
+        if (line.size() < 22 + level.size() + 1 || line[0] != '[' || line[20] != ']') return false;
+        if (line.compare(22, level.size(), level) != 0 || line[22 + level.size()] != ' ') return false;
+        payloads.push_back(line.substr(22 + level.size() + 1));
+    }
+    return true;
+}
+
+/// Descriptors this process has open.
+std::size_t open_descriptors()
+{
+    const std::filesystem::directory_iterator fds("/proc/self/fd");
+    return static_cast<std::size_t>(std::distance(begin(fds), end(fds)));
+}
+
+/// Logs to more files than the writer keeps open: every line lands in its
+/// file, and once the writer goes idle all files are closed. A record
+/// logged after that wakes it up again.
+bool test_logger_files(const std::size_t files)
+{
+    const auto idle = std::chrono::milliseconds(200);
+    std::this_thread::sleep_for(idle);
+    const std::size_t before = open_descriptors();
+
+    std::vector<std::string> paths;
+    for (std::size_t i = 0; i < files; ++i)
+    {
+        paths.push_back(log_path("files"));
+        std::remove(paths.back().c_str());
+    }
+    for (std::size_t round = 0; round < 2; ++round)
+    {
+        for (const std::string& path : paths)
+        {
+            logger(path, logflag::info | logflag::nostdout) << "round " << round;
+        }
+    }
+    logger::flush();
+    if (open_descriptors() > before + 16) return false;
+
+    for (const std::string& path : paths)
+    {
+        std::vector<std::string> payloads;
+        const bool read = read_log(path, "[ INFO   ]", payloads);
+        std::remove(path.c_str());
+        if (!read || payloads != std::vector<std::string> { "round 0", "round 1" }) return false;
+    }
+
+    std::this_thread::sleep_for(idle);
+    if (open_descriptors() != before) return false;
+
+    const std::string path = log_path("wake");
+    std::remove(path.c_str());
+    logger(path, logflag::info | logflag::nostdout) << "awake";
+    logger::flush();
+    std::vector<std::string> payloads;
+    const bool read = read_log(path, "[ INFO   ]", payloads);
+    std::remove(path.c_str());
+    return read && payloads == std::vector<std::string> { "awake" };
+}
+
+/// threads producers log records each to one file at the same time.
+bool test_logger_threads(const std::size_t threads, const std::size_t records)
+{
+    const std::string path = log_path("threads");
+    std::remove(path.c_str());
+
+    std::vector<std::thread> producers;
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&, t] {
+            for (std::size_t i = 0; i < records; ++i)
+            {
+                logger(path, logflag::info | logflag::nostdout) << "thread " << t << " record " << i;
+            }
+        });
+    }
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    logger::flush();
+
+    std::vector<std::string> payloads;
+    const bool intact = read_log(path, "[ INFO   ]", payloads);
+    std::remove(path.c_str());
+    if (!intact || payloads.size() != threads * records) return false;
+
+    std::vector<std::size_t> next(threads, 0);
+    for (const std::string& payload : payloads)
+    {
+        std::size_t t = 0;
+        std::size_t i = 0;
+        if (std::sscanf(payload.c_str(), "thread %zu record %zu", &t, &i) != 2 || t >= threads) return false;
+        if (payload != "thread " + std::to_string(t) + " record " + std::to_string(i)) return false;
+        if (i != next[t]++) return false;
+    }
+    return true;
+}
+
+/// The writer blocks opening a FIFO until the FIFO has a reader, so the
+/// records behind it fill the queue (4096 slots) and their producer has to
+/// wait for the writer. Nothing may be lost or reordered on the way.
+bool test_logger_full_queue(const std::size_t records)
+{
+    const std::string fifo = log_path("fifo");
+    const std::string path = log_path("full");
+    std::remove(fifo.c_str());
+    std::remove(path.c_str());
+    if (mkfifo(fifo.c_str(), 0600) != 0) return false;
+
+    logger(fifo, logflag::info | logflag::nostdout) << "blocked";
+    std::atomic<std::size_t> pushed { 0 };
+    std::thread producer([&] {
+        for (std::size_t i = 0; i < records; ++i)
+        {
+            logger(path, logflag::info | logflag::nostdout) << i;
+            pushed.store(i + 1, std::memory_order_relaxed);
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const std::size_t stalled = pushed.load(std::memory_order_relaxed);
+
+    std::string unblocked;
+    {
+        std::ifstream reader(fifo);
+        std::getline(reader, unblocked);
+    }
+    producer.join();
+    logger::flush();
+
+    std::vector<std::string> payloads;
+    const bool intact = read_log(path, "[ INFO   ]", payloads);
+    std::remove(fifo.c_str());
+    std::remove(path.c_str());
+    if (stalled < 4096 || stalled >= records) return false;
+    if (unblocked.find("blocked") == std::string::npos) return false;
+    if (!intact || payloads.size() != records) return false;
+    for (std::size_t i = 0; i < records; ++i)
+    {
+        if (payloads[i] != std::to_string(i)) return false;
+    }
     return true;
 }
 
+struct log_point
+{
+    int x;
+    int y;
+};
+
+std::ostream& operator << (std::ostream& os, const log_point& p)
+{
+    return os << '(' << p.x << ", " << p.y << ')';
+}
+
+/// Arguments are queued in binary and formatted by the writer thread; the
+/// line must read as if every argument had gone through std::ostream.
+template <typename... Args>
+bool test_log_rendering(const Args&... args)
+{
+    const std::string path = log_path("rendering");
+    std::remove(path.c_str());
+
+    (logger(path, logflag::info | logflag::nostdout | logflag::box_bracekts | logflag::spaces) << ... << args);
+    logger::flush();
+
+    std::ostringstream expected;
+    ((expected << '[' << args << "] "), ...);
+
+    std::vector<std::string> payloads;
+    const bool intact = read_log(path, "[ INFO   ]", payloads);
+    std::remove(path.c_str());
+    return intact && payloads.size() == 1 && payloads[0] == expected.str();
+}
+
 TEST(arithmetic_test, arithmetic)
 {
     ASSERT_TRUE(test_mul<int>(10));
@@ -211,6 +1329,399 @@ TEST(arithmetic_test, arithmetic)
     ASSERT_TRUE(test_mul<double>(300));
 }
 
+TEST(arithmetic_test, rectangular_mul)
+{
+    ASSERT_TRUE(test_rect_mul<int>(1, 1, 1));
+    ASSERT_TRUE(test_rect_mul<int>(7, 13, 5));
+    ASSERT_TRUE(test_rect_mul<float>(33, 17, 65));
+    ASSERT_TRUE(test_rect_mul<double>(100, 300, 70));
+    ASSERT_TRUE(test_rect_mul<double>(257, 129, 511));
+    ASSERT_TRUE(test_rect_mul<long>(50, 60, 70));
+}
+
+TEST(simd_test, every_isa_level)
+{
+    const simd::isa detected = simd::detect_isa();
+    for (simd::isa level : { simd::isa::generic, simd::isa::sse2, simd::isa::avx2, simd::isa::avx512 })
+    {
+        if (simd::force_isa(level) != level) continue;
+
+        ASSERT_TRUE(test_add<int>(37));
+        ASSERT_TRUE(test_sub<float>(41));
+        ASSERT_TRUE(test_add<double>(43));
+        ASSERT_TRUE(test_rect_mul<int>(33, 47, 29));
+        ASSERT_TRUE(test_rect_mul<float>(65, 31, 70));
+        ASSERT_TRUE(test_rect_mul<double>(130, 75, 99));
+    }
+    simd::force_isa(detected);
+}
+
+TEST(expression_test, fused)
+{
+    ASSERT_TRUE(test_expression<int>(3, 5));
+    ASSERT_TRUE(test_expression<float>(100, 70));
+    ASSERT_TRUE(test_expression<double>(300, 301));
+    ASSERT_TRUE(test_expression<long>(17, 1));
+}
+
+TEST(expression_test, product_operands)
+{
+    ASSERT_TRUE(test_expression_product<int>(3, 5));
+    ASSERT_TRUE(test_expression_product<double>(70, 40));
+    ASSERT_TRUE(test_expression_product<long>(17, 1));
+}
+
+TEST(view_test, blocks)
+{
+    ASSERT_TRUE(test_view<int>(12, 9));
+    ASSERT_TRUE(test_view<double>(130, 97));
+    ASSERT_TRUE(test_view<float>(301, 256));
+}
+
+TEST(allocator_test, placement)
+{
+    constexpr std::size_t huge_page = storage_policy<>::huge_page_size;
+    ASSERT_TRUE((test_allocator<float, matrix_allocator_t<float>>(3, 5, 64)));
+    ASSERT_TRUE((test_allocator<double, matrix_allocator_t<double>>(100, 100, 64)));
+    ASSERT_TRUE((test_allocator<double, matrix_allocator_t<double>>(1024, 1024, huge_page)));
+    ASSERT_TRUE((test_allocator<int, matrix_allocator<int, std::allocator_traits<aligned_allocator<int, storage_policy<128, false, false>>>>>(2048, 1024, 128)));
+    ASSERT_TRUE((test_allocator<int, pool_matrix_allocator_t<int>>(33, 17, alignof(int))));
+}
+
+TEST(allocator_test, pool)
+{
+    ASSERT_TRUE(test_pool<float>(8));
+    ASSERT_TRUE(test_pool<double>(100));
+    ASSERT_GT(pool_stats().hit_rate(), 0.5);
+}
+
+TEST(blas_test, gemv)
+{
+    ASSERT_TRUE(test_vec_mul<int>(100));
+    ASSERT_TRUE(test_vec_mul<double>(1000));
+    ASSERT_TRUE(test_gemv<int>(37, 29));
+    ASSERT_TRUE(test_gemv<float>(300, 257));
+    ASSERT_TRUE(test_gemv<double>(1029, 66));
+    ASSERT_TRUE(test_gemv<long>(17, 100));
+}
+
+TEST(blas_test, level1)
+{
+    ASSERT_TRUE(test_blas1<int>(1000));
+    ASSERT_TRUE(test_blas1<float>(77));
+    ASSERT_TRUE(test_blas1<double>(100000));
+    ASSERT_TRUE(test_blas1<long>(5));
+
+    vector<double> v(2);
+    v[0] = 3;
+    v[1] = 4;
+    ASSERT_EQ(nrm2(v), 5.0);
+}
+
+TEST(batch_test, small)
+{
+    ASSERT_TRUE(test_batched<double>(1000, 4, 4, 4, false));
+    ASSERT_TRUE(test_batched<float>(300, 8, 8, 8, true));
+    ASSERT_TRUE(test_batched<double>(100, 16, 16, 16, false));
+    ASSERT_TRUE(test_batched<float>(50, 37, 13, 21, false));
+    ASSERT_TRUE(test_batched<int>(20, 3, 5, 7, false));
+    ASSERT_TRUE(test_batched<long>(10, 9, 2, 5, true));
+}
+
+TEST(batch_test, large)
+{
+    ASSERT_TRUE(test_batched<double>(3, 65, 70, 80, false));
+    ASSERT_TRUE(test_batched<int>(2, 100, 30, 20, true));
+}
+
+TEST(fixed_test, arithmetic)
+{
+    ASSERT_TRUE((test_fixed<double, 4, 4, 4>()));
+    ASSERT_TRUE((test_fixed<float, 3, 3, 3>()));
+    ASSERT_TRUE((test_fixed<float, 8, 2, 5>()));
+    ASSERT_TRUE((test_fixed<int, 2, 7, 1>()));
+    ASSERT_TRUE((test_fixed<long, 4, 3, 4>()));
+
+    const fixed_matrix<int, 2, 3> m(1, 2, 3,
+                                    4, 5, 6);
+    ASSERT_EQ(m(0, 2), 3);
+    ASSERT_EQ(m(1, 0), 4);
+}
+
+TEST(fixed_test, inverse)
+{
+    ASSERT_TRUE((test_fixed_inverse<double, 1>()));
+    ASSERT_TRUE((test_fixed_inverse<double, 2>()));
+    ASSERT_TRUE((test_fixed_inverse<float, 3>()));
+    ASSERT_TRUE((test_fixed_inverse<double, 4>()));
+    ASSERT_TRUE((test_fixed_inverse<float, 4>()));
+    ASSERT_TRUE((test_fixed_inverse<double, 6>()));
+}
+
+TEST(gemm_test, operands)
+{
+    for (gemm_op op_a : { gemm_op::none, gemm_op::transpose })
+    {
+        for (gemm_op op_b : { gemm_op::none, gemm_op::transpose })
+        {
+            ASSERT_TRUE(test_gemm<int>(37, 29, 41, op_a, op_b));
+            ASSERT_TRUE(test_gemm<float>(130, 300, 70, op_a, op_b));
+            ASSERT_TRUE(test_gemm<double>(67, 259, 129, op_a, op_b));
+            ASSERT_TRUE(test_gemm<long>(9, 17, 5, op_a, op_b));
+        }
+    }
+
+    matrix<double> a(3, 3);
+    matrix<double> c(3, 3);
+    a.fill(1);
+    c.fill(5);
+    gemm(0.0, a, a, 2.0, c);
+    ASSERT_EQ(c(2, 1), 10.0);
+}
+
+TEST(mapped_test, round_trip)
+{
+    ASSERT_TRUE(test_mapped<double>(300, 200));
+    ASSERT_TRUE(test_mapped<int>(1, 1000));
+    ASSERT_TRUE(test_mapped<std::uint8_t>(77, 3));
+
+    const std::string path = (std::filesystem::temp_directory_path() / "haifisch_mapped_type.bin").string();
+    matrix<float> m(4, 4);
+    m.fill(1);
+    save_matrix(path, m.view());
+    ASSERT_THROW(mapped_matrix<double> wrong(path), std::runtime_error);
+    std::remove(path.c_str());
+    ASSERT_THROW(mapped_matrix<float> missing(path), std::system_error);
+}
+
+TEST(mapped_test, out_of_core)
+{
+    ASSERT_TRUE(test_out_of_core<double>(200, 150, 130));
+    ASSERT_TRUE(test_out_of_core<float>(64, 300, 1));
+    ASSERT_TRUE(test_out_of_core<int>(129, 65, 257));
+}
+
+TEST(sparse_test, kernels)
+{
+    for (sparse_format format : { sparse_format::csr, sparse_format::csc })
+    {
+        ASSERT_TRUE(test_sparse<double>(300, 200, format));
+        ASSERT_TRUE(test_sparse<float>(5, 40, format));
+        ASSERT_TRUE(test_sparse<int>(1000, 900, format));
+        ASSERT_TRUE(test_sparse<long>(17, 3, format));
+    }
+}
+
+TEST(solve_test, trsm)
+{
+    ASSERT_TRUE(test_trsm<double>(1, 1, 1e-12));
+    ASSERT_TRUE(test_trsm<double>(37, 5, 1e-12));
+    ASSERT_TRUE(test_trsm<double>(300, 270, 1e-10));
+    ASSERT_TRUE(test_trsm<float>(150, 20, 1e-4f));
+}
+
+TEST(solve_test, lu)
+{
+    ASSERT_TRUE(test_lu<double>(1, 1, 1e-12));
+    ASSERT_TRUE(test_lu<double>(129, 3, 1e-8));
+    ASSERT_TRUE(test_lu<double>(500, 17, 1e-7));
+    ASSERT_TRUE(test_lu<float>(200, 4, 1e-2f));
+}
+
+TEST(solve_test, lu_rectangular)
+{
+    ASSERT_TRUE(test_lu_rect<double>(3, 5, 1e-12));
+    ASSERT_TRUE(test_lu_rect<double>(5, 3, 1e-12));
+    ASSERT_TRUE(test_lu_rect<double>(200, 250, 1e-9));
+    ASSERT_TRUE(test_lu_rect<double>(300, 130, 1e-9));
+    ASSERT_TRUE(test_lu_rect<float>(100, 400, 1e-3f));
+}
+
+TEST(solve_test, cholesky)
+{
+    ASSERT_TRUE(test_cholesky<double>(1, 1, 1e-12));
+    ASSERT_TRUE(test_cholesky<double>(129, 3, 1e-10));
+    ASSERT_TRUE(test_cholesky<double>(500, 17, 1e-10));
+    ASSERT_TRUE(test_cholesky<float>(200, 4, 1e-4f));
+}
+
+TEST(elementwise_test, reductions)
+{
+    ASSERT_TRUE(test_reductions<int>(2, 3));
+    ASSERT_TRUE(test_reductions<int>(300, 301));
+    ASSERT_TRUE(test_reductions<float>(33, 17));
+    ASSERT_TRUE(test_reductions<double>(1100, 1001));
+}
+
+TEST(quantized_test, gemm)
+{
+    ASSERT_TRUE(test_quantized<std::int8_t>(1, 1, 1, false));
+    ASSERT_TRUE(test_quantized<std::int8_t>(37, 13, 11, true));
+    ASSERT_TRUE(test_quantized<std::uint8_t>(64, 64, 64, false));
+    ASSERT_TRUE(test_quantized<std::int8_t>(300, 1100, 270, true));
+    ASSERT_TRUE(test_quantized<std::uint8_t>(129, 2051, 33, true));
+}
+
+TEST(mixed_test, gemm)
+{
+    ASSERT_TRUE(test_mixed<bfloat16>(1, 1, 1));
+    ASSERT_TRUE(test_mixed<float16>(37, 13, 11));
+    ASSERT_TRUE(test_mixed<bfloat16>(64, 300, 64));
+    ASSERT_TRUE(test_mixed<float16>(300, 270, 130));
+}
+
+TEST(mixed_test, half_matrix)
+{
+    ASSERT_TRUE(test_half_matrix<bfloat16>(1, 1));
+    ASSERT_TRUE(test_half_matrix<float16>(37, 13));
+    ASSERT_TRUE(test_half_matrix<bfloat16>(300, 270));
+    ASSERT_TRUE(test_half_matrix<float16>(300, 270));
+}
+
+TEST(benchmark_test, statistics)
+{
+    const bench::statistics stats = bench::summarize({ 5, 1, 3, 2, 4, 100 });
+    ASSERT_EQ(stats.samples, 6u);
+    ASSERT_EQ(stats.outliers, 1u);
+    ASSERT_DOUBLE_EQ(stats.min, 1.0);
+    ASSERT_DOUBLE_EQ(stats.max, 100.0);
+    ASSERT_DOUBLE_EQ(stats.median, 3.5);
+    ASSERT_DOUBLE_EQ(stats.p95, 76.25);
+    ASSERT_DOUBLE_EQ(stats.mean, 3.0);
+    ASSERT_DOUBLE_EQ(stats.stddev, std::sqrt(2.5));
+
+    std::size_t calls = 0;
+    const bench::statistics counted = bench::measure({ 2, 3 }, [&] { ++calls; });
+    ASSERT_EQ(calls, 5u);
+    ASSERT_EQ(counted.samples, 3u);
+}
+
+TEST(profile_test, registry)
+{
+    ASSERT_EQ(profile::size_class(1), 0u);
+    ASSERT_EQ(profile::size_class(1000), 9u);
+    ASSERT_EQ(profile::size_class(1024), 10u);
+
+    profile::reset();
+    profile::counters sample;
+    sample.calls = 1;
+    sample.seconds = 0.5;
+    sample.values[static_cast<std::size_t>(profile::counter::cycles)] = 100;
+    sample.available[static_cast<std::size_t>(profile::counter::cycles)] = true;
+    profile::record("kernel", 1000, sample);
+    profile::record("kernel", 1023, sample);
+    profile::record("kernel", 4096, sample);
+
+    const std::vector<profile::entry> entries = profile::snapshot();
+    ASSERT_EQ(entries.size(), 2u);
+    ASSERT_EQ(entries[0].size_class, 9u);
+    ASSERT_EQ(entries[0].totals.calls, 2u);
+    ASSERT_EQ(entries[0].totals[profile::counter::cycles], 200u);
+    ASSERT_EQ(entries[1].size_class, 12u);
+    ASSERT_NE(profile::format(entries[0]).find("cycles=200 instructions=-"), std::string::npos);
+    profile::reset();
+    ASSERT_TRUE(profile::snapshot().empty());
+}
+
+TEST(logger_test, threads)
+{
+    ASSERT_TRUE(test_logger_threads(8, 20000));
+}
+
+TEST(logger_test, full_queue)
+{
+    ASSERT_TRUE(test_logger_full_queue(3 * 4096));
+}
+
+TEST(logger_test, destinations)
+{
+    const std::string path = log_path("destinations");
+    std::remove(path.c_str());
+
+    testing::internal::CaptureStdout();
+    HAIFISCH_LOG_TO(path, logflag::warn | logflag::nostdout) << "file only " << 1;
+    HAIFISCH_LOG_TO(path, logflag::warn) << "file and stdout " << 2;
+    HAIFISCH_LOG(logflag::warn) << "stdout only " << 3;
+    logger::flush();
+    const std::string out = testing::internal::GetCapturedStdout();
+
+    std::vector<std::string> payloads;
+    ASSERT_TRUE(read_log(path, "[ WARN   ]", payloads));
+    std::remove(path.c_str());
+    ASSERT_EQ(payloads, (std::vector<std::string> { "file only 1", "file and stdout 2" }));
+    ASSERT_EQ(out.find("file only"), std::string::npos);
+    ASSERT_NE(out.find("[ WARN   ] file and stdout 2\n"), std::string::npos);
+    ASSERT_NE(out.find("[ WARN   ] stdout only 3\n"), std::string::npos);
+}
+
+TEST(logger_test, open_files)
+{
+    ASSERT_TRUE(test_logger_files(40));
+}
+
+TEST(logger_test, levels)
+{
+    ASSERT_EQ(level_of(logflag::debug), loglevel::debug);
+    ASSERT_EQ(level_of(logflag::debug | logflag::error), loglevel::error);
+    ASSERT_EQ(level_of(logflag::info | logflag::warn | logflag::spaces), loglevel::warn);
+    ASSERT_EQ(level_of(logflag::debug | logflag::info), loglevel::info);
+    ASSERT_EQ(level_of(logflag::nostdout | logflag::spaces), loglevel::info);
+
+    std::size_t evaluated = 0;
+    const auto argument = [&] { return ++evaluated; };
+
+    logger::set_level(loglevel::warn);
+    ASSERT_FALSE(logger::enabled(logflag::debug | logflag::nostdout));
+    ASSERT_TRUE(logger::enabled(logflag::warn | logflag::nostdout));
+    HAIFISCH_LOG(logflag::debug | logflag::nostdout) << argument();
+    HAIFISCH_LOG(logflag::info | logflag::nostdout) << argument();
+    ASSERT_EQ(evaluated, 0u);
+    HAIFISCH_LOG(logflag::error | logflag::nostdout) << argument();
+    ASSERT_EQ(evaluated, 1u);
+
+    logger::set_level(loglevel::off);
+    HAIFISCH_LOG(logflag::error | logflag::nostdout) << argument();
+    ASSERT_EQ(evaluated, 1u);
+    logger::set_level(loglevel::debug);
+    HAIFISCH_LOG(logflag::debug | logflag::nostdout) << argument();
+    ASSERT_EQ(evaluated, 2u);
+}
+
+TEST(logger_test, rendering)
+{
+    const std::string text = "view";
+    ASSERT_TRUE(test_log_rendering('c', static_cast<signed char>('s'), static_cast<unsigned char>('u')));
+    ASSERT_TRUE(test_log_rendering(static_cast<short>(-7), -42, std::numeric_limits<long long>::min(),
+                                   42u, std::numeric_limits<std::uint64_t>::max(), true, false));
+    ASSERT_TRUE(test_log_rendering(3.14159265358979, 1e-7, 2.5e10, -0.0, 0.1f, 123456789.0));
+    ASSERT_TRUE(test_log_rendering(std::string("string"), "literal", std::string_view(text), log_point { 3, -4 }));
+}
+
+TEST(strassen_test, power_of_two)
+{
+    ASSERT_TRUE(test_strassen<int>(128, 128, 128, 16));
+    ASSERT_TRUE(test_strassen<long>(256, 256, 256, 32));
+    ASSERT_TRUE(test_strassen<double>(512, 512, 512, 64));
+}
+
+TEST(strassen_test, peeling)
+{
+    ASSERT_TRUE(test_strassen<int>(64, 64, 64, 4));
+    ASSERT_TRUE(test_strassen<int>(63, 65, 67, 4));
+    ASSERT_TRUE(test_strassen<long>(101, 37, 80, 8));
+    ASSERT_TRUE(test_strassen<double>(33, 129, 47, 5));
+    ASSERT_TRUE(test_strassen<double>(255, 257, 129, 16));
+    ASSERT_TRUE(test_strassen<int>(5, 3, 7, 1));
+}
+
+TEST(strassen_test, tasks)
+{
+    ASSERT_TRUE(test_strassen<int>(64, 64, 64, 4, 1));
+    ASSERT_TRUE(test_strassen<int>(63, 65, 67, 4, 2));
+    ASSERT_TRUE(test_strassen<double>(255, 257, 129, 16, 3));
+    ASSERT_TRUE(test_strassen<long>(17, 9, 33, 2, 8));
+}
+
 TEST(transpose_test, transpose)
 {
     ASSERT_TRUE(test_transpose<int>(32, 64, 10));
@@ -222,3 +1733,13 @@ TEST(transpose_test, transpose)
     ASSERT_TRUE(test_transpose<int>(1024, 2048, 10));
     ASSERT_TRUE(test_transpose<int>(2058, 4096, 10));
 }
+
+TEST(transpose_test, values)
+{
+    ASSERT_TRUE(test_transpose_values<int>(7, 7));
+    ASSERT_TRUE(test_transpose_values<int>(130, 130));
+    ASSERT_TRUE(test_transpose_values<float>(301, 67));
+    ASSERT_TRUE(test_transpose_values<double>(64, 200));
+    ASSERT_TRUE(test_transpose_values<long>(513, 515));
+    ASSERT_TRUE(test_transpose_values<short>(100, 37));
+}
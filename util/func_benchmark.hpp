@@ -1,33 +1,136 @@
-#include <iostream>
+#pragma once
+
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include "logger.hpp"
 
 
-template <class Function, class... Args>
-void test_func_speed(std::string_view label, uint64_t iterations, Function function, Args&&... args) {
-  std::cout << label << "\t: " << iterations << " iteration(s): ";
-  auto start = std::chrono::high_resolution_clock::now();
-  while (iterations-- > 0) {
-    function(std::forward<Args>(args)...);
+namespace bench {
+
+/// How a function is sampled: warm-up runs are discarded, then it is timed
+/// repetitions times and, past that, until min_time has been spent on
+/// samples, never more than max_repetitions times.
+struct options {
+  std::size_t warmup          = 2;
+  std::size_t repetitions     = 10;
+  double      min_time        = 0.0;
+  std::size_t max_repetitions = 1000;
+};
+
+/// Seconds per call. Median and p95 come from all samples; mean and stddev
+/// leave out the outliers beyond Tukey's fences (1.5 IQR past the
+/// quartiles), which are only counted.
+struct statistics {
+  std::size_t samples  = 0;
+  std::size_t outliers = 0;
+  double      min      = 0;
+  double      median   = 0;
+  double      p95      = 0;
+  double      max      = 0;
+  double      mean     = 0;
+  double      stddev   = 0;
+};
+
+/// Linear interpolation between the closest ranks of sorted samples.
+inline double percentile(const std::vector<double>& sorted, double q) noexcept {
+  if (sorted.empty()) return 0;
+  const double position = q * static_cast<double>(sorted.size() - 1);
+  const std::size_t lower = static_cast<std::size_t>(position);
+  const std::size_t upper = std::min(lower + 1, sorted.size() - 1);
+  return sorted[lower] + (position - static_cast<double>(lower)) * (sorted[upper] - sorted[lower]);
+}
+
+inline statistics summarize(std::vector<double> samples) {
+  statistics stats;
+  if (samples.empty()) return stats;
+
+  std::sort(samples.begin(), samples.end());
+  stats.samples = samples.size();
+  stats.min     = samples.front();
+  stats.max     = samples.back();
+  stats.median  = percentile(samples, 0.5);
+  stats.p95     = percentile(samples, 0.95);
+
+  const double q1    = percentile(samples, 0.25);
+  const double q3    = percentile(samples, 0.75);
+  const double lower = q1 - 1.5 * (q3 - q1);
+  const double upper = q3 + 1.5 * (q3 - q1);
+
+  double sum = 0;
+  std::size_t kept = 0;
+  for (double sample : samples) {
+    if (sample < lower || sample > upper) continue;
+    sum += sample;
+    ++kept;
   }
-  auto timeSpent = std::chrono::high_resolution_clock::now() - start;
-  std::cout << std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent).count() << " s." << std::endl;
-  std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(timeSpent).count() << " ms." << std::endl;
+  stats.outliers = samples.size() - kept;
+  stats.mean     = sum / static_cast<double>(kept);
+
+  double squares = 0;
+  for (double sample : samples) {
+    if (sample < lower || sample > upper) continue;
+    squares += (sample - stats.mean) * (sample - stats.mean);
+  }
+  stats.stddev = kept > 1 ? std::sqrt(squares / static_cast<double>(kept - 1)) : 0.0;
+
+  return stats;
+}
+
+/// Keeps the compiler from discarding a result that is never read.
+template <class T>
+inline void do_not_optimize(T&& value) noexcept {
+  asm volatile("" : : "g"(&value) : "memory");
 }
 
 template <class Function, class... Args>
-void test_func_speed(uint64_t iterations, Function function, Args&&... args) {
-  std::string info = std::to_string(iterations) + " iteration(s): ";
-  auto start = std::chrono::high_resolution_clock::now();
-  while (iterations-- > 0) {
-    function(std::forward<Args>(args)...);
+statistics measure(const options& opts, Function&& function, Args&&... args) {
+  using clock = std::chrono::steady_clock;
+
+  for (std::size_t i = 0; i < opts.warmup; ++i) {
+    function(args...);
+  }
+
+  std::vector<double> samples;
+  samples.reserve(opts.repetitions);
+  double spent = 0;
+  while (samples.size() < std::max<std::size_t>(opts.repetitions, 1)
+         || (spent < opts.min_time && samples.size() < opts.max_repetitions)) {
+    const auto start = clock::now();
+    function(args...);
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    samples.push_back(seconds);
+    spent += seconds;
   }
-  auto timeSpent = std::chrono::high_resolution_clock::now() - start;
-  info += std::to_string(std::chrono::duration_cast<std::chrono::duration<float>>(timeSpent).count());
-  info += " s., ";
-  info += std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(timeSpent).count());
-  info += " ms.";
-  std::cout << info << std::endl;
+
+  return summarize(std::move(samples));
+}
+
+inline std::ostream& operator<<(std::ostream& os, const statistics& stats) {
+  return os << "median " << stats.median * 1e3 << " ms, p95 " << stats.p95 * 1e3
+            << " ms, stddev " << stats.stddev * 1e3 << " ms (" << stats.samples << " samples, "
+            << stats.outliers << " outliers)";
 }
 
+} // namespace bench
+
+/// Times iterations calls after one warm-up call and prints the summary.
+template <class Function, class... Args>
+void test_func_speed(std::string_view label, uint64_t iterations, Function function, Args&&... args) {
+  const bench::statistics stats = bench::measure({ 1, iterations }, function, std::forward<Args>(args)...);
+  std::cout << label << "\t: " << stats << std::endl;
+}
+
+template <class Function, class... Args>
+void test_func_speed(uint64_t iterations, Function function, Args&&... args) {
+  const bench::statistics stats = bench::measure({ 1, iterations }, function, std::forward<Args>(args)...);
+  std::cout << stats << std::endl;
+}
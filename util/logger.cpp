@@ -0,0 +1,509 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+namespace logging
+{
+string_buffer::int_type string_buffer::overflow(int_type c)
+{
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    text.push_back(traits_type::to_char_type(c));
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize string_buffer::xsputn(const char* s, std::streamsize n)
+{
+  text.append(s, static_cast<std::size_t>(n));
+  return n;
+}
+
+thread_buffer& local_buffer() noexcept
+{
+  static thread_local thread_buffer buffer;
+  return buffer;
+}
+
+namespace
+{
+struct record
+{
+  std::uint32_t    flags     = 0;
+  std::int64_t     timestamp = 0;
+  std::string      path;
+  std::string      text;
+};
+
+/// Bounded multi-producer single-consumer ring (Vyukov's sequence-numbered
+/// slots). Producers claim a slot with one CAS on the tail; the writer is
+/// the only consumer, so the head is a plain counter. Slot strings keep
+/// their capacity, so steady-state logging does not allocate. The CAS and
+/// pushed() are sequentially consistent, which lets the writer go to sleep
+/// without missing a record (see writer::wait()).
+class ring
+{
+public:
+  static constexpr std::size_t capacity = 4096;
+
+  ring()
+  {
+    for (std::size_t i = 0; i < capacity; ++i)
+    {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool try_push(std::uint32_t flags, std::int64_t timestamp, std::string_view path, const char* text, std::size_t size) noexcept
+  {
+    std::size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      slot& s = slots[pos % capacity];
+      const std::size_t sequence = s.sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+          s.value.flags = flags;
+          s.value.timestamp = timestamp;
+          s.value.path.assign(path.data(), path.size());
+          s.value.text.assign(text, size);
+          s.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// The oldest record, or nullptr when the ring is empty. It stays valid
+  /// until pop().
+  const record* front() noexcept
+  {
+    slot& s = slots[head % capacity];
+    if (s.sequence.load(std::memory_order_acquire) != head + 1)
+    {
+      return nullptr;
+    }
+    return &s.value;
+  }
+
+  void pop() noexcept
+  {
+    slots[head % capacity].sequence.store(head + capacity, std::memory_order_release);
+    ++head;
+    popped.store(head, std::memory_order_release);
+  }
+
+  std::size_t pushed() const noexcept
+  {
+    return tail.load(std::memory_order_seq_cst);
+  }
+
+  std::size_t consumed() const noexcept
+  {
+    return popped.load(std::memory_order_acquire);
+  }
+
+private:
+  struct slot
+  {
+    std::atomic<std::size_t> sequence;
+    record value;
+  };
+
+  std::unique_ptr<slot[]> slots { new slot[capacity] };
+  alignas(64) std::atomic<std::size_t> tail { 0 };
+  alignas(64) std::size_t head = 0;
+  std::atomic<std::size_t> popped { 0 };
+};
+
+#if defined(__linux__) || defined(__FreeBSD__)
+constexpr std::string_view red    = "\033[0;31m";
+constexpr std::string_view green  = "\033[0;32m";
+constexpr std::string_view yellow = "\033[0;33m";
+constexpr std::string_view purple = "\033[0;35m";
+constexpr std::string_view gray   = "\033[0;90m";
+constexpr std::string_view eoc    = "\033[0;0m";
+#endif
+
+/// Level tags, with the level's default color added when the record asks
+/// for none.
+std::string_view type(std::uint32_t& flags) noexcept
+{
+  const auto any_of = [&](auto... args) -> bool { return (static_cast<bool>(flags & args) | ... ); };
+#if defined(__linux__) || defined(__FreeBSD__)
+  const bool colored = any_of(logflag::red, logflag::green, logflag::yellow, logflag::purple, logflag::gray);
+  if ( (flags & logflag::info ) > 0 && !colored) flags |= logflag::green;
+  if ( (flags & logflag::debug) > 0 && !colored) flags |= logflag::gray;
+  if ( (flags & logflag::warn ) > 0 && !colored) flags |= logflag::yellow;
+  if ( (flags & logflag::error) > 0 && !colored) flags |= logflag::red;
+#endif
+
+  if ( (flags & logflag::info ) > 0) return "[ INFO   ]";
+  if ( (flags & logflag::debug) > 0) return "[ DEBUG  ]";
+  if ( (flags & logflag::warn ) > 0) return "[ WARN   ]";
+  if ( (flags & logflag::error) > 0) return "[ ERROR  ]";
+  return "";
+}
+
+std::string_view begin_color(std::uint32_t flags) noexcept
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+  if ( (flags & logflag::red     ) > 0) return red;
+  if ( (flags & logflag::green   ) > 0) return green;
+  if ( (flags & logflag::purple  ) > 0) return purple;
+  if ( (flags & logflag::yellow  ) > 0) return yellow;
+  if ( (flags & logflag::gray    ) > 0) return gray;
+#endif
+  (void) flags;
+  return "";
+}
+
+std::string_view end_color(std::uint32_t flags) noexcept
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+  if (!begin_color(flags).empty()) return eoc;
+#endif
+  (void) flags;
+  return "";
+}
+
+template <typename T>
+T take(std::string_view payload, std::size_t& at) noexcept
+{
+  T value;
+  std::memcpy(&value, payload.data() + at, sizeof(T));
+  at += sizeof(T);
+  return value;
+}
+
+/// Formats the binary arguments of a record the way operator<< of an
+/// ostream with default flags would, each wrapped in the decorations its
+/// flags ask for.
+void render(std::uint32_t flags, std::string_view payload, std::string& line)
+{
+  std::size_t at = 0;
+  while (at < payload.size())
+  {
+    if ( (flags & logflag::newline         ) > 0) line += '\n';
+
+    if ( (flags & logflag::box_bracekts    ) > 0) line += '[';
+    if ( (flags & logflag::chevrons        ) > 0) line += '<';
+    if ( (flags & logflag::curly_brackets  ) > 0) line += '{';
+    if ( (flags & logflag::round_brackets  ) > 0) line += '(';
+
+    char digits[32];
+    switch (static_cast<argument>(payload[at++]))
+    {
+      case argument::text:
+      {
+        const auto size = take<std::uint32_t>(payload, at);
+        line.append(payload.substr(at, size));
+        at += size;
+        break;
+      }
+      case argument::character:
+        line += take<char>(payload, at);
+        break;
+      case argument::signed_integer:
+        line.append(digits, std::to_chars(digits, digits + sizeof(digits), take<std::int64_t>(payload, at)).ptr);
+        break;
+      case argument::unsigned_integer:
+        line.append(digits, std::to_chars(digits, digits + sizeof(digits), take<std::uint64_t>(payload, at)).ptr);
+        break;
+      case argument::floating:
+      {
+        const int size = std::snprintf(digits, sizeof(digits), "%g", take<double>(payload, at));
+        line.append(digits, static_cast<std::size_t>(size));
+        break;
+      }
+    }
+
+    if ( (flags & logflag::round_brackets  ) > 0) line += ')';
+    if ( (flags & logflag::curly_brackets  ) > 0) line += '}';
+    if ( (flags & logflag::chevrons        ) > 0) line += '>';
+    if ( (flags & logflag::box_bracekts    ) > 0) line += ']';
+
+    if ( (flags & logflag::spaces          ) > 0) line += ' ';
+  }
+}
+
+/// Background thread draining the ring. Lines are collected into one
+/// buffer per destination and written once the ring runs dry, so a burst
+/// of records costs one write per destination. At most max_open_files
+/// files stay open, the least recently written are closed first. Once the
+/// ring has been empty for a while the writer closes them all and blocks
+/// until the next record.
+class writer
+{
+public:
+  static constexpr std::size_t max_open_files = 16;
+
+  writer()
+    : thread([this] { run(); })
+  { }
+
+  ~writer()
+  {
+    stop.store(true, std::memory_order_release);
+    wake();
+    thread.join();
+  }
+
+  void push(std::uint32_t flags, std::int64_t timestamp, std::string_view path, const char* text, std::size_t size) noexcept
+  {
+    while (!queue.try_push(flags, timestamp, path, text, size))
+    {
+      std::this_thread::yield();
+    }
+    if (sleeping.load(std::memory_order_seq_cst))
+    {
+      wake();
+    }
+  }
+
+  void flush() noexcept
+  {
+    const std::size_t target = queue.pushed();
+    while (queue.consumed() < target || written.load(std::memory_order_acquire) < target)
+    {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  /// Rounds of an empty ring spent yielding, then napping, before the
+  /// writer blocks: about 10 ms in all.
+  static constexpr std::size_t yield_rounds = 64;
+  static constexpr std::size_t nap_rounds = 50;
+
+  void wake()
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    ready.notify_one();
+  }
+
+  /// A producer claims its slot before it reads sleeping, the writer sets
+  /// sleeping before it reads the tail, and all four accesses are
+  /// sequentially consistent: either the writer sees the record or the
+  /// producer sees the writer asleep and wakes it.
+  void wait()
+  {
+    files.clear();
+    std::unique_lock<std::mutex> lock(mutex);
+    sleeping.store(true, std::memory_order_seq_cst);
+    ready.wait(lock, [this] { return queue.pushed() != queue.consumed() || stop.load(std::memory_order_acquire); });
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  void run()
+  {
+    std::size_t idle = 0;
+    for (;;)
+    {
+      std::size_t drained = 0;
+      while (const record* r = queue.front())
+      {
+        format(*r);
+        queue.pop();
+        ++drained;
+      }
+
+      if (drained > 0)
+      {
+        write();
+        written.store(queue.consumed(), std::memory_order_release);
+        idle = 0;
+        continue;
+      }
+      if (stop.load(std::memory_order_acquire))
+      {
+        break;
+      }
+      if (++idle < yield_rounds)
+      {
+        std::this_thread::yield();
+      }
+      else if (idle < yield_rounds + nap_rounds)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      else
+      {
+        wait();
+        idle = 0;
+      }
+    }
+  }
+
+  void format(const record& r)
+  {
+    std::uint32_t flags = r.flags;
+    const std::string_view level = type(flags);
+    const std::string_view prefix = (flags & logflag::unixtime) > 0 ? unixtime(r.timestamp) : time(r.timestamp);
+    const std::size_t line_begin = file_line.size();
+
+    file_line.append(prefix).append(1, ' ').append(level).append(1, ' ');
+    render(r.flags, r.text, file_line);
+    file_line.append(1, '\n');
+    const std::string_view line(file_line.data() + line_begin, file_line.size() - line_begin);
+
+    if (!((flags & logflag::nostdout) > 0))
+    {
+      out.append(begin_color(flags)).append(line).append(end_color(flags));
+    }
+    if (!r.path.empty())
+    {
+      files[r.path].pending.append(line);
+    }
+    file_line.resize(line_begin);
+  }
+
+  void write()
+  {
+    if (!out.empty())
+    {
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      std::fflush(stdout);
+      out.clear();
+    }
+    for (auto& [path, file] : files)
+    {
+      if (file.pending.empty()) continue;
+      if (!file.stream.is_open())
+      {
+        file.stream.open(path, std::ios::app);
+      }
+      file.stream.write(file.pending.data(), static_cast<std::streamsize>(file.pending.size()));
+      file.stream.flush();
+      file.pending.clear();
+      file.last_write = ++writes;
+    }
+    while (files.size() > max_open_files)
+    {
+      const auto oldest = std::min_element(files.begin(), files.end(), [](const auto& lhs, const auto& rhs)
+      {
+        return lhs.second.last_write < rhs.second.last_write;
+      });
+      files.erase(oldest);
+    }
+  }
+
+  /// strftime runs once per second of log time; records within the same
+  /// second reuse the cached text.
+  std::string_view time(std::int64_t timestamp)
+  {
+    if (timestamp != cached_second || cached_time.empty())
+    {
+      const std::time_t now = static_cast<std::time_t>(timestamp);
+      std::tm local {};
+      localtime_r(&now, &local);
+      char text[32];
+      const std::size_t size = std::strftime(text, sizeof(text), "[%Y-%m-%d %H:%M:%S]", &local);
+      cached_time.assign(text, size);
+      cached_second = timestamp;
+    }
+    return cached_time;
+  }
+
+  std::string_view unixtime(std::int64_t timestamp)
+  {
+    cached_unix = "[" + std::to_string(timestamp) + "]";
+    return cached_unix;
+  }
+
+  struct file_output
+  {
+    std::ofstream stream;
+    std::string   pending;
+    std::size_t   last_write = 0;
+  };
+
+  ring queue;
+  std::string out;
+  std::string file_line;
+  std::map<std::string, file_output> files;
+  std::size_t writes = 0;
+  std::int64_t cached_second = 0;
+  std::string cached_time;
+  std::string cached_unix;
+  std::atomic<std::size_t> written { 0 };
+  std::atomic<bool> stop { false };
+  std::atomic<bool> sleeping { false };
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::thread thread;
+};
+
+/// Records carry whole seconds, so the coarse clock (a few ns, no syscall)
+/// is precise enough.
+std::int64_t now_seconds() noexcept
+{
+#if defined(__linux__)
+  timespec now;
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  return static_cast<std::int64_t>(now.tv_sec);
+#else
+  return static_cast<std::int64_t>(std::time(nullptr));
+#endif
+}
+
+writer& backend()
+{
+  static writer instance;
+  return instance;
+}
+} // namespace
+} // namespace logging
+
+
+logger::logger(logflag logflags)
+  : logger("", logflags)
+{ }
+
+logger::logger(std::string_view filename, logflag logflags)
+  : flags     (static_cast<std::uint32_t>(logflags))
+  , path      (filename)
+  , local     (logging::local_buffer())
+  , start     (local.buffer.text.size())
+  , timestamp (logging::now_seconds())
+  , active    (enabled(logflags))
+{ }
+
+logger::~logger()
+{
+  std::string& text = local.buffer.text;
+  if (active && text.size() > start)
+  {
+    logging::backend().push(flags, timestamp, path, text.data() + start, text.size() - start);
+  }
+  text.resize(start);
+}
+
+void logger::flush()
+{
+  logging::backend().flush();
+}
@@ -1,6 +1,15 @@
 #pragma once
 
-#include <sstream>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 
 enum class logflag : std::uint32_t
@@ -27,7 +36,7 @@ enum class logflag : std::uint32_t
 #endif
 };
 
-inline logflag operator | (logflag lhs, logflag rhs) noexcept
+constexpr logflag operator | (logflag lhs, logflag rhs) noexcept
 {
   return static_cast<logflag>(static_cast<std::uint32_t>(lhs) | static_cast<std::uint32_t>(rhs));
 }
@@ -42,204 +51,206 @@ inline std::uint32_t operator &= (std::uint32_t& lhs, logflag rhs) noexcept
   return lhs &= static_cast<std::uint32_t>(rhs);
 }
 
-inline std::uint32_t operator ~ (logflag lhs) noexcept
+constexpr std::uint32_t operator ~ (logflag lhs) noexcept
 {
   return ~static_cast<std::uint32_t>(lhs);
 }
 
-inline std::uint32_t operator & (std::uint32_t lhs, logflag rhs) noexcept
+constexpr std::uint32_t operator & (std::uint32_t lhs, logflag rhs) noexcept
 {
   return lhs & static_cast<std::uint32_t>(rhs);
 }
 
-class logger
+/// Severity of a record, taken from its most severe level flag; records
+/// without one count as info.
+enum class loglevel : std::uint32_t
 {
-public:
-  logger()                          = delete;
-  logger(const logger&)             = delete;
-  logger(logger&&)                  = delete;
-  logger& operator=(logger&&)       = delete;
-  logger& operator=(const logger&)  = delete;
-
-  explicit logger(logflag);
-  explicit logger(std::string_view, logflag);
-  ~logger();
+  debug,
+  info,
+  warn,
+  error,
+  off
+};
 
-  template <typename T>
-  inline logger&  operator<<(T&& data) & = delete;
-  template <typename T>
-  inline logger&& operator<<(T&& data) &&;
+constexpr loglevel level_of(logflag flags) noexcept
+{
+  const std::uint32_t bits = static_cast<std::uint32_t>(flags);
+  if ( (bits & logflag::error) > 0) return loglevel::error;
+  if ( (bits & logflag::warn ) > 0) return loglevel::warn;
+  if ( (bits & logflag::info ) > 0) return loglevel::info;
+  if ( (bits & logflag::debug) > 0) return loglevel::debug;
+  return loglevel::info;
+}
 
-private:
-  inline std::string type()                     & noexcept;
-  inline std::string colorize(std::string_view) &;
-  inline std::string unixtime()           const &;
-  inline std::string time()               const &;
-  inline void        logging()                  &;
-
-#if !defined(__linux__) && !defined(__FreeBSD__)
-  constexpr
+/// Records below HAIFISCH_LOG_LEVEL (0 debug, 1 info, 2 warn, 3 error,
+/// 4 off) are compiled out of HAIFISCH_LOG statements.
+#ifndef HAIFISCH_LOG_LEVEL
+# define HAIFISCH_LOG_LEVEL 0
 #endif
-  inline std::string_view begin_color()   const & noexcept;
 
-#if !defined(__linux__) && !defined(__FreeBSD__)
-  constexpr
-#endif
-  inline std::string_view end_color()     const & noexcept;
+/// HAIFISCH_LOG(flags) << a << b; logs like logger(flags) << a << b, but
+/// when flags fall below the compile-time or the runtime threshold neither
+/// a nor b is evaluated. Expands to an if/else, so it is a statement, not an
+/// expression.
+#define HAIFISCH_LOG(flags) \
+  if (!logger::enabled(flags)) { } else logger(flags)
 
-  static inline
-  std::stringstream   ss;
-  std::uint32_t       flags;
-  std::string_view    path;
+#define HAIFISCH_LOG_TO(path, flags) \
+  if (!logger::enabled(flags)) { } else logger(path, flags)
 
-#if defined(__linux__) || defined(__FreeBSD__)
-  static inline constexpr std::string_view red    = "\033[0;31m";
-  static inline constexpr std::string_view green  = "\033[0;32m";
-  static inline constexpr std::string_view yellow = "\033[0;33m";
-  static inline constexpr std::string_view purple = "\033[0;35m";
-  static inline constexpr std::string_view gray   = "\033[0;90m";
-  static inline constexpr std::string_view eoc    = "\033[0;0m";
-#endif
+namespace logging
+{
+/// Records are queued as a binary sequence of arguments, each a tag byte
+/// followed by the raw value; text is length-prefixed. The writer thread
+/// turns them into characters, so the hot path only copies bytes.
+enum class argument : char
+{
+  text,
+  character,
+  signed_integer,
+  unsigned_integer,
+  floating
 };
 
-template<typename T>
-inline logger&& logger::operator<<(T&& data) &&
+template <typename T>
+inline void put(std::string& out, argument tag, T value)
 {
-  if ( (flags & logflag::newline         ) > 0) ss << '\n';
-
-  if ( (flags & logflag::box_bracekts    ) > 0) ss << '[';
-  if ( (flags & logflag::chevrons        ) > 0) ss << '<';
-  if ( (flags & logflag::curly_brackets  ) > 0) ss << '{';
-  if ( (flags & logflag::round_brackets  ) > 0) ss << '(';
-
-  ss << data;
-
-  if ( (flags & logflag::round_brackets  ) > 0) ss << ')';
-  if ( (flags & logflag::curly_brackets  ) > 0) ss << '}';
-  if ( (flags & logflag::chevrons        ) > 0) ss << '>';
-  if ( (flags & logflag::box_bracekts    ) > 0) ss << ']';
-
-  if ( (flags & logflag::spaces          ) > 0) ss << ' ';
-
-  return std::move(*this);
+  char bytes[1 + sizeof(T)];
+  bytes[0] = static_cast<char>(tag);
+  std::memcpy(bytes + 1, &value, sizeof(T));
+  out.append(bytes, sizeof(bytes));
 }
 
+inline void put_text(std::string& out, std::string_view text)
+{
+  put(out, argument::text, static_cast<std::uint32_t>(text.size()));
+  out.append(text);
+}
 
-#include <iostream>
-#include <fstream>
-#include <ctime>
-#include <mutex>
-#include <cstring>
-
-
-logger::logger(logflag logflags)
-  : flags   (static_cast<std::uint32_t>(logflags))
-  , path    ("")
-{ }
+/// Streambuf appending to a string the owning thread reuses for every
+/// message, so formatting does not allocate once the string has grown.
+class string_buffer : public std::streambuf
+{
+public:
+  std::string text;
 
-logger::logger(std::string_view filename, logflag logflags)
-  : flags   (static_cast<std::uint32_t>(logflags))
-  , path    (filename)
-{ }
+protected:
+  int_type        overflow(int_type c) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+};
 
-std::string logger::time() const &
+/// Per-thread formatting state. Loggers alive at the same time on one thread
+/// nest strictly, so each one owns the tail of text from the offset it
+/// started at.
+struct thread_buffer
 {
-  long now = std::time(nullptr);
-
-  std::string time(25, 0);
-  std::strftime(&time[0], time.size(), "[%Y-%m-%d %H:%M:%S]", std::localtime(&now));
+  string_buffer buffer;
+  std::ostream  stream { &buffer };
+};
 
-  return time;
-}
+thread_buffer& local_buffer() noexcept;
+} // namespace logging
 
-std::string logger::unixtime() const &
+/// Captures a record on the calling thread and hands it to a background
+/// writer through a lock-free queue when the temporary dies. Arguments are
+/// stored raw and formatted by the writer, which also prefixes time and
+/// level, colors the line and writes stdout and the log files in batches,
+/// so logging never waits for I/O. Records below the runtime level are
+/// dropped; use HAIFISCH_LOG to skip evaluating their arguments too.
+class logger
 {
-  return "[" + std::to_string(std::time(nullptr)) + "]";
-}
+public:
+  logger()                          = delete;
+  logger(const logger&)             = delete;
+  logger(logger&&)                  = delete;
+  logger& operator=(logger&&)       = delete;
+  logger& operator=(const logger&)  = delete;
 
-#if !defined(__linux__) && !defined(__FreeBSD__)
-constexpr
-#endif
-std::string_view logger::begin_color() const & noexcept
-{
-#if defined(__linux__) || defined(__FreeBSD__)
-  if ( (flags & logflag::red     ) > 0) return red;
-  if ( (flags & logflag::green   ) > 0) return green;
-  if ( (flags & logflag::purple  ) > 0) return purple;
-  if ( (flags & logflag::yellow  ) > 0) return yellow;
-  if ( (flags & logflag::gray    ) > 0) return gray;
-#endif
-  return "";
-}
+  explicit logger(logflag);
+  explicit logger(std::string_view, logflag);
+  ~logger();
 
-#if !defined(__linux__) && !defined(__FreeBSD__)
-constexpr
-#endif
-std::string_view logger::end_color() const & noexcept
-{
-#if defined(__linux__) || defined(__FreeBSD__)
-  if ( (flags & logflag::red     ) > 0) return eoc;
-  if ( (flags & logflag::green   ) > 0) return eoc;
-  if ( (flags & logflag::purple  ) > 0) return eoc;
-  if ( (flags & logflag::yellow  ) > 0) return eoc;
-  if ( (flags & logflag::gray    ) > 0) return eoc;
-#endif
-  return "";
-}
+  template <typename T>
+  inline logger&  operator<<(T&& data) & = delete;
+  template <typename T>
+  inline logger&& operator<<(T&& data) &&;
 
-std::string logger::type() & noexcept
-{
-  static const logflag all_except_green  = logflag::gray | logflag::red   | logflag::purple | logflag::yellow;
-  static const logflag all_except_gray   = logflag::red  | logflag::green | logflag::purple | logflag::yellow;
-  static const logflag all_except_yellow = logflag::red  | logflag::green | logflag::purple | logflag::gray;
-  static const logflag all_except_red    = logflag::gray | logflag::green | logflag::purple | logflag::yellow;
+  /// Blocks until every record logged before the call has been written.
+  static void flush();
+
+  static constexpr loglevel compiled_level = static_cast<loglevel>(HAIFISCH_LOG_LEVEL);
 
-  auto any_of = [&](auto... args) -> bool { return (static_cast<bool>(flags & args) | ... ); };
+  /// Records below level are dropped from now on.
+  static void set_level(loglevel level) noexcept
+  {
+    threshold.store(static_cast<std::uint32_t>(level), std::memory_order_relaxed);
+  }
 
-  std::string flaglist;
+  static loglevel level() noexcept
+  {
+    return static_cast<loglevel>(threshold.load(std::memory_order_relaxed));
+  }
 
-  if ( (flags & logflag::info ) > 0) { flaglist += "[ INFO   ]"; if (!any_of(all_except_green  )) { flags |= logflag::green;  } }
-  if ( (flags & logflag::debug) > 0) { flaglist += "[ DEBUG  ]"; if (!any_of(all_except_gray   )) { flags |= logflag::gray;   } }
-  if ( (flags & logflag::warn ) > 0) { flaglist += "[ WARN   ]"; if (!any_of(all_except_yellow )) { flags |= logflag::yellow; } }
-  if ( (flags & logflag::error) > 0) { flaglist += "[ ERROR  ]"; if (!any_of(all_except_red    )) { flags |= logflag::red;    } }
+  static bool enabled(logflag flags) noexcept
+  {
+    const loglevel severity = level_of(flags);
+    return severity >= compiled_level && static_cast<std::uint32_t>(severity) >= threshold.load(std::memory_order_relaxed);
+  }
 
-  return flaglist;
-}
+private:
+  static inline std::atomic<std::uint32_t> threshold { static_cast<std::uint32_t>(loglevel::debug) };
+
+  std::uint32_t           flags;
+  std::string_view        path;
+  logging::thread_buffer& local;
+  std::size_t             start;
+  std::int64_t            timestamp;
+  bool                    active;
+};
 
-std::string logger::colorize(std::string_view text) &
+template<typename T>
+inline logger&& logger::operator<<(T&& data) &&
 {
-  return std::string { begin_color() } + std::string { text } + std::string { end_color() };
-}
+  if (!active)
+  {
+    return std::move(*this);
+  }
 
-void logger::logging() &
-{
-  std::string source;
-  (((flags & logflag::unixtime) > 0))
-    ? source = unixtime() + ' ' + type() + ' ' + ss.str() + '\n'
-    : source =     time() + ' ' + type() + ' ' + ss.str() + '\n';
+  using logging::argument;
+  using value_type = std::decay_t<T>;
+  std::string& out = local.buffer.text;
 
-  if (!((flags & logflag::no_sync_with_stdio) > 0))
+  if constexpr (std::is_convertible_v<const value_type&, std::string_view>)
   {
-    std::ios::sync_with_stdio(false);
+    logging::put_text(out, std::string_view { data });
   }
-  if (!((flags & logflag::nostdout) > 0))
+  else if constexpr (std::is_same_v<value_type, char> || std::is_same_v<value_type, signed char>
+                     || std::is_same_v<value_type, unsigned char>)
   {
-    std::cout << colorize(source) << std::flush;
+    logging::put(out, argument::character, static_cast<char>(data));
   }
-
-  if (!path.empty())
+  else if constexpr (std::is_integral_v<value_type> && std::is_signed_v<value_type>)
   {
-    static std::ofstream ofs(path.data(), std::ios::app);
-    ofs.write(source.c_str(), source.size());
+    logging::put(out, argument::signed_integer, static_cast<std::int64_t>(data));
+  }
+  else if constexpr (std::is_integral_v<value_type>)
+  {
+    logging::put(out, argument::unsigned_integer, static_cast<std::uint64_t>(data));
+  }
+  else if constexpr (std::is_same_v<value_type, float> || std::is_same_v<value_type, double>)
+  {
+    logging::put(out, argument::floating, static_cast<double>(data));
+  }
+  else
+  {
+    // Anything else is formatted here through its operator<<, into the
+    // length-prefixed text slot.
+    logging::put(out, argument::text, std::uint32_t {});
+    const std::size_t begin = out.size();
+    local.stream << data;
+    const auto size = static_cast<std::uint32_t>(out.size() - begin);
+    std::memcpy(&out[begin - sizeof(size)], &size, sizeof(size));
   }
-  ss.str("");
-  ss.clear();
-}
 
-logger::~logger()
-{
-  static std::mutex mtx;
-  std::lock_guard<decltype(mtx)> guard(mtx);
-  if (ss.rdbuf()->in_avail())
-    logging();
+  return std::move(*this);
 }